@@ -202,6 +202,7 @@ int boot_arm_linux(struct boot_info *bi, void *fdt, FitImageNode *kernel)
 		return 1;
 
 	timestamp_add_now(TS_KERNEL_DECOMPRESSION);
+	uint64_t start_us = timer_us(0);
 
 	size_t true_size = fit_decompress(kernel, reloc_addr, image_size);
 	if (!true_size) {
@@ -209,6 +210,10 @@ int boot_arm_linux(struct boot_info *bi, void *fdt, FitImageNode *kernel)
 		return 1;
 	}
 
+	timestamp_add_now(TS_KERNEL_DECOMPRESSION_DONE);
+	printf("Kernel: %u -> %zu bytes in %llu ms\n", kernel->size, true_size,
+	       timer_us(start_us) / USECS_PER_MSEC);
+
 	if (CONFIG(BOOTCONFIG))
 		append_android_bootconfig_boottime(bi);
 
@@ -21,14 +21,11 @@
  */
 
 #include <libpayload.h>
-#include <endian.h>
-
-#include "crc32.h"
 
+#include "base/crc32.h"
 
 static int crc_table_empty = 1;
-static uint32_t crc_table[256];
-static void make_crc_table (void);
+static uint32_t crc_table[8][256];
 
 /*
   Generate a table for a byte-wise 32-bit CRC calculation on the polynomial:
@@ -53,6 +50,10 @@ static void make_crc_table (void);
   The table is simply the CRC of all possible eight bit values.  This is all
   the information needed to generate CRC's on data a byte at a time for all
   combinations of CRC register values and incoming bytes.
+
+  For slice-by-8, table k holds the CRC of each byte value followed by k zero
+  bytes, so that eight bytes can be folded into the register with eight
+  independent lookups instead of a chain of eight dependent ones.
 */
 /* terms of polynomial defining this crc (except x^32): */
 static const uint8_t p[] = {0,1,2,4,5,7,8,10,11,12,16,22,23,26};
@@ -72,61 +73,97 @@ static void make_crc_table(void)
 		c = (uint32_t)n;
 		for (k = 0; k < 8; k++)
 			c = c & 1 ? poly ^ (c >> 1) : c >> 1;
-		crc_table[n] = htole32(c);
+		crc_table[0][n] = c;
+	}
+
+	for (n = 0; n < 256; n++) {
+		c = crc_table[0][n];
+		for (k = 1; k < 8; k++) {
+			c = crc_table[0][c & 0xff] ^ (c >> 8);
+			crc_table[k][n] = c;
+		}
 	}
 	crc_table_empty = 0;
 }
 
 /* ========================================================================= */
-#  define DO_CRC(x) crc = tab[(crc ^ (x)) & 255] ^ (crc >> 8)
-
-/* ========================================================================= */
+#define DO_CRC(x) crc = crc_table[0][(crc ^ (x)) & 0xff] ^ (crc >> 8)
 
-/* No ones complement version. JFFS2 (and other things ?)
- * don't use ones compliment in their CRC calculations.
- */
-static uint32_t crc32_no_comp(uint32_t crc, const void *p, unsigned len)
+/* All supported architectures are little endian. */
+uint32_t crc32_le_sw(uint32_t crc, const void *p, size_t len)
 {
 	const uint8_t *buf = p;
-	const uint32_t *tab = crc_table;
-	const uint32_t *b =(const uint32_t *)buf;
-	size_t rem_len;
+
 	if (crc_table_empty)
 		make_crc_table();
-	crc = htole32(crc);
-	/* Align it */
-	if (((long)b) & 3 && len) {
-		uint8_t *p = (uint8_t *)b;
-		do {
-			DO_CRC(*p++);
-		} while ((--len) && ((long)p)&3);
-		b = (uint32_t *)p;
-	}
 
-	rem_len = len & 3;
-	len = len >> 2;
-	for (--b; len; --len) {
-		/* load data 32 bits wide, xor data 32 bits wide. */
-		crc ^= *++b; /* use pre increment for speed */
-		DO_CRC(0);
-		DO_CRC(0);
-		DO_CRC(0);
-		DO_CRC(0);
-	}
-	len = rem_len;
-	/* And the last few bytes */
-	if (len) {
-		uint8_t *p = (uint8_t *)(b + 1) - 1;
-		do {
-			DO_CRC(*++p); /* use pre increment for speed */
-		} while (--len);
+	for (; len && !IS_ALIGNED((uintptr_t)buf, sizeof(uint32_t)); len--)
+		DO_CRC(*buf++);
+
+	for (; len >= 8; len -= 8, buf += 8) {
+		uint32_t lo = ((const uint32_t *)buf)[0] ^ crc;
+		uint32_t hi = ((const uint32_t *)buf)[1];
+
+		crc = crc_table[7][lo & 0xff] ^
+		      crc_table[6][(lo >> 8) & 0xff] ^
+		      crc_table[5][(lo >> 16) & 0xff] ^
+		      crc_table[4][lo >> 24] ^
+		      crc_table[3][hi & 0xff] ^
+		      crc_table[2][(hi >> 8) & 0xff] ^
+		      crc_table[1][(hi >> 16) & 0xff] ^
+		      crc_table[0][hi >> 24];
 	}
 
-	return le32toh(crc);
+	while (len--)
+		DO_CRC(*buf++);
+
+	return crc;
 }
 #undef DO_CRC
 
-uint32_t crc32 (uint32_t crc, const void *p, unsigned len)
+#if CONFIG(CRC32_ARMV8)
+
+static inline uint32_t crc32b(uint32_t crc, uint8_t v)
+{
+	__asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1"
+		: "+r" (crc) : "r" (v));
+	return crc;
+}
+
+static inline uint32_t crc32x(uint32_t crc, uint64_t v)
+{
+	__asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %x1"
+		: "+r" (crc) : "r" (v));
+	return crc;
+}
+
+/* The CRC32B/CRC32X instructions use the same reflected polynomial. */
+uint32_t crc32_le(uint32_t crc, const void *p, size_t len)
+{
+	const uint8_t *buf = p;
+
+	for (; len && !IS_ALIGNED((uintptr_t)buf, sizeof(uint64_t)); len--)
+		crc = crc32b(crc, *buf++);
+
+	for (; len >= 8; len -= 8, buf += 8)
+		crc = crc32x(crc, *(const uint64_t *)buf);
+
+	while (len--)
+		crc = crc32b(crc, *buf++);
+
+	return crc;
+}
+
+#else
+
+uint32_t crc32_le(uint32_t crc, const void *p, size_t len)
+{
+	return crc32_le_sw(crc, p, len);
+}
+
+#endif
+
+uint32_t crc32(uint32_t crc, const void *p, size_t len)
 {
-	return crc32_no_comp(crc ^ 0xffffffffL, p, len) ^ 0xffffffffL;
+	return ~crc32_le(~crc, p, len);
 }
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2014 Google LLC
+ *
+ * See file CREDITS for list of people who contributed to this project.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but without
+ * any warranty; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ */
+
+#ifndef __BASE_CRC32_H__
+#define __BASE_CRC32_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32 on the reflected polynomial 0xedb88320 (zlib, gzip, Ethernet, GPT,
+ * Android sparse images). crc32() is the zlib one: it takes and returns the
+ * finished CRC, so successive calls can be chained and crc32(0, p, len)
+ * computes the CRC of a buffer. crc32_le() is the raw register update
+ * without the ones complement on either side, like Linux's crc32_le().
+ */
+uint32_t crc32(uint32_t crc, const void *p, size_t len);
+uint32_t crc32_le(uint32_t crc, const void *p, size_t len);
+
+/*
+ * Portable slice-by-8 implementation of crc32_le(), which is used when no
+ * hardware backend is configured. Exposed for testing.
+ */
+uint32_t crc32_le_sw(uint32_t crc, const void *p, size_t len);
+
+#endif /* __BASE_CRC32_H__ */
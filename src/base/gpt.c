@@ -230,8 +230,16 @@ enum gpt_io_ret gpt_erase_partition(BlockDev *disk, GptData *gpt,
 		return GPT_IO_NO_PARTITION;
 
 	lba_t space = GptGetEntrySizeLba(e);
-	if ((disk->ops.erase == NULL) ||
-	    disk->ops.erase(&disk->ops, e->starting_lba, space)) {
+	bool erased = false;
+
+	if (disk->ops.erase) {
+		lba_t count = disk->ops.erase(&disk->ops, e->starting_lba, space);
+
+		/* Unless enabled, the erase is followed by the fill below as well */
+		erased = CONFIG(SPARSE_WRITE_ERASE) && count == space;
+	}
+
+	if (!erased) {
 		/*
 		 * TODO(b/396352272): This is workaround to unblock flows that require erasing
 		 * large partitions. Erase just the beginning of the partition. This approach
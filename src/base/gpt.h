@@ -64,6 +64,7 @@ enum gpt_io_ret {
 	GPT_IO_SPARSE_WRONG_HEADER_SIZE,
 	GPT_IO_SPARSE_WRONG_CHUNK_SIZE,
 	GPT_IO_SPARSE_WRONG_CHUNK_TYPE,
+	GPT_IO_SPARSE_WRONG_MAGIC,
 };
 
 /*
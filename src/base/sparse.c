@@ -19,48 +19,10 @@
 #include <stdint.h>
 
 #include "base/sparse.h"
+#include "drivers/storage/bouncebuf.h"
 
 /********************** Sparse Image Handling ****************************/
 
-/*
- * Sparse Image Header.
- * The canonical definition of the sparse format (including the magic values
- * from below) is in AOSP's libsparse:
- * https://android.googlesource.com/platform/system/core/+/refs/heads/master/libsparse/sparse_format.h
- */
-struct sparse_image_hdr {
-	/* Magic number for sparse image 0xed26ff3a. */
-	uint32_t magic;
-	/* Major version = 0x1 */
-	uint16_t major_version;
-	uint16_t minor_version;
-	uint16_t file_hdr_size;
-	uint16_t chunk_hdr_size;
-	/* Size of block in bytes. */
-	uint32_t blk_size;
-	/* # of blocks in the non-sparse image. */
-	uint32_t total_blks;
-	/* # of chunks in the sparse image. */
-	uint32_t total_chunks;
-	uint32_t image_checksum;
-};
-
-#define SPARSE_IMAGE_MAGIC 0xed26ff3a
-#define CHUNK_TYPE_RAW 0xCAC1
-#define CHUNK_TYPE_FILL 0xCAC2
-#define CHUNK_TYPE_DONT_CARE 0xCAC3
-#define CHUNK_TYPE_CRC32 0xCAC4
-
-/* Chunk header in sparse image */
-struct sparse_chunk_hdr {
-	uint16_t type;
-	uint16_t reserved;
-	/* Chunk size is in number of blocks */
-	uint32_t size_in_blks;
-	/* Size in bytes of chunk header and data */
-	uint32_t total_size_bytes;
-};
-
 /* Check if given image is sparse */
 int is_sparse_image(void *image_addr)
 {
@@ -71,61 +33,63 @@ int is_sparse_image(void *image_addr)
 		(hdr->major_version == 0x1));
 }
 
-struct img_buff {
-	void *data;
-	uint64_t size;
-};
+unsigned int sparse_default_policy(void)
+{
+	unsigned int policy = 0;
 
-/*
- * Initialize img_buff structure with passed in data and size. Verifies that
- * buff and data is not NULL.
- * Returns 0 on success and -1 on error.
- */
-static int img_buff_init(struct img_buff *buff, void *data, uint64_t size)
+	if (CONFIG(SPARSE_WRITE_ERASE))
+		policy |= SPARSE_WRITE_ERASE_ZERO_FILL | SPARSE_WRITE_ERASE_DONT_CARE;
+	if (CONFIG(SPARSE_WRITE_MERGE_RAW))
+		policy |= SPARSE_WRITE_MERGE_RAW;
+
+	return policy;
+}
+
+/* Record the error that stopped decoding */
+static enum gpt_io_ret sparse_stream_fail(struct sparse_stream *ss, enum gpt_io_ret ret)
 {
-	if ((buff == NULL) || (data == NULL))
-		return -1;
+	ss->state = SPARSE_STREAM_ERROR;
+	ss->error = ret;
 
-	buff->data = data;
-	buff->size = size;
+	return ret;
+}
 
-	return 0;
+void sparse_stream_init(struct sparse_stream *ss, BlockDev *disk, uint64_t part_start,
+			uint64_t part_size, unsigned int policy)
+{
+	memset(ss, 0, sizeof(*ss));
+	ss->disk = disk;
+	ss->policy = policy;
+	ss->part_start = part_start;
+	ss->part_size = part_size;
+	ss->state = SPARSE_STREAM_FILE_HDR;
+	ss->error = GPT_IO_SUCCESS;
 }
 
 /*
- * Obtain current pointer to data and advance data pointer by size. If there is
- * not enough data to advance, then it returns NULL.
+ * Copy up to size bytes of a header or chunk payload into dst, continuing where the previous
+ * feed call stopped. Returns true once all size bytes were collected.
  */
-static void *img_buff_advance(struct img_buff *buff, uint64_t size)
+static bool sparse_stream_collect(struct sparse_stream *ss, void *dst, size_t size,
+				  const uint8_t **data, uint64_t *len)
 {
-	void *data;
+	size_t n = MIN(size - ss->collect_len, *len);
 
-	if (buff->size < size)
-		return NULL;
+	memcpy((uint8_t *)dst + ss->collect_len, *data, n);
+	ss->collect_len += n;
+	*data += n;
+	*len -= n;
 
-	data = buff->data;
-	buff->data = (uint8_t *)(buff->data) + size;
-	buff->size -= size;
+	if (ss->collect_len < size)
+		return false;
 
-	return data;
+	ss->collect_len = 0;
+	return true;
 }
 
-/* Write sparse image to the disk */
-enum gpt_io_ret write_sparse_image(BlockDev *disk, uint64_t part_start,
-				   uint64_t part_size, void *image_addr,
-				   uint64_t image_size)
+static enum gpt_io_ret sparse_stream_parse_file_hdr(struct sparse_stream *ss)
 {
-	struct img_buff buff;
-	struct sparse_image_hdr *img_hdr;
-	struct sparse_chunk_hdr *chunk_hdr;
-
-	if (img_buff_init(&buff, image_addr, image_size))
-		return GPT_IO_SPARSE_TOO_SMALL;
-
-	img_hdr = img_buff_advance(&buff, sizeof(*img_hdr));
-
-	if (img_hdr == NULL)
-		return GPT_IO_SPARSE_TOO_SMALL;
+	struct sparse_image_hdr *img_hdr = &ss->img_hdr;
 
 	TRACE_SPARSE("Magic          : %x\n", img_hdr->magic);
 	TRACE_SPARSE("Major Version  : %x\n", img_hdr->major_version);
@@ -137,140 +101,298 @@ enum gpt_io_ret write_sparse_image(BlockDev *disk, uint64_t part_start,
 	TRACE_SPARSE("Total chunks   : %x\n", img_hdr->total_chunks);
 	TRACE_SPARSE("Checksum       : %x\n", img_hdr->image_checksum);
 
+	if (!is_sparse_image(img_hdr))
+		return sparse_stream_fail(ss, GPT_IO_SPARSE_WRONG_MAGIC);
+
 	/* Is image header size as expected? */
 	if (img_hdr->file_hdr_size != sizeof(*img_hdr))
-		return GPT_IO_SPARSE_WRONG_HEADER_SIZE;
+		return sparse_stream_fail(ss, GPT_IO_SPARSE_WRONG_HEADER_SIZE);
 
 	/* Is chunk header size as expected? */
-	if (img_hdr->chunk_hdr_size != sizeof(*chunk_hdr))
-		return GPT_IO_SPARSE_WRONG_HEADER_SIZE;
-
-	int i;
-	BlockDevOps *ops = &disk->ops;
-
-	/* Perform the following operation on each chunk */
-	for (i = 0; i < img_hdr->total_chunks; i++) {
-		/* Get chunk header */
-		chunk_hdr = img_buff_advance(&buff, sizeof(*chunk_hdr));
-
-		if (chunk_hdr == NULL)
-			return GPT_IO_SPARSE_TOO_SMALL;
-
-		TRACE_SPARSE("Chunk %d\n", i);
-		TRACE_SPARSE("Type         : %x\n", chunk_hdr->type);
-		TRACE_SPARSE("Size in blks : %x\n", chunk_hdr->size_in_blks);
-		TRACE_SPARSE("Total size   : %x\n", chunk_hdr->total_size_bytes);
-		TRACE_SPARSE("Part addr    : %llx\n", part_start);
-
-		/* Size in bytes of the area occupied by chunk range */
-		const uint64_t chunk_size =
-			(uint64_t)chunk_hdr->size_in_blks * img_hdr->blk_size;
-
-		/* Should not write past partition size */
-		if (part_size < chunk_size) {
-			TRACE_SPARSE("part_size:%llx\n", part_size);
-			TRACE_SPARSE("chunk_size:%llx\n", chunk_size);
-			return GPT_IO_OUT_OF_RANGE;
-		}
+	if (img_hdr->chunk_hdr_size != sizeof(struct sparse_chunk_hdr))
+		return sparse_stream_fail(ss, GPT_IO_SPARSE_WRONG_HEADER_SIZE);
 
-		switch (chunk_hdr->type) {
-		case CHUNK_TYPE_RAW: {
+	ss->chunks_left = img_hdr->total_chunks;
+	ss->state = ss->chunks_left ? SPARSE_STREAM_CHUNK_HDR : SPARSE_STREAM_DONE;
 
-			uint8_t *data_ptr;
+	return GPT_IO_SUCCESS;
+}
 
-			/*
-			 * For Raw chunk type:
-			 * chunk_size + chunk_hdr_size = chunk_total_size
-			 */
-			if ((chunk_size + sizeof(*chunk_hdr)) != chunk_hdr->total_size_bytes) {
-				TRACE_SPARSE("chunk_size_bytes:%llx\n",
-					     chunk_size + sizeof(*chunk_hdr));
-				TRACE_SPARSE("total_size_bytes:%x\n",
-					     chunk_hdr->total_size_bytes);
-				return GPT_IO_SPARSE_WRONG_CHUNK_SIZE;
-			}
+/* Write out RAW data coalesced in the buffer */
+static enum gpt_io_ret sparse_stream_flush(struct sparse_stream *ss)
+{
+	if (ss->buf_used == 0)
+		return GPT_IO_SUCCESS;
 
-			data_ptr = img_buff_advance(&buff, chunk_size);
-			if (data_ptr == NULL)
-				return GPT_IO_SPARSE_TOO_SMALL;
+	if (blockdev_write_bytes(&ss->disk->ops, ss->buf_addr, ss->buf, ss->buf_used) !=
+	    ss->buf_used)
+		return sparse_stream_fail(ss, GPT_IO_TRANSFER_ERROR);
 
-			if (blockdev_write_bytes(ops, part_start, data_ptr, chunk_size) !=
-			    chunk_size)
-				return GPT_IO_TRANSFER_ERROR;
+	ss->buf_addr += ss->buf_used;
+	ss->buf_used = 0;
 
-			break;
-		}
-		case CHUNK_TYPE_FILL: {
-
-			uint32_t *data_fill;
-
-			/*
-			 * For fill chunk type:
-			 * chunk_hdr_size + 4 bytes = chunk_total_size_bytes
-			 */
-			if (sizeof(uint32_t) + sizeof(*chunk_hdr) !=
-			    chunk_hdr->total_size_bytes) {
-				TRACE_SPARSE("chunk_size_bytes:%zx\n",
-					     sizeof(uint32_t) + sizeof(*chunk_hdr));
-				TRACE_SPARSE("total_size_bytes:%x\n",
-					     chunk_hdr->total_size_bytes);
-				return GPT_IO_SPARSE_WRONG_CHUNK_SIZE;
-			}
-
-			data_fill = img_buff_advance(&buff, sizeof(*data_fill));
-			if (!data_fill)
-				return GPT_IO_SPARSE_TOO_SMALL;
-
-			/* Perform fill_write operation */
-			if (blockdev_fill_write_bytes(ops, part_start, chunk_size,
-						*data_fill) != chunk_size)
-				return GPT_IO_TRANSFER_ERROR;
+	return GPT_IO_SUCCESS;
+}
+
+/* Advance the disk address past the current chunk */
+static enum gpt_io_ret sparse_stream_next_chunk(struct sparse_stream *ss)
+{
+	ss->part_start += ss->chunk_size;
+	ss->part_size -= ss->chunk_size;
+
+	if (--ss->chunks_left) {
+		ss->state = SPARSE_STREAM_CHUNK_HDR;
+		return GPT_IO_SUCCESS;
+	}
+
+	/* Write out RAW data still held back for merging */
+	if (sparse_stream_flush(ss) != GPT_IO_SUCCESS)
+		return ss->error;
+
+	ss->state = SPARSE_STREAM_DONE;
+	return GPT_IO_SUCCESS;
+}
 
+/*
+ * Erase the whole blocks inside [addr, addr + size). On success, *head and *tail are set to
+ * the number of bytes before and after them that were not erased.
+ */
+static bool sparse_stream_erase_blocks(struct sparse_stream *ss, uint64_t addr,
+				       uint64_t size, uint64_t *head, uint64_t *tail)
+{
+	BlockDevOps *ops = &ss->disk->ops;
+	const uint64_t block_size = ss->disk->block_size;
+	const uint64_t start = ALIGN_UP(addr, block_size);
+	const uint64_t end = ALIGN_DOWN(addr + size, block_size);
+	const lba_t blocks = (end - start) / block_size;
+
+	if (ops->erase == NULL || start >= end)
+		return false;
+
+	if (ops->erase(ops, start / block_size, blocks) != blocks)
+		return false;
+
+	*head = start - addr;
+	*tail = addr + size - end;
+
+	return true;
+}
+
+static enum gpt_io_ret sparse_stream_parse_chunk_hdr(struct sparse_stream *ss)
+{
+	struct sparse_chunk_hdr *chunk_hdr = &ss->chunk_hdr;
+	uint64_t expected_size;
+
+	TRACE_SPARSE("Chunk %d\n", ss->img_hdr.total_chunks - ss->chunks_left);
+	TRACE_SPARSE("Type         : %x\n", chunk_hdr->type);
+	TRACE_SPARSE("Size in blks : %x\n", chunk_hdr->size_in_blks);
+	TRACE_SPARSE("Total size   : %x\n", chunk_hdr->total_size_bytes);
+	TRACE_SPARSE("Part addr    : %llx\n", ss->part_start);
+
+	/* Size in bytes of the area occupied by chunk range */
+	ss->chunk_size = (uint64_t)chunk_hdr->size_in_blks * ss->img_hdr.blk_size;
+
+	/* Should not write past partition size */
+	if (ss->part_size < ss->chunk_size) {
+		TRACE_SPARSE("part_size:%llx\n", ss->part_size);
+		TRACE_SPARSE("chunk_size:%llx\n", ss->chunk_size);
+		return sparse_stream_fail(ss, GPT_IO_OUT_OF_RANGE);
+	}
+
+	switch (chunk_hdr->type) {
+	case CHUNK_TYPE_RAW:
+		/* chunk_size + chunk_hdr_size = chunk_total_size */
+		expected_size = ss->chunk_size + sizeof(*chunk_hdr);
+		break;
+	case CHUNK_TYPE_FILL:
+	case CHUNK_TYPE_CRC32:
+		/* chunk_hdr_size + 4 bytes = chunk_total_size_bytes */
+		expected_size = sizeof(uint32_t) + sizeof(*chunk_hdr);
+		break;
+	case CHUNK_TYPE_DONT_CARE:
+		/* chunk_hdr_size = chunk_total_size_bytes, no data in sparse image */
+		expected_size = sizeof(*chunk_hdr);
+		break;
+	default:
+		/* Unknown chunk type */
+		TRACE_SPARSE("Unknown chunk type %d\n", chunk_hdr->type);
+		return sparse_stream_fail(ss, GPT_IO_SPARSE_WRONG_CHUNK_TYPE);
+	}
+
+	if (expected_size != chunk_hdr->total_size_bytes) {
+		TRACE_SPARSE("chunk_size_bytes:%llx\n", expected_size);
+		TRACE_SPARSE("total_size_bytes:%x\n", chunk_hdr->total_size_bytes);
+		return sparse_stream_fail(ss, GPT_IO_SPARSE_WRONG_CHUNK_SIZE);
+	}
+
+	/* Merged RAW data ends where a chunk of another type begins */
+	if (chunk_hdr->type != CHUNK_TYPE_RAW && sparse_stream_flush(ss) != GPT_IO_SUCCESS)
+		return ss->error;
+
+	switch (chunk_hdr->type) {
+	case CHUNK_TYPE_RAW:
+		ss->raw_left = ss->chunk_size;
+		/* With SPARSE_WRITE_MERGE_RAW the buffer may still hold the previous chunk */
+		if (ss->buf_used == 0)
+			ss->buf_addr = ss->part_start;
+		if (ss->raw_left)
+			ss->state = SPARSE_STREAM_RAW;
+		else
+			return sparse_stream_next_chunk(ss);
+		break;
+	case CHUNK_TYPE_FILL:
+		ss->state = SPARSE_STREAM_FILL;
+		break;
+	case CHUNK_TYPE_CRC32:
+		ss->state = SPARSE_STREAM_CRC32;
+		break;
+	default: {
+		uint64_t head, tail;
+
+		/* Content doesn't matter, so failing to discard it is fine */
+		if (ss->policy & SPARSE_WRITE_ERASE_DONT_CARE)
+			sparse_stream_erase_blocks(ss, ss->part_start, ss->chunk_size, &head,
+						   &tail);
+		return sparse_stream_next_chunk(ss);
+	}
+	}
+
+	return GPT_IO_SUCCESS;
+}
+
+static enum gpt_io_ret sparse_stream_raw(struct sparse_stream *ss, const uint8_t **data,
+					 uint64_t *len)
+{
+	const bool merge = ss->policy & SPARSE_WRITE_MERGE_RAW;
+	uint64_t n = MIN(*len, ss->raw_left);
+
+	if (ss->buf_used == 0 &&
+	    ((n == ss->raw_left && !merge) || n >= SPARSE_STREAM_BUF_BYTES)) {
+		/*
+		 * Large pieces go to the disk straight from the caller's memory. Unless this
+		 * completes the chunk, stop on a block boundary so the next write starts
+		 * aligned.
+		 */
+		if (n != ss->raw_left)
+			n = ALIGN_DOWN(n, ss->disk->block_size);
+
+		if (blockdev_write_bytes(&ss->disk->ops, ss->buf_addr, *data, n) != n)
+			return sparse_stream_fail(ss, GPT_IO_TRANSFER_ERROR);
+
+		ss->buf_addr += n;
+	} else {
+		if (ss->buf == NULL)
+			ss->buf = xmemalign(ARCH_DMA_MINALIGN, SPARSE_STREAM_BUF_BYTES);
+
+		n = MIN(n, SPARSE_STREAM_BUF_BYTES - ss->buf_used);
+		memcpy(ss->buf + ss->buf_used, *data, n);
+		ss->buf_used += n;
+	}
+
+	*data += n;
+	*len -= n;
+	ss->raw_left -= n;
+
+	/* When merging, the next chunk header decides whether to write the buffer out */
+	if (ss->buf_used == SPARSE_STREAM_BUF_BYTES || (ss->raw_left == 0 && !merge)) {
+		if (sparse_stream_flush(ss) != GPT_IO_SUCCESS)
+			return ss->error;
+	}
+
+	if (ss->raw_left == 0)
+		return sparse_stream_next_chunk(ss);
+
+	return GPT_IO_SUCCESS;
+}
+
+static enum gpt_io_ret sparse_stream_fill(struct sparse_stream *ss)
+{
+	BlockDevOps *ops = &ss->disk->ops;
+	uint64_t head, tail;
+
+	if (ss->word == 0 && (ss->policy & SPARSE_WRITE_ERASE_ZERO_FILL) &&
+	    ss->disk->erase_zeroes &&
+	    sparse_stream_erase_blocks(ss, ss->part_start, ss->chunk_size, &head, &tail)) {
+		/* Only the partial blocks at the edges still have to be written */
+		if (blockdev_fill_write_bytes(ops, ss->part_start, head, 0) != head ||
+		    blockdev_fill_write_bytes(ops, ss->part_start + ss->chunk_size - tail,
+					      tail, 0) != tail)
+			return sparse_stream_fail(ss, GPT_IO_TRANSFER_ERROR);
+	} else if (blockdev_fill_write_bytes(ops, ss->part_start, ss->chunk_size,
+					     ss->word) != ss->chunk_size) {
+		/* Perform fill_write operation */
+		return sparse_stream_fail(ss, GPT_IO_TRANSFER_ERROR);
+	}
+
+	return sparse_stream_next_chunk(ss);
+}
+
+enum gpt_io_ret sparse_stream_feed(struct sparse_stream *ss, const void *data, uint64_t len)
+{
+	const uint8_t *ptr = data;
+	enum gpt_io_ret ret = GPT_IO_SUCCESS;
+
+	while (len && ret == GPT_IO_SUCCESS) {
+		switch (ss->state) {
+		case SPARSE_STREAM_FILE_HDR:
+			if (sparse_stream_collect(ss, &ss->img_hdr, sizeof(ss->img_hdr), &ptr,
+						  &len))
+				ret = sparse_stream_parse_file_hdr(ss);
 			break;
-		}
-		case CHUNK_TYPE_DONT_CARE: {
-			/*
-			 * For dont care chunk type:
-			 * chunk_hdr_size = chunk_total_size_bytes
-			 * data in sparse image = 0 bytes
-			 */
-			if (sizeof(*chunk_hdr) != chunk_hdr->total_size_bytes) {
-				TRACE_SPARSE("chunk_size_bytes:%zx\n", sizeof(*chunk_hdr));
-				TRACE_SPARSE("total_size_bytes:%x\n",
-					     chunk_hdr->total_size_bytes);
-				return GPT_IO_SPARSE_WRONG_CHUNK_SIZE;
-			}
+		case SPARSE_STREAM_CHUNK_HDR:
+			if (sparse_stream_collect(ss, &ss->chunk_hdr, sizeof(ss->chunk_hdr), &ptr,
+						  &len))
+				ret = sparse_stream_parse_chunk_hdr(ss);
 			break;
-		}
-		case CHUNK_TYPE_CRC32: {
-			/*
-			 * For crc32 chunk type:
-			 * chunk_hdr_size + 4 bytes = chunk_total_size_bytes
-			 */
-			if (sizeof(uint32_t) + sizeof(*chunk_hdr) !=
-			    chunk_hdr->total_size_bytes) {
-				TRACE_SPARSE("chunk_size_bytes:%zx\n",
-					     sizeof(uint32_t) + sizeof(*chunk_hdr));
-				TRACE_SPARSE("total_size_bytes:%x\n",
-					     chunk_hdr->total_size_bytes);
-				return GPT_IO_SPARSE_WRONG_CHUNK_SIZE;
-			}
-
-			/* Data present in chunk sparse image = 4 bytes */
-			if (img_buff_advance(&buff, sizeof(uint32_t)) == NULL)
-				return GPT_IO_SPARSE_TOO_SMALL;
+		case SPARSE_STREAM_RAW:
+			ret = sparse_stream_raw(ss, &ptr, &len);
 			break;
+		case SPARSE_STREAM_FILL:
+			if (sparse_stream_collect(ss, &ss->word, sizeof(ss->word), &ptr, &len))
+				ret = sparse_stream_fill(ss);
+			break;
+		case SPARSE_STREAM_CRC32:
+			/* CRC is not verified, just skip it */
+			if (sparse_stream_collect(ss, &ss->word, sizeof(ss->word), &ptr, &len))
+				ret = sparse_stream_next_chunk(ss);
+			break;
+		case SPARSE_STREAM_DONE:
+			/* Ignore anything following the last chunk */
+			return GPT_IO_SUCCESS;
+		case SPARSE_STREAM_ERROR:
+			return ss->error;
 		}
-		default: {
-			/* Unknown chunk type */
-			TRACE_SPARSE("Unknown chunk type %d\n", chunk_hdr->type);
-			return GPT_IO_SPARSE_WRONG_CHUNK_TYPE;
-		}
-		}
-		/* Update partition address and size accordingly */
-		part_start += chunk_size;
-		part_size -= chunk_size;
 	}
 
-	return 0;
+	return ret;
+}
+
+enum gpt_io_ret sparse_stream_finish(struct sparse_stream *ss)
+{
+	enum gpt_io_ret ret = ss->error;
+
+	if (ss->state != SPARSE_STREAM_DONE && ss->state != SPARSE_STREAM_ERROR)
+		ret = GPT_IO_SPARSE_TOO_SMALL;
+
+	free(ss->buf);
+	ss->buf = NULL;
+	ss->buf_used = 0;
+
+	return ret;
+}
+
+/* Write sparse image to the disk */
+enum gpt_io_ret write_sparse_image(BlockDev *disk, uint64_t part_start,
+				   uint64_t part_size, void *image_addr,
+				   uint64_t image_size)
+{
+	struct sparse_stream ss;
+
+	if (image_addr == NULL)
+		return GPT_IO_SPARSE_TOO_SMALL;
+
+	sparse_stream_init(&ss, disk, part_start, part_size, sparse_default_policy());
+	sparse_stream_feed(&ss, image_addr, image_size);
+
+	return sparse_stream_finish(&ss);
 }
@@ -18,6 +18,9 @@
 #ifndef __BASE_SPARSE_H__
 #define __BASE_SPARSE_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "base/gpt.h"
 #include "drivers/storage/blockdev.h"
 
@@ -27,9 +30,127 @@
 #define TRACE_SPARSE(...)
 #endif
 
+/*
+ * Sparse Image Header.
+ * The canonical definition of the sparse format (including the magic values
+ * from below) is in AOSP's libsparse:
+ * https://android.googlesource.com/platform/system/core/+/refs/heads/master/libsparse/sparse_format.h
+ */
+struct sparse_image_hdr {
+	/* Magic number for sparse image 0xed26ff3a. */
+	uint32_t magic;
+	/* Major version = 0x1 */
+	uint16_t major_version;
+	uint16_t minor_version;
+	uint16_t file_hdr_size;
+	uint16_t chunk_hdr_size;
+	/* Size of block in bytes. */
+	uint32_t blk_size;
+	/* # of blocks in the non-sparse image. */
+	uint32_t total_blks;
+	/* # of chunks in the sparse image. */
+	uint32_t total_chunks;
+	uint32_t image_checksum;
+};
+
+#define SPARSE_IMAGE_MAGIC 0xed26ff3a
+#define CHUNK_TYPE_RAW 0xCAC1
+#define CHUNK_TYPE_FILL 0xCAC2
+#define CHUNK_TYPE_DONT_CARE 0xCAC3
+#define CHUNK_TYPE_CRC32 0xCAC4
+
+/* Chunk header in sparse image */
+struct sparse_chunk_hdr {
+	uint16_t type;
+	uint16_t reserved;
+	/* Chunk size is in number of blocks */
+	uint32_t size_in_blks;
+	/* Size in bytes of chunk header and data */
+	uint32_t total_size_bytes;
+};
+
+/* Size of the buffer used to coalesce RAW chunk data fed in small pieces */
+#define SPARSE_STREAM_BUF_BYTES (1024 * 1024)
+
+/*
+ * Sparse write policy flags.
+ * Zero FILL chunks are erased instead of written, on disks whose erase leaves zeroes.
+ */
+#define SPARSE_WRITE_ERASE_ZERO_FILL	(1 << 0)
+/* DONT_CARE chunks are erased (discarded) instead of left untouched */
+#define SPARSE_WRITE_ERASE_DONT_CARE	(1 << 1)
+/* Adjacent RAW chunks are coalesced and written together */
+#define SPARSE_WRITE_MERGE_RAW		(1 << 2)
+
+enum sparse_stream_state {
+	SPARSE_STREAM_FILE_HDR = 0,
+	SPARSE_STREAM_CHUNK_HDR,
+	SPARSE_STREAM_RAW,
+	SPARSE_STREAM_FILL,
+	SPARSE_STREAM_CRC32,
+	SPARSE_STREAM_DONE,
+	SPARSE_STREAM_ERROR,
+};
+
+/*
+ * Incremental sparse image decoder. The image may be fed in pieces of any size, RAW and
+ * FILL chunks are written to the disk as soon as their data arrives.
+ */
+struct sparse_stream {
+	BlockDev *disk;
+	/* SPARSE_WRITE_* flags */
+	unsigned int policy;
+	/* Disk address in bytes of the next chunk and space left from there */
+	uint64_t part_start;
+	uint64_t part_size;
+
+	enum sparse_stream_state state;
+	/* Result of the first failed operation, sticky once set */
+	enum gpt_io_ret error;
+
+	struct sparse_image_hdr img_hdr;
+	struct sparse_chunk_hdr chunk_hdr;
+	uint32_t chunks_left;
+	/* Disk size in bytes of the current chunk */
+	uint64_t chunk_size;
+
+	/* FILL value or CRC32 of the current chunk */
+	uint32_t word;
+	/* Bytes of the header or word being collected across feed calls */
+	size_t collect_len;
+
+	/* RAW data of the current chunk not yet received */
+	uint64_t raw_left;
+	/* Disk address the coalescing buffer will be written to */
+	uint64_t buf_addr;
+	/* Coalescing buffer for RAW data, allocated on first use */
+	uint8_t *buf;
+	size_t buf_used;
+};
+
 int is_sparse_image(void *image_addr);
+/* Policy used by write_sparse_image(), selected in Kconfig */
+unsigned int sparse_default_policy(void);
 enum gpt_io_ret write_sparse_image(BlockDev *disk, uint64_t part_start,
 				   uint64_t part_size, void *image_addr,
 				   uint64_t image_size);
 
+/*
+ * Start decoding a sparse image into part_size bytes of disk at part_start, writing it
+ * according to the SPARSE_WRITE_* flags in policy.
+ */
+void sparse_stream_init(struct sparse_stream *ss, BlockDev *disk, uint64_t part_start,
+			uint64_t part_size, unsigned int policy);
+/*
+ * Feed the next len bytes of the image. Returns GPT_IO_SUCCESS, or the error that stopped
+ * decoding (further calls return the same error). Bytes following the last chunk are
+ * ignored.
+ */
+enum gpt_io_ret sparse_stream_feed(struct sparse_stream *ss, const void *data, uint64_t len);
+/*
+ * Finish decoding and release the decoder's buffers. Returns GPT_IO_SPARSE_TOO_SMALL if the
+ * image wasn't complete.
+ */
+enum gpt_io_ret sparse_stream_finish(struct sparse_stream *ss);
+
 #endif // __BASE_SPARSE_H__
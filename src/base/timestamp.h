@@ -60,9 +60,16 @@ enum timestamp_id {
 
 	TS_VB_SELECT_AND_LOAD_KERNEL = 1020,
 	TS_VB_EC_VBOOT_DONE = 1030,
+	TS_EC_HASH_START = 1031,
+	TS_EC_HASH_READY = 1032,
 	TS_VB_STORAGE_INIT_DONE = 1040,
+	TS_STORAGE_KICK_START = 1041,
+	TS_STORAGE_KICK_DONE = 1042,
+	TS_STORAGE_FINISH_DONE = 1043,
 	TS_VB_READ_KERNEL_DONE = 1050,
 	TS_VB_AUXFW_SYNC_DONE = 1060,
+	TS_WIPE_MEMORY_START = 1070,
+	TS_WIPE_MEMORY_DONE = 1071,
 	TS_VB_VBOOT_DONE = 1100,
 
 	TS_PVMFW_SETUP_START = 1110,
@@ -74,6 +81,7 @@ enum timestamp_id {
 
 	TS_START_KERNEL = 1101,
 	TS_KERNEL_DECOMPRESSION = 1102,
+	TS_KERNEL_DECOMPRESSION_DONE = 1103,
 };
 
 void timestamp_init(void);
@@ -1,22 +0,0 @@
-/*
- * Copyright 2014 Google LLC
- *
- * See file CREDITS for list of people who contributed to this project.
- *
- * This program is free software; you can redistribute it and/or modify it
- * under the terms of the GNU General Public License as published by the Free
- * Software Foundation; either version 2 of the License, or (at your option)
- * any later version.
- *
- * This program is distributed in the hope that it will be useful, but without
- * any warranty; without even the implied warranty of MERCHANTABILITY or
- * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
- * more details.
- */
-
-#ifndef __BOOT_CRC32_H__
-#define __BOOT_CRC32_H__
-
-uint32_t crc32 (uint32_t crc, const void *p, unsigned len);
-
-#endif /* __BOOT_CRC32_H__ */
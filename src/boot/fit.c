@@ -102,12 +102,65 @@ static void fit_add_default_compats(void)
 	fit_add_compat(strdup(base));
 }
 
-static FitImageNode *find_image(const char *name)
+/*
+ * Unified kernels carry hundreds of FDTs and overlays, and every config
+ * refers to several of them by name, so images are looked up through an
+ * open-addressed hash table instead of walking image_nodes each time.
+ */
+typedef struct FitImageHashEntry
 {
+	uint32_t hash;
 	FitImageNode *image;
+} FitImageHashEntry;
+
+static FitImageHashEntry *image_hash;
+static size_t image_hash_size;	/* power of two */
+
+/* FNV-1a over at most |maxlen| bytes of |str|. */
+static uint32_t fit_hash(const char *str, size_t maxlen)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; maxlen && *str; maxlen--)
+		hash = (hash ^ (uint8_t)*str++) * 16777619u;
+	return hash;
+}
+
+static void image_hash_build(void)
+{
+	FitImageNode *image;
+	size_t count = 0;
+
+	list_for_each(image, image_nodes, list_node)
+		count++;
+
+	/* Keep the load factor at or below one half. */
+	free(image_hash);
+	image_hash_size = 1;
+	while (image_hash_size < 2 * count)
+		image_hash_size <<= 1;
+	image_hash = xzalloc(image_hash_size * sizeof(*image_hash));
+
 	list_for_each(image, image_nodes, list_node) {
-		if (!strcmp(image->name, name))
-			return image;
+		uint32_t hash = fit_hash(image->name, SIZE_MAX);
+		size_t i = hash & (image_hash_size - 1);
+
+		while (image_hash[i].image)
+			i = (i + 1) & (image_hash_size - 1);
+		image_hash[i].hash = hash;
+		image_hash[i].image = image;
+	}
+}
+
+static FitImageNode *find_image(const char *name)
+{
+	uint32_t hash = fit_hash(name, SIZE_MAX);
+	size_t i = hash & (image_hash_size - 1);
+
+	for (; image_hash[i].image; i = (i + 1) & (image_hash_size - 1)) {
+		if (image_hash[i].hash == hash &&
+		    !strcmp(image_hash[i].image->name, name))
+			return image_hash[i].image;
 	}
 	printf("ERROR: Can't find image node %s!\n", name);
 	return NULL;
@@ -138,24 +191,25 @@ static FitImageNode *find_image_with_overlays(const char *name, int bytes,
 	return base;
 }
 
-static void image_node(struct device_tree_node *node)
+static void image_node(void *blob, uint32_t offset)
 {
 	FitImageNode *image = xzalloc(sizeof(*image));
 	image->compression = CompressionNone;
 
-	image->name = node->name;
+	offset += fdt_next_node_name(blob, offset, &image->name);
 
-	struct device_tree_property *prop;
-	list_for_each(prop, node->properties, list_node) {
-		if (!strcmp("data", prop->prop.name)) {
-			image->data = prop->prop.data;
-			image->size = prop->prop.size;
-		} else if (!strcmp("compression", prop->prop.name)) {
-			if (!strcmp("none", prop->prop.data))
+	struct fdt_property prop;
+	int size;
+	for (; (size = fdt_next_property(blob, offset, &prop)); offset += size) {
+		if (!strcmp("data", prop.name)) {
+			image->data = prop.data;
+			image->size = prop.size;
+		} else if (!strcmp("compression", prop.name)) {
+			if (!strcmp("none", prop.data))
 				image->compression = CompressionNone;
-			else if (!strcmp("lzma", prop->prop.data))
+			else if (!strcmp("lzma", prop.data))
 				image->compression = CompressionLzma;
-			else if (!strcmp("lz4", prop->prop.data))
+			else if (!strcmp("lz4", prop.data))
 				image->compression = CompressionLz4;
 			else
 				image->compression = CompressionInvalid;
@@ -165,43 +219,83 @@ static void image_node(struct device_tree_node *node)
 	list_insert_after(&image->list_node, &image_nodes);
 }
 
-static void config_node(struct device_tree_node *node)
+static void config_node(void *blob, uint32_t offset)
 {
 	FitConfigNode *config = xzalloc(sizeof(*config));
-	config->name = node->name;
-
-	struct device_tree_property *prop;
-	list_for_each(prop, node->properties, list_node) {
-		if (!strcmp("kernel", prop->prop.name))
-			config->kernel = find_image(prop->prop.data);
-		else if (!strcmp("fdt", prop->prop.name))
-			config->fdt = find_image_with_overlays(prop->prop.data,
-				prop->prop.size, &config->overlays);
-		else if (!strcmp("ramdisk", prop->prop.name))
-			config->ramdisk = find_image(prop->prop.data);
-		else if (!strcmp("compatible", prop->prop.name))
-			config->compat = prop->prop;
+
+	offset += fdt_next_node_name(blob, offset, &config->name);
+
+	struct fdt_property prop;
+	int size;
+	for (; (size = fdt_next_property(blob, offset, &prop)); offset += size) {
+		if (!strcmp("kernel", prop.name))
+			config->kernel = find_image(prop.data);
+		else if (!strcmp("fdt", prop.name))
+			config->fdt = find_image_with_overlays(prop.data,
+				prop.size, &config->overlays);
+		else if (!strcmp("ramdisk", prop.name))
+			config->ramdisk = find_image(prop.data);
+		else if (!strcmp("compatible", prop.name))
+			config->compat = prop;
 	}
 
 	list_insert_after(&config->list_node, &config_nodes);
 }
 
-static void fit_unpack(struct device_tree *tree, const char **default_config)
+/*
+ * Call |func| on every subnode of the node at |offset|. If |default_name| is
+ * not NULL, it is set to the node's "default" property.
+ */
+static void fit_for_each_subnode(void *blob, uint32_t offset,
+				 void (*func)(void *blob, uint32_t offset),
+				 const char **default_name)
 {
-	struct device_tree_node *child;
-	struct device_tree_node *images = dt_find_node_by_path(tree, "/images",
-							       NULL, NULL, 0);
-	if (images)
-		list_for_each(child, images->children, list_node)
-			image_node(child);
-
-	struct device_tree_node *configs = dt_find_node_by_path(tree,
-		"/configurations", NULL, NULL, 0);
-	if (configs) {
-		*default_config = dt_find_string_prop(configs, "default");
-		list_for_each(child, configs->children, list_node)
-			config_node(child);
+	struct fdt_property prop;
+	int size;
+
+	offset += fdt_next_node_name(blob, offset, NULL);
+	for (; (size = fdt_next_property(blob, offset, &prop)); offset += size) {
+		if (default_name && !strcmp("default", prop.name))
+			*default_name = prop.data;
 	}
+
+	for (; fdt_next_node_name(blob, offset, NULL);
+	     offset += fdt_skip_node(blob, offset))
+		func(blob, offset);
+}
+
+/*
+ * Walk the flat FIT directly rather than unflattening it: the image data is
+ * referenced in place either way, and the FIT can have hundreds of nodes.
+ */
+static void fit_unpack(void *fit, const char **default_config)
+{
+	struct fdt_header *header = fit;
+	uint32_t offset = betohl(header->structure_offset);
+	uint32_t images = 0, configs = 0;
+	struct fdt_property prop;
+	const char *name;
+	int size;
+
+	offset += fdt_next_node_name(fit, offset, NULL);
+	while ((size = fdt_next_property(fit, offset, &prop)))
+		offset += size;
+
+	for (; fdt_next_node_name(fit, offset, &name);
+	     offset += fdt_skip_node(fit, offset)) {
+		if (!strcmp("images", name))
+			images = offset;
+		else if (!strcmp("configurations", name))
+			configs = offset;
+	}
+
+	if (images)
+		fit_for_each_subnode(fit, images, image_node, NULL);
+	image_hash_build();
+
+	if (configs)
+		fit_for_each_subnode(fit, configs, config_node,
+				     default_config);
 }
 
 static int fdt_find_compat(void *blob, uint32_t start_offset,
@@ -226,18 +320,57 @@ static int fdt_find_compat(void *blob, uint32_t start_offset,
 	return -1;
 }
 
-static int fit_check_compat(struct fdt_property *compat_prop,
-			    const char *compat_name)
+/*
+ * Map from each string in fit_kernel_compat to its rank (index), so that
+ * every compatible string of every config is looked up once instead of
+ * being compared against the whole preference list.
+ */
+typedef struct FitCompatRank
 {
-	int bytes = compat_prop->size;
-	const char *compat_str = compat_prop->data;
+	uint32_t hash;
+	const char *compat;
+	int rank;
+} FitCompatRank;
 
-	for (int pos = 0; bytes && compat_str[0]; pos++) {
-		if (!strncmp(compat_str, compat_name, bytes))
-			return pos;
-		int len = strlen(compat_str) + 1;
-		compat_str += len;
-		bytes -= len;
+/* Power of two, at least twice the size of fit_kernel_compat. */
+static FitCompatRank compat_ranks[32];
+_Static_assert(ARRAY_SIZE(compat_ranks) >= 2 * ARRAY_SIZE(fit_kernel_compat),
+	       "compat rank map too small");
+
+static void fit_build_compat_ranks(void)
+{
+	memset(compat_ranks, 0, sizeof(compat_ranks));
+
+	for (int rank = 0; rank < num_fit_kernel_compat; rank++) {
+		const char *compat = fit_kernel_compat[rank];
+		uint32_t hash = fit_hash(compat, SIZE_MAX);
+		size_t i = hash & (ARRAY_SIZE(compat_ranks) - 1);
+
+		for (; compat_ranks[i].compat;
+		     i = (i + 1) & (ARRAY_SIZE(compat_ranks) - 1)) {
+			/* A duplicate keeps its better (first) rank. */
+			if (!strcmp(compat_ranks[i].compat, compat))
+				break;
+		}
+		if (compat_ranks[i].compat)
+			continue;
+		compat_ranks[i].hash = hash;
+		compat_ranks[i].compat = compat;
+		compat_ranks[i].rank = rank;
+	}
+}
+
+/* Returns the rank of |compat| (at most |maxlen| bytes long), or -1. */
+static int fit_compat_rank(const char *compat, size_t maxlen)
+{
+	uint32_t hash = fit_hash(compat, maxlen);
+	size_t i = hash & (ARRAY_SIZE(compat_ranks) - 1);
+
+	for (; compat_ranks[i].compat;
+	     i = (i + 1) & (ARRAY_SIZE(compat_ranks) - 1)) {
+		if (compat_ranks[i].hash == hash &&
+		    !strncmp(compat_ranks[i].compat, compat, maxlen))
+			return compat_ranks[i].rank;
 	}
 	return -1;
 }
@@ -276,14 +409,19 @@ static int fit_rank_compat(FitConfigNode *config)
 
 	config->compat_pos = -1;
 	config->compat_rank = -1;
-	for (int i = 0; i < num_fit_kernel_compat; i++) {
-		int pos = fit_check_compat(&config->compat,
-					   fit_kernel_compat[i]);
-		if (pos >= 0) {
+
+	int bytes = config->compat.size;
+	const char *compat_str = config->compat.data;
+	for (int pos = 0; bytes > 0 && compat_str[0]; pos++) {
+		int rank = fit_compat_rank(compat_str, bytes);
+		if (rank >= 0 && (config->compat_rank < 0 ||
+				  rank < config->compat_rank)) {
 			config->compat_pos = pos;
-			config->compat_rank = i;
-			break;
+			config->compat_rank = rank;
 		}
+		int len = strnlen(compat_str, bytes) + 1;
+		compat_str += len;
+		bytes -= len;
 	}
 
 	return 0;
@@ -341,9 +479,8 @@ FitImageNode *fit_load(void *fit, struct device_tree **dt)
 
 	printf("Loading FIT.\n");
 
-	struct device_tree *tree = fdt_unflatten(fit);
-	if (!tree) {
-		printf("Failed to unflatten FIT image!\n");
+	if (!fdt_is_valid(fit)) {
+		printf("Invalid FIT image!\n");
 		return NULL;
 	}
 
@@ -351,7 +488,7 @@ FitImageNode *fit_load(void *fit, struct device_tree **dt)
 	FitConfigNode *default_config = NULL;
 	FitConfigNode *compat_config = NULL;
 
-	fit_unpack(tree, &default_config_name);
+	fit_unpack(fit, &default_config_name);
 
 	// List the images we found.
 	list_for_each(image, image_nodes, list_node)
@@ -362,6 +499,7 @@ FitImageNode *fit_load(void *fit, struct device_tree **dt)
 	for (int i = 0; i < num_fit_kernel_compat; i++)
 		printf(" %s", fit_kernel_compat[i]);
 	printf("\n");
+	fit_build_compat_ranks();
 	// Process and list the configs.
 	list_for_each(config, config_nodes, list_node) {
 		if (!config->kernel) {
@@ -28,10 +28,10 @@
 #include <libpayload.h>
 #include <endian.h>
 
+#include "base/crc32.h"
 #include "image/symbols.h"
 
 #include "atags.h"
-#include "crc32.h"
 #include "legacy_image.h"
 
 /* Check header CRC of the uImage header */
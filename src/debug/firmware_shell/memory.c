@@ -16,6 +16,7 @@
  * GNU General Public License for more details.
  */
 
+#include "base/crc32.h"
 #include "debug/firmware_shell/common.h"
 
 typedef unsigned long ulong;
@@ -260,18 +261,6 @@ static int do_cp(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 	return 0;
 }
 
-static inline u32 crc32_le(u32 crc, unsigned char const *p, size_t len)
-{
-	int i;
-	u32 polynomial = 0xedb88320;
-	while (len--) {
-		crc ^= *p++;
-		for (i = 0; i < 8; i++)
-			crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
-	}
-	return crc;
-}
-
 static int do_crc(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 {
 	ulong addr, length, seed;
@@ -31,9 +31,11 @@ static int storage_show(int argc, char *const argv[])
 	for (i = 0, bd = current_devices.known_devices;
 	     i < current_devices.total;
 	     i++, bd++)
-		console_printf("%c %2d: %s\n",
+		console_printf("%c %2d: %s (%llu of %llu bytes bounced)\n",
 		       current_devices.curr_device == i ? '*' : ' ',
-		       i, (*bd)->name ? (*bd)->name : "UNNAMED");
+		       i, (*bd)->name ? (*bd)->name : "UNNAMED",
+		       (unsigned long long)(*bd)->bounced_bytes,
+		       (unsigned long long)(*bd)->dma_bytes);
 
 	console_printf("%d devices total\n", i);
 	return 0;
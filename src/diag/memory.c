@@ -26,7 +26,6 @@
 	}
 
 #define DEFAULT_DIAGNOSTIC_OUTPUT_SIZE (64 * KiB)
-#define PATTERN_CACHE_SIZE (1 * KiB)
 #define CHUNK_SIZE (32 * MiB)
 
 typedef enum {
@@ -35,8 +34,8 @@ typedef enum {
 } TestResult;
 
 typedef struct {
-	// Cyclic memory test pattern. To Speedup via memcpy/memcmp and cache.
-	uint32_t pattern[PATTERN_CACHE_SIZE];
+	// Cyclic memory test pattern, unrolled to speed up write and check.
+	PatternBlock pattern;
 
 	// Check Result
 	TestResult result;
@@ -76,27 +75,13 @@ typedef struct {
 	const char *prev_pattern_name;
 } MemoryTestState;
 
-// Copy and fill dst with cyclic src.
-static void cyclic(const void *_src, size_t src_size, void *_dst,
-		   size_t dst_size)
-{
-	uint8_t *src = (uint8_t *)_src;
-	uint8_t *dst = (uint8_t *)_dst;
-	for (uint64_t pos = 0; pos < dst_size; pos++, dst++)
-		*dst = src[pos % src_size];
-}
-
 /* Functions of PhysMapFunc to operate on memory via arch_phys_map() */
 static void op_write(uint64_t phys_addr, void *start, uint64_t size,
 		     void *_data)
 {
 	OpData *data = (OpData *)_data;
 
-	size_t pat_size = sizeof(data->pattern);
-	for (uint64_t pos = 0, cur_size; pos < size; pos += cur_size) {
-		cur_size = MIN(size - pos, pat_size);
-		memcpy(start + pos, data->pattern, cur_size);
-	}
+	pattern_write(start, size, &data->pattern);
 }
 
 static void op_read_and_check(uint64_t phys_addr, void *start, uint64_t size,
@@ -104,30 +89,12 @@ static void op_read_and_check(uint64_t phys_addr, void *start, uint64_t size,
 {
 	OpData *data = (OpData *)_data;
 
-	size_t pat_size = sizeof(data->pattern);
-	for (uint64_t pos = 0, cur_size; pos < size; pos += cur_size) {
-		cur_size = MIN(size - pos, pat_size);
-
-		int res = memcmp(start + pos, data->pattern, cur_size);
-		if (res != 0) {
-			data->result = TEST_FAILED;
-			data->error_phys_addr_st = phys_addr;
-			data->error_phys_addr_ed = phys_addr + size;
-
-			// Calculate the precised unmatched memory address
-			uint64_t offset = 0x0;
-			uint8_t *mem = start + pos;
-			uint8_t *mem_ed = start + cur_size;
-			uint8_t *pat = (uint8_t *)data->pattern;
-			for (; mem != mem_ed; mem++, pat++) {
-				if (*mem != *pat) {
-					offset = mem - (uint8_t *)start;
-					break;
-				}
-			}
-			data->error_phys_offset = offset;
-			return;
-		}
+	uint64_t offset = pattern_check(start, size, &data->pattern);
+	if (offset != size) {
+		data->result = TEST_FAILED;
+		data->error_phys_addr_st = phys_addr;
+		data->error_phys_addr_ed = phys_addr + size;
+		data->error_phys_offset = offset;
 	}
 }
 
@@ -159,11 +126,8 @@ static inline void reset_operation(void)
 
 static inline void fill_opdata(void)
 {
-	const void *src = state.pattern_cur->data;
-	size_t src_size =
-		sizeof(*state.pattern_cur->data) * state.pattern_cur->len;
-	cyclic(src, src_size, state.single_operation_data->pattern,
-	       sizeof(state.single_operation_data->pattern));
+	pattern_block_fill(&state.single_operation_data->pattern,
+			   state.pattern_cur);
 }
 
 static inline void reset_memory_test(void)
@@ -5,7 +5,9 @@
 
 #include <commonlib/list.h>
 #include <libpayload.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "diag/pattern.h"
 
@@ -79,7 +81,6 @@ static inline void add_pattern(struct list_node *head, const char *name,
 		size_t len;                                                    \
 		name##_generator(&ptr, &len);                                  \
 		add_pattern(&(head), #name, ptr, len);                         \
-		free(ptr);                                                     \
 	} while (0)
 
 #define ADD_PATTERN_BY_ARRAY(head, name)                                       \
@@ -118,3 +119,108 @@ const struct list_node *DiagGetTestPatterns(void)
 
 	return &pattern_list;
 }
+
+#define PATTERN_BLOCK_WORDS ARRAY_SIZE(((PatternBlock *)0)->data)
+
+/* Number of words moved or compared per loop iteration: one cache line. */
+#define PATTERN_STEP_WORDS 8
+
+void pattern_block_fill(PatternBlock *block, const Pattern *pattern)
+{
+	uint8_t *dst = (uint8_t *)block->data;
+	size_t size = MIN(pattern->len * sizeof(*pattern->data),
+			  sizeof(block->data));
+
+	if (!size) {
+		memset(block->data, 0, sizeof(block->data));
+		return;
+	}
+
+	/*
+	 * The filled part always holds a whole number of pattern periods, so
+	 * doubling it keeps the pattern going without any modulo.
+	 */
+	memcpy(dst, pattern->data, size);
+	while (size < sizeof(block->data)) {
+		size_t len = MIN(size, sizeof(block->data) - size);
+		memcpy(dst + size, dst, len);
+		size += len;
+	}
+}
+
+static void write_block(uint64_t *dst, const uint64_t *src)
+{
+	for (size_t i = 0; i < PATTERN_BLOCK_WORDS; i += PATTERN_STEP_WORDS) {
+		dst[i + 0] = src[i + 0];
+		dst[i + 1] = src[i + 1];
+		dst[i + 2] = src[i + 2];
+		dst[i + 3] = src[i + 3];
+		dst[i + 4] = src[i + 4];
+		dst[i + 5] = src[i + 5];
+		dst[i + 6] = src[i + 6];
+		dst[i + 7] = src[i + 7];
+	}
+}
+
+/* Returns true if the block matches. Only branches once per cache line. */
+static bool check_block(const uint64_t *mem, const uint64_t *src)
+{
+	for (size_t i = 0; i < PATTERN_BLOCK_WORDS; i += PATTERN_STEP_WORDS) {
+		uint64_t diff = (mem[i + 0] ^ src[i + 0]) |
+				(mem[i + 1] ^ src[i + 1]) |
+				(mem[i + 2] ^ src[i + 2]) |
+				(mem[i + 3] ^ src[i + 3]) |
+				(mem[i + 4] ^ src[i + 4]) |
+				(mem[i + 5] ^ src[i + 5]) |
+				(mem[i + 6] ^ src[i + 6]) |
+				(mem[i + 7] ^ src[i + 7]);
+		if (diff)
+			return false;
+	}
+	return true;
+}
+
+static inline bool use_words(const void *p, uint64_t size)
+{
+	return size == PATTERN_BLOCK_SIZE &&
+	       IS_ALIGNED((uintptr_t)p, sizeof(uint64_t));
+}
+
+void pattern_write(void *dst, uint64_t size, const PatternBlock *block)
+{
+	uint8_t *mem = dst;
+
+	for (uint64_t pos = 0, cur_size; pos < size; pos += cur_size) {
+		cur_size = MIN(size - pos, sizeof(block->data));
+		if (use_words(mem + pos, cur_size))
+			write_block((uint64_t *)(mem + pos), block->data);
+		else
+			memcpy(mem + pos, block->data, cur_size);
+	}
+}
+
+uint64_t pattern_check(const void *src, uint64_t size,
+		       const PatternBlock *block)
+{
+	const uint8_t *mem = src;
+	const uint8_t *pat = (const uint8_t *)block->data;
+
+	for (uint64_t pos = 0, cur_size; pos < size; pos += cur_size) {
+		cur_size = MIN(size - pos, sizeof(block->data));
+		if (use_words(mem + pos, cur_size)) {
+			if (check_block((const uint64_t *)(mem + pos),
+					block->data))
+				continue;
+		} else if (!memcmp(mem + pos, pat, cur_size)) {
+			continue;
+		}
+
+		/* Pinpoint the mismatching byte */
+		for (uint64_t i = 0; i < cur_size; i++) {
+			if (mem[pos + i] != pat[i])
+				return pos + i;
+		}
+	}
+
+	return size;
+}
@@ -7,6 +7,8 @@
 #define __DIAG_PATTERN_H__
 
 #include <commonlib/list.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct Pattern {
 	const char *name;
@@ -17,7 +19,31 @@ typedef struct Pattern {
 	struct list_node list_node;
 } Pattern;
 
+/*
+ * A pattern unrolled into a block. Memory is written and checked one block at
+ * a time, so the pattern restarts at every PATTERN_BLOCK_SIZE boundary
+ * relative to the start of the tested region.
+ */
+#define PATTERN_BLOCK_SIZE 4096
+
+typedef struct PatternBlock {
+	uint64_t data[PATTERN_BLOCK_SIZE / sizeof(uint64_t)];
+} PatternBlock;
+
 const struct list_node *DiagGetSimpleTestPatterns(void);
 const struct list_node *DiagGetTestPatterns(void);
 
+/* Fill the block by repeating the pattern. */
+void pattern_block_fill(PatternBlock *block, const Pattern *pattern);
+
+/* Fill size bytes at dst with the pattern block. */
+void pattern_write(void *dst, uint64_t size, const PatternBlock *block);
+
+/*
+ * Check that size bytes at src hold the pattern block. Returns the offset of
+ * the first mismatching byte, or size if everything matches.
+ */
+uint64_t pattern_check(const void *src, uint64_t size,
+		       const PatternBlock *block);
+
 #endif
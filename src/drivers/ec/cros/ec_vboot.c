@@ -8,6 +8,7 @@
 #include <cbfs_glue.h>
 
 #include "base/cleanup_funcs.h"
+#include "base/timestamp.h"
 #include "drivers/bus/i2c/cros_ec_tunnel.h"
 #include "drivers/ec/cros/commands.h"
 #include "drivers/ec/cros/commands_api.h"
@@ -103,6 +104,36 @@ static vb2_error_t vboot_hash_image_ap_flash(const uint8_t **hash, int *hash_siz
 	return VB2_SUCCESS;
 }
 
+static vb2_error_t vboot_start_hash(VbootEcOps *vbec,
+				    enum vb2_firmware_selection select)
+{
+	CrosEc *me = container_of(vbec, CrosEc, vboot);
+	struct ec_response_vboot_hash resp;
+	struct ec_params_vboot_hash p = { 0 };
+
+	/* The AP computes the hash itself, there is nothing to start */
+	if (CONFIG(EC_UPDATE_AP_SPI_FLASH))
+		return VB2_SUCCESS;
+
+	p.cmd = EC_VBOOT_HASH_GET;
+	p.offset = get_vboot_hash_offset(select);
+	if (ec_cmd_vboot_hash(me, &p, &resp) < 0)
+		return VB2_ERROR_UNKNOWN;
+
+	/* The EC may already have a hash, or be computing one */
+	if (resp.status != EC_VBOOT_HASH_STATUS_NONE)
+		return VB2_SUCCESS;
+
+	p.cmd = EC_VBOOT_HASH_START;
+	p.hash_type = EC_VBOOT_HASH_TYPE_SHA256;
+	p.nonce_size = 0;
+	if (ec_cmd_vboot_hash(me, &p, &resp) < 0)
+		return VB2_ERROR_UNKNOWN;
+
+	timestamp_add_now(TS_EC_HASH_START);
+	return VB2_SUCCESS;
+}
+
 static vb2_error_t vboot_hash_image(VbootEcOps *vbec,
 				    enum vb2_firmware_selection select,
 				    const uint8_t **hash, int *hash_size)
@@ -144,6 +175,7 @@ static vb2_error_t vboot_hash_image(VbootEcOps *vbec,
 			if (ec_cmd_vboot_hash(me, &p, &resp) < 0)
 				return VB2_ERROR_UNKNOWN;
 
+			timestamp_add_now(TS_EC_HASH_START);
 			recalc_requested = 1;
 			/* Expect status to be busy (and don't break while)
 			 * since we just sent a recalc request. */
@@ -171,6 +203,7 @@ static vb2_error_t vboot_hash_image(VbootEcOps *vbec,
 		return VB2_ERROR_UNKNOWN;
 	}
 
+	timestamp_add_now(TS_EC_HASH_READY);
 	*hash = resp.hash_digest;
 	*hash_size = resp.digest_size;
 
@@ -417,6 +450,184 @@ static int ec_flash_write(CrosEc *me, const uint8_t *data, uint32_t offset,
 	return 0;
 }
 
+/**
+ * Read data from the flash
+ *
+ * Read an arbitrary amount of data from the EC flash, in blocks that fit in
+ * the host response buffer.
+ *
+ * @param data		Pointer to buffer to read into
+ * @param offset	Offset within flash to read from
+ * @param size		Number of bytes to read
+ * @return 0 if ok, -1 on error
+ */
+static int ec_flash_read(CrosEc *me, uint8_t *data, uint32_t offset,
+			 uint32_t size)
+{
+	int burst = me->proto3_response_size -
+		(int)sizeof(struct ec_host_response);
+	struct ec_params_flash_read p;
+	uint32_t end, off;
+
+	if (burst <= 0)
+		return -1;
+
+	end = offset + size;
+	for (off = offset; off < end; off += burst, data += burst) {
+		uint32_t todo = MIN(end - off, burst);
+
+		p.offset = off;
+		p.size = todo;
+		if (ec_command(me, EC_CMD_FLASH_READ, 0, &p, sizeof(p), data,
+			       todo) != todo)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the erase block size of the EC flash, and the value that erased flash
+ * reads back as. Only version 1 of EC_CMD_FLASH_INFO can report chips that
+ * erase to 0, everything else erases to 0xff.
+ */
+static int ec_flash_erase_info(CrosEc *me, uint32_t *block_size,
+			       uint8_t *erase_value)
+{
+	struct ec_response_flash_info_1 info;
+	int version = 0;
+	int size = sizeof(struct ec_response_flash_info);
+
+	if (cros_ec_cmd_version_supported(EC_CMD_FLASH_INFO, 1) > 0) {
+		version = 1;
+		size = sizeof(info);
+	}
+
+	memset(&info, 0, sizeof(info));
+	if (ec_command(me, EC_CMD_FLASH_INFO, version, NULL, 0, &info,
+		       size) != size)
+		return -1;
+
+	*block_size = info.erase_block_size;
+	*erase_value = (info.flags & EC_FLASH_INFO_ERASE_TO_0) ? 0 : 0xff;
+	return 0;
+}
+
+/* Check whether every byte of buf is erase_value. */
+static int ec_flash_is_erased(const uint8_t *buf, uint32_t len,
+			      uint8_t erase_value)
+{
+	for (uint32_t i = 0; i < len; i++)
+		if (buf[i] != erase_value)
+			return 0;
+	return 1;
+}
+
+/*
+ * Check whether the erase block at pos of a region already holds what it
+ * should after the update: the image, and erased flash past its end.
+ */
+static int ec_flash_block_matches(const uint8_t *current, const uint8_t *image,
+				  uint32_t image_size, uint32_t pos,
+				  uint32_t block_size, uint8_t erase_value)
+{
+	uint32_t len = pos < image_size ? MIN(image_size - pos, block_size) : 0;
+
+	return !memcmp(current, image + pos, len) &&
+	       ec_flash_is_erased(current + len, block_size - len, erase_value);
+}
+
+/**
+ * Update a region, only rewriting the erase blocks that change
+ *
+ * Every erase block of the region is read back and compared against the new
+ * image. Only blocks that differ are erased and rewritten, and those are read
+ * back again at the end to verify them. If more than half of the blocks
+ * differ, nothing is written, since a full rewrite is faster then.
+ *
+ * @param image		New image
+ * @param image_size	Size of the new image
+ * @param region_offset	Offset of the region within flash
+ * @param region_size	Size of the region
+ * @return 0 if ok, 1 if the region should be rewritten in full, -1 on error
+ */
+static int ec_flash_update_diff(CrosEc *me, const uint8_t *image,
+				uint32_t image_size, uint32_t region_offset,
+				uint32_t region_size)
+{
+	uint32_t block_size, block_count, changed = 0;
+	uint8_t *current, *dirty, erase_value;
+	int rv = -1;
+
+	if (ec_flash_erase_info(me, &block_size, &erase_value))
+		return -1;
+
+	if (!block_size || region_offset % block_size ||
+	    region_size % block_size)
+		return -1;
+	block_count = region_size / block_size;
+
+	current = xmalloc(block_size);
+	dirty = xzalloc(block_count);
+
+	for (uint32_t i = 0; i < block_count; i++) {
+		uint32_t pos = i * block_size;
+
+		if (ec_flash_read(me, current, region_offset + pos, block_size))
+			goto end;
+		if (ec_flash_block_matches(current, image, image_size, pos,
+					   block_size, erase_value))
+			continue;
+		dirty[i] = 1;
+		changed++;
+	}
+
+	if (changed * 2 > block_count) {
+		printf("EC: %u of %u blocks differ, rewriting region\n",
+		       changed, block_count);
+		rv = 1;
+		goto end;
+	}
+
+	for (uint32_t i = 0; i < block_count; i++) {
+		uint32_t pos = i * block_size;
+		uint32_t off = region_offset + pos;
+
+		if (!dirty[i])
+			continue;
+		if (ec_flash_erase(me, off, block_size))
+			goto end;
+		/* Nothing to write past the end of the image */
+		if (pos < image_size &&
+		    ec_flash_write(me, image + pos, off,
+				   MIN(image_size - pos, block_size)))
+			goto end;
+	}
+
+	/* Verify the blocks that were rewritten */
+	for (uint32_t i = 0; i < block_count; i++) {
+		uint32_t pos = i * block_size;
+
+		if (!dirty[i])
+			continue;
+		if (ec_flash_read(me, current, region_offset + pos, block_size))
+			goto end;
+		if (!ec_flash_block_matches(current, image, image_size, pos,
+					    block_size, erase_value)) {
+			printf("EC: block at %#x failed to verify\n",
+			       region_offset + pos);
+			goto end;
+		}
+	}
+
+	printf("EC: rewrote %u of %u blocks\n", changed, block_count);
+	rv = 0;
+end:
+	free(dirty);
+	free(current);
+	return rv;
+}
+
 /**
  * Run verification on a slot
  *
@@ -500,6 +711,10 @@ static vb2_error_t vboot_update_image_ap_flash(const uint8_t *image, int image_s
 		printf("%s: image to large", __func__);
 		return VB2_ERROR_INVALID_PARAMETER;
 	}
+	/* Rewrite only what changed if possible, else the whole image. */
+	if (CONFIG(EC_DIFF_UPDATE) &&
+	    flash_rewrite_diff(image, ar.offset, image_size) == image_size)
+		return VB2_SUCCESS;
 	/* Rewrite to the flash region. */
 	if (flash_rewrite(image, ar.offset, image_size) != image_size) {
 		printf("%s: couldn't rewrite image to flash\n",__func__);
@@ -528,6 +743,15 @@ static vb2_error_t vboot_update_image(VbootEcOps *vbec,
 	if (image_size > region_size)
 		return VB2_ERROR_INVALID_PARAMETER;
 
+	if (CONFIG(EC_DIFF_UPDATE)) {
+		int diff_rv = ec_flash_update_diff(me, image, image_size,
+						   region_offset, region_size);
+		if (!diff_rv)
+			goto verify;
+		if (diff_rv < 0)
+			printf("EC: differential update failed, rewriting region\n");
+	}
+
 	/*
 	 * Erase the entire region, so that the EC doesn't see any garbage
 	 * past the new image if it's smaller than the current image.
@@ -543,6 +767,7 @@ static vb2_error_t vboot_update_image(VbootEcOps *vbec,
 	if (ec_flash_write(me, image, region_offset, image_size))
 		return VB2_ERROR_UNKNOWN;
 
+verify:
 	/* Verify the image */
 	if (CONFIG(EC_EFS) && ec_efs_verify(me, region))
 		return VB2_ERROR_UNKNOWN;
@@ -611,6 +836,7 @@ CrosEc *new_cros_ec(CrosEcBusOps *bus, GpioOps *interrupt_gpio)
 	me->vboot.hash_image = vboot_hash_image;
 	me->vboot.update_image = vboot_update_image;
 	me->vboot.protect = vboot_protect;
+	me->vboot.start_hash = vboot_start_hash;
 	me->vboot.reboot_to_ro = vboot_reboot_to_ro;
 	me->vboot.reboot_switch_rw = vboot_reboot_switch_rw;
 	me->vboot.reboot_ap_off = vboot_reboot_ap_off;
@@ -31,6 +31,14 @@ typedef struct VbootEcOps {
 				  const uint8_t *image, int image_size);
 	vb2_error_t (*protect)(struct VbootEcOps *me);
 
+	/*
+	 * Start computing the hash of an image in the background, so that a
+	 * later hash_image() only has to collect it. Optional operation, so
+	 * check before invoking it.
+	 */
+	vb2_error_t (*start_hash)(struct VbootEcOps *me,
+				  enum vb2_firmware_selection select);
+
 	/* Tells the EC to reboot to RO on next AP shutdown. */
 	vb2_error_t (*reboot_to_ro)(struct VbootEcOps *me);
 
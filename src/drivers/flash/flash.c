@@ -121,6 +121,71 @@ end:
 	return result;
 }
 
+int __must_check flash_rewrite_diff_ops(FlashOps *ops, const void *buffer,
+					uint32_t start, uint32_t length)
+{
+	uint32_t sector_size = flash_sector_size_ops(ops);
+	uint32_t initial_start = ALIGN_DOWN(start, sector_size);
+	uint32_t final_end = ALIGN_UP(start + length, sector_size);
+	uint32_t full_length = final_end - initial_start;
+	uint8_t *current = xmalloc(full_length);
+	uint8_t *expected = xmalloc(full_length);
+	uint32_t changed = 0;
+	int result = -1;
+	int ret;
+
+	ret = flash_read_ops(ops, current, initial_start, full_length);
+	if (ret != full_length) {
+		printf("diff rewriting failed in read ret=%d\n", ret);
+		goto end;
+	}
+	memcpy(expected, current, full_length);
+	memcpy(expected + (start - initial_start), buffer, length);
+
+	/* Erase and write each run of sectors that differ from the new contents */
+	for (uint32_t off = 0; off < full_length; ) {
+		uint32_t run_end = off;
+
+		while (run_end < full_length &&
+		       memcmp(current + run_end, expected + run_end, sector_size))
+			run_end += sector_size;
+		if (run_end == off) {
+			off += sector_size;
+			continue;
+		}
+
+		ret = flash_erase_ops(ops, initial_start + off, run_end - off);
+		if (ret != run_end - off) {
+			printf("diff rewriting failed in erase ret=%d\n", ret);
+			goto end;
+		}
+		ret = flash_write_ops(ops, expected + off, initial_start + off,
+				      run_end - off);
+		if (ret != run_end - off) {
+			printf("diff rewriting failed in write ret=%d\n", ret);
+			goto end;
+		}
+		changed += run_end - off;
+		off = run_end;
+	}
+
+	/* Verify that the flash now holds the new contents */
+	if (changed) {
+		ret = flash_read_ops(ops, current, initial_start, full_length);
+		if (ret != full_length || memcmp(current, expected, full_length)) {
+			printf("diff rewriting failed in verify ret=%d\n", ret);
+			goto end;
+		}
+	}
+
+	printf("diff rewrite: %u of %u bytes changed\n", changed, full_length);
+	result = length;
+end:
+	free(expected);
+	free(current);
+	return result;
+}
+
 static FlashOps *flash_ops;
 
 void flash_set_ops(FlashOps *ops)
@@ -155,6 +220,12 @@ int __must_check flash_rewrite(const void *buffer, uint32_t start,
 	return flash_rewrite_ops(flash_ops, buffer, start, length);
 }
 
+int __must_check flash_rewrite_diff(const void *buffer, uint32_t start,
+				    uint32_t length)
+{
+	return flash_rewrite_diff_ops(flash_ops, buffer, start, length);
+}
+
 int flash_write_status(uint8_t status)
 {
 	return flash_write_status_ops(flash_ops, status);
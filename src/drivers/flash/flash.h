@@ -71,6 +71,12 @@ int __must_check flash_erase(uint32_t offset, uint32_t size);
 uint32_t flash_sector_size(void);
 int __must_check flash_rewrite(const void *buffer, uint32_t start,
 			       uint32_t length);
+/*
+ * Like flash_rewrite(), but only erases and writes the sectors whose contents
+ * change, and reads them back afterwards to verify them.
+ */
+int __must_check flash_rewrite_diff(const void *buffer, uint32_t start,
+				    uint32_t length);
 int flash_write_status(uint8_t status);
 int flash_read_status(void);
 int flash_is_wp_enabled(void);
@@ -85,6 +91,8 @@ int __must_check flash_write_ops(FlashOps *ops, const void *buffer,
 int __must_check flash_erase_ops(FlashOps *ops, uint32_t offset, uint32_t size);
 int __must_check flash_rewrite_ops(FlashOps *ops, const void *buffer,
 				   uint32_t start, uint32_t length);
+int __must_check flash_rewrite_diff_ops(FlashOps *ops, const void *buffer,
+					uint32_t start, uint32_t length);
 
 /* List of supported flashes terminated with a 0 filled element*/
 extern FlashProtectionMapping flash_protection_list[];
@@ -137,6 +137,12 @@ int net_wait_for_link(bool loop)
 /* According to uip_arp_timer it should be called once every 10 seconds */
 #define UIP_ARP_INTERVAL_US (10 * USECS_PER_SEC)
 
+/*
+ * Upper bound on the frames handled by one net_poll() call, so that a busy
+ * link still lets the caller get its own work done between polls.
+ */
+#define NET_POLL_MAX_RX_FRAMES 32
+
 enum net_poll_status net_poll(void)
 {
 	int ret;
@@ -150,11 +156,18 @@ enum net_poll_status net_poll(void)
 	}
 
 	struct uip_eth_hdr *hdr = (struct uip_eth_hdr *)uip_buf;
-	ret = net_device->ops->recv(net_device, uip_buf, &uip_len, CONFIG_UIP_BUFSIZE);
-	if (ret) {
-		printf("Receive failed. (%d)\n", ret);
-		status = NET_POLL_RX_ERR;
-	} else if (uip_len) {
+	for (int frames = 0; frames < NET_POLL_MAX_RX_FRAMES; frames++) {
+		ret = net_device->ops->recv(net_device, uip_buf, &uip_len,
+					    CONFIG_UIP_BUFSIZE);
+		if (ret) {
+			printf("Receive failed. (%d)\n", ret);
+			if (!frames)
+				status = NET_POLL_RX_ERR;
+			break;
+		}
+		if (!uip_len)
+			break;
+
 		if (hdr->type == htonw(UIP_ETHTYPE_IP)) {
 			uip_arp_ipin();
 			uip_input();
@@ -168,6 +181,11 @@ enum net_poll_status net_poll(void)
 				net_device->ops->send(net_device, uip_buf, uip_len);
 		}
 		status = NET_POLL_RX;
+
+		/* Only keep going while that doesn't mean waiting for the wire. */
+		if (!net_device->ops->rx_pending ||
+		    !net_device->ops->rx_pending(net_device))
+			break;
 	}
 
 	if (timer_us(periodic_timer_us) > UIP_PERIODIC_INTERVAL_US) {
@@ -36,6 +36,11 @@ typedef struct NetDeviceOps {
 	int (*ready)(NetDevice *dev, int *ready);
 	int (*recv)(NetDevice *dev, void *buf, uint16_t *len,
 		int maxlen);
+	/*
+	 * Optional. Returns non-zero when recv() has more frames buffered
+	 * and can return them without waiting for the device.
+	 */
+	int (*rx_pending)(NetDevice *dev);
 	int (*send)(NetDevice *dev, void *buf, uint16_t len);
 	int (*mdio_read)(NetDevice *dev, uint8_t loc, uint16_t *val);
 	int (*mdio_write)(NetDevice *dev, uint8_t loc, uint16_t val);
@@ -69,6 +74,10 @@ enum net_poll_status {
 };
 
 /*
+ * Receives and processes frames from the current device. Frames the device
+ * already has buffered (see NetDeviceOps.rx_pending) are all drained in one
+ * call, up to NET_POLL_MAX_RX_FRAMES.
+ *
  * Returns:
  * - NET_POLL_RX when any packet was received
  * - NET_POLL_NO_RX when no packet was received
@@ -1434,69 +1434,133 @@ static int rtl8152_send(NetDevice *net_dev, void *buf, uint16_t len)
 		< 0);
 }
 
-static int rtl8152_recv(NetDevice *net_dev, void *buf, uint16_t *len,
-			int maxlen)
+/*
+ * Splits complete frames out of the aggregate buffer into the ring. A frame
+ * which continues past the end of the received data is left in place for
+ * r8152_rx_refill() to complete with the next transfer.
+ */
+static int r8152_rx_split(R8152RxRing *rx, int maxlen)
+{
+	while (rx->count < R8152_RX_RING_SIZE &&
+	       rx->offset + R8152_RX_DESC_SIZE <= rx->size) {
+		uint32_t rx_desc[R8152_RX_DESC_SIZE / sizeof(uint32_t)];
+		int32_t packet_len;
+
+		memcpy(&rx_desc, rx->agg + rx->offset, sizeof(rx_desc));
+		packet_len = le32toh(rx_desc[0]) & 0x7fff;
+		packet_len -= 4;
+
+		/*
+		 * Only reject frames that could never fit. One that runs past
+		 * the end of this transfer is carried over to the next one.
+		 */
+		if (packet_len < 0 || packet_len > maxlen ||
+		    R8152_RX_DESC_SIZE + packet_len > sizeof(rx->agg)) {
+			rx->size = 0;
+			rx->offset = 0;
+			printf("R8152: Packet is too large.\n");
+			return 1;
+		}
+
+		if (rx->offset + R8152_RX_DESC_SIZE + packet_len > rx->size)
+			break;
+
+		R8152RxFrame *frame = &rx->frames[(rx->head + rx->count) %
+						  R8152_RX_RING_SIZE];
+		frame->offset = rx->offset + R8152_RX_DESC_SIZE;
+		frame->len = packet_len;
+		rx->count++;
+
+		rx->offset += R8152_RX_DESC_SIZE + packet_len + 4;
+		rx->offset = ALIGN_UP(rx->offset, 8);
+	}
+
+	return 0;
+}
+
+static int r8152_rx_refill(R8152Dev *r8152_dev, int maxlen)
 {
-	R8152Dev *r8152_dev = container_of(net_dev, R8152Dev, net_dev);
-	GenericUsbDevice *gen_dev = (GenericUsbDevice *)net_dev->dev_data;
+	GenericUsbDevice *gen_dev =
+		(GenericUsbDevice *)r8152_dev->net_dev.dev_data;
 	usbdev_t *usb_dev = gen_dev->dev;
-
-	uint32_t rx_desc[6];
-	int32_t packet_len;
-	static int32_t buf_size = 0;
-	static uint8_t msg[ETHERNET_MAX_FRAME_SIZE + sizeof(rx_desc)];
-	static int32_t offset, partial;
+	R8152RxRing *rx = &r8152_dev->rx;
 	static uint64_t last_poll = 0;
+	int32_t partial, buf_size;
+
+	/*
+	 * Move an incomplete frame to the front, the rest of it follows in
+	 * the next transfer. A few bytes short of a descriptor are just
+	 * padding, unless the transfer was cut short by the buffer size.
+	 */
+	partial = MAX(rx->size - rx->offset, 0);
+	if (partial < R8152_RX_DESC_SIZE && rx->size < sizeof(rx->agg))
+		partial = 0;
+	if (partial && rx->offset)
+		memmove(rx->agg, rx->agg + rx->offset, partial);
+	rx->size = partial;
+	rx->offset = 0;
 
 	/* Wait at least 20 us between polling for receive. */
 	while (timer_us(last_poll) < 20);
 	last_poll = timer_us(0);
 
-	if (partial || offset >= buf_size) {
-		offset = 0;
-		buf_size = usb_dev->controller->bulk_timeout(r8152_dev->bulk_in,
-				sizeof(msg) - partial, msg + partial,
-				USB_ETH_BULK_POLL_TIMEOUT_US);
-		if (buf_size == USB_TIMEOUT) {
-			*len = 0;
-			return 0;
-		} else if (buf_size < 0) {
-			printf("R8152: Bulk read error %#x\n", buf_size);
-			return 1;
-		}
-		buf_size += partial;
-		partial = 0;
+	buf_size = usb_dev->controller->bulk_timeout(r8152_dev->bulk_in,
+			sizeof(rx->agg) - partial, rx->agg + partial,
+			USB_ETH_BULK_POLL_TIMEOUT_US);
+	if (buf_size == USB_TIMEOUT) {
+		return 0;
+	} else if (buf_size < 0) {
+		printf("R8152: Bulk read error %#x\n", buf_size);
+		rx->size = 0;
+		return 1;
 	}
+	rx->size += buf_size;
 
-	*len = 0;
-	if (buf_size < offset + sizeof(rx_desc))
-		return 0;
+	return r8152_rx_split(rx, maxlen);
+}
 
-	memcpy(&rx_desc, msg + offset, sizeof(rx_desc));
-	packet_len = le32toh(rx_desc[0]) & 0x7fff;
-	packet_len -= 4;
+static int rtl8152_recv(NetDevice *net_dev, void *buf, uint16_t *len,
+			int maxlen)
+{
+	R8152Dev *r8152_dev = container_of(net_dev, R8152Dev, net_dev);
+	R8152RxRing *rx = &r8152_dev->rx;
 
-	if (packet_len > maxlen ||
-	    offset + sizeof(rx_desc) + packet_len > sizeof(msg)) {
-		buf_size = 0;
-		offset = 0;
-		printf("R8152: Packet is too large.\n");
-		return 1;
-	}
+	*len = 0;
 
-	if  (offset == 0 && packet_len > buf_size) {
-		partial = buf_size;
+	/*
+	 * A single bulk-in transfer may hold several frames. They are handed
+	 * out of the ring one per call, and only an empty ring goes back to
+	 * the device for more.
+	 */
+	if (!rx->count && r8152_rx_refill(r8152_dev, maxlen))
+		return 1;
+	if (!rx->count)
 		return 0;
-	}
 
-	*len = packet_len;
-	memcpy(buf, msg + offset + sizeof(rx_desc), packet_len);
-	offset += sizeof(rx_desc) + packet_len + 4;
-	offset = ALIGN_UP(offset, 8);
+	R8152RxFrame *frame = &rx->frames[rx->head];
+	memcpy(buf, rx->agg + frame->offset, frame->len);
+	*len = frame->len;
+	rx->head = (rx->head + 1) % R8152_RX_RING_SIZE;
+	rx->count--;
+
+	/*
+	 * Refill the ring from what is left of the current transfer. A bad
+	 * descriptor there is reported and dropped by r8152_rx_split(), the
+	 * frame we already have is still good.
+	 */
+	if (!rx->count)
+		r8152_rx_split(rx, maxlen);
 
 	return 0;
 }
 
+static int rtl8152_rx_pending(NetDevice *net_dev)
+{
+	R8152Dev *r8152_dev = container_of(net_dev, R8152Dev, net_dev);
+
+	return r8152_dev->rx.count;
+}
+
 static const uip_eth_addr *rtl8152_get_mac(NetDevice *net_dev)
 {
 	R8152Dev *r8152_dev = container_of(net_dev, R8152Dev, net_dev);
@@ -1576,6 +1640,7 @@ static UsbEthDriver r8152_usb_driver = {
 		.init = &rtl8152_init,
 		.ready = &mii_ready,
 		.recv = &rtl8152_recv,
+		.rx_pending = &rtl8152_rx_pending,
 		.send = &rtl8152_send,
 		.get_mac = &rtl8152_get_mac,
 		.mdio_read = &rtl8152_mdio_read,
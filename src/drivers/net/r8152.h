@@ -370,6 +370,27 @@ enum {
  */
 #define R8152_RECV_WINDOW	32768
 
+/* Size of the descriptor in front of each received frame */
+#define R8152_RX_DESC_SIZE	24
+/* Bulk-in buffer, holds one aggregated transfer */
+#define R8152_RX_AGG_SIZE	(ETHERNET_MAX_FRAME_SIZE + R8152_RX_DESC_SIZE)
+/* Number of frames split out of the aggregate buffer ahead of uIP */
+#define R8152_RX_RING_SIZE	16
+
+typedef struct R8152RxFrame {
+	uint16_t offset;
+	uint16_t len;
+} R8152RxFrame;
+
+typedef struct R8152RxRing {
+	uint8_t agg[R8152_RX_AGG_SIZE];
+	int size;	/* bytes received into agg */
+	int offset;	/* next descriptor to split */
+	R8152RxFrame frames[R8152_RX_RING_SIZE];
+	int head;
+	int count;
+} R8152RxRing;
+
 typedef struct R8152Dev {
 	NetDevice net_dev;
 	endpoint_t *bulk_in;
@@ -377,6 +398,7 @@ typedef struct R8152Dev {
 	uip_eth_addr mac_addr;
 	uint8_t version;
 	uint16_t ocp_base;
+	R8152RxRing rx;
 } R8152Dev;
 
 #endif /* __DRIVERS_NET_R8152_H__ */
@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <assert.h>
+#include <libpayload.h>
+#include <stdio.h>
+
+#include "drivers/storage/block_cache.h"
+#include "drivers/storage/bouncebuf.h"
+
+#define NO_ENTRY	(-1)
+
+typedef struct {
+	lba_t lba;
+	int hash_next;		/* next entry in the same hash bucket */
+	int lru_prev;		/* more recently used entry */
+	int lru_next;		/* less recently used entry */
+	bool valid;
+} CacheEntry;
+
+typedef struct BdevCache {
+	BlockDev dev;
+	BlockDev *parent_dev;
+	BlockDevCacheStats stats;
+
+	int nentries;		/* power of 2, also the number of buckets */
+	CacheEntry *entries;
+	int *buckets;
+	int lru_head;		/* most recently used */
+	int lru_tail;		/* least recently used, replaced first */
+	uint8_t *data;
+} BdevCache;
+
+static int hash_lba(BdevCache *cache, lba_t lba)
+{
+	return lba & (cache->nentries - 1);
+}
+
+static void *entry_data(BdevCache *cache, int i)
+{
+	return cache->data + (size_t)i * cache->dev.block_size;
+}
+
+static int lookup(BdevCache *cache, lba_t lba)
+{
+	int i = cache->buckets[hash_lba(cache, lba)];
+
+	while (i != NO_ENTRY && cache->entries[i].lba != lba)
+		i = cache->entries[i].hash_next;
+
+	return i;
+}
+
+static void lru_unlink(BdevCache *cache, int i)
+{
+	CacheEntry *e = &cache->entries[i];
+
+	if (e->lru_prev != NO_ENTRY)
+		cache->entries[e->lru_prev].lru_next = e->lru_next;
+	else
+		cache->lru_head = e->lru_next;
+
+	if (e->lru_next != NO_ENTRY)
+		cache->entries[e->lru_next].lru_prev = e->lru_prev;
+	else
+		cache->lru_tail = e->lru_prev;
+}
+
+static void lru_push_head(BdevCache *cache, int i)
+{
+	CacheEntry *e = &cache->entries[i];
+
+	e->lru_prev = NO_ENTRY;
+	e->lru_next = cache->lru_head;
+	if (cache->lru_head != NO_ENTRY)
+		cache->entries[cache->lru_head].lru_prev = i;
+	cache->lru_head = i;
+	if (cache->lru_tail == NO_ENTRY)
+		cache->lru_tail = i;
+}
+
+static void lru_push_tail(BdevCache *cache, int i)
+{
+	CacheEntry *e = &cache->entries[i];
+
+	e->lru_next = NO_ENTRY;
+	e->lru_prev = cache->lru_tail;
+	if (cache->lru_tail != NO_ENTRY)
+		cache->entries[cache->lru_tail].lru_next = i;
+	cache->lru_tail = i;
+	if (cache->lru_head == NO_ENTRY)
+		cache->lru_head = i;
+}
+
+static void hash_unlink(BdevCache *cache, int i)
+{
+	int *link = &cache->buckets[hash_lba(cache, cache->entries[i].lba)];
+
+	while (*link != i)
+		link = &cache->entries[*link].hash_next;
+	*link = cache->entries[i].hash_next;
+}
+
+/* Drop an entry and make it the first one to be reused */
+static void invalidate(BdevCache *cache, int i)
+{
+	hash_unlink(cache, i);
+	cache->entries[i].valid = false;
+	lru_unlink(cache, i);
+	lru_push_tail(cache, i);
+}
+
+static void insert(BdevCache *cache, lba_t lba, const void *data)
+{
+	int i = lookup(cache, lba);
+
+	if (i == NO_ENTRY) {
+		i = cache->lru_tail;
+		if (cache->entries[i].valid) {
+			hash_unlink(cache, i);
+			cache->stats.evictions++;
+		}
+		cache->entries[i].lba = lba;
+		cache->entries[i].valid = true;
+		cache->entries[i].hash_next = cache->buckets[hash_lba(cache, lba)];
+		cache->buckets[hash_lba(cache, lba)] = i;
+	}
+
+	memcpy(entry_data(cache, i), data, cache->dev.block_size);
+	lru_unlink(cache, i);
+	lru_push_head(cache, i);
+}
+
+static lba_t cache_read(struct BlockDevOps *me, lba_t start, lba_t count,
+			void *buffer)
+{
+	BdevCache *cache = container_of(me, BdevCache, dev.ops);
+	BlockDevOps *parent = &cache->parent_dev->ops;
+	const unsigned block_size = cache->dev.block_size;
+	lba_t i;
+
+	if (count > cache->nentries / 2) {
+		cache->stats.uncached++;
+		return parent->read(parent, start, count, buffer);
+	}
+
+	for (i = 0; i < count; i++)
+		if (lookup(cache, start + i) == NO_ENTRY)
+			break;
+
+	if (i < count) {
+		cache->stats.misses++;
+		if (parent->read(parent, start, count, buffer) != count)
+			return 0;
+		for (i = 0; i < count; i++)
+			insert(cache, start + i, buffer + i * block_size);
+		return count;
+	}
+
+	cache->stats.hits++;
+	for (i = 0; i < count; i++) {
+		int e = lookup(cache, start + i);
+
+		memcpy(buffer + i * block_size, entry_data(cache, e), block_size);
+		lru_unlink(cache, e);
+		lru_push_head(cache, e);
+	}
+	return count;
+}
+
+/* Update cached copies of written blocks, drop them if 'buffer' is NULL */
+static void update_range(BdevCache *cache, lba_t start, lba_t count,
+			 const void *buffer)
+{
+	const unsigned block_size = cache->dev.block_size;
+	int i;
+
+	if (count > cache->nentries) {
+		for (i = 0; i < cache->nentries; i++) {
+			CacheEntry *e = &cache->entries[i];
+
+			if (!e->valid || e->lba < start || e->lba - start >= count)
+				continue;
+			if (buffer)
+				memcpy(entry_data(cache, i),
+				       buffer + (e->lba - start) * block_size,
+				       block_size);
+			else
+				invalidate(cache, i);
+		}
+		return;
+	}
+
+	for (lba_t lba = start; lba < start + count; lba++) {
+		i = lookup(cache, lba);
+		if (i == NO_ENTRY)
+			continue;
+		if (buffer)
+			memcpy(entry_data(cache, i),
+			       buffer + (lba - start) * block_size, block_size);
+		else
+			invalidate(cache, i);
+	}
+}
+
+static lba_t cache_write(struct BlockDevOps *me, lba_t start, lba_t count,
+			 const void *buffer)
+{
+	BdevCache *cache = container_of(me, BdevCache, dev.ops);
+	BlockDevOps *parent = &cache->parent_dev->ops;
+	lba_t ret = parent->write(parent, start, count, buffer);
+
+	/* On failure the device content is unknown, drop the whole range */
+	update_range(cache, start, count, ret == count ? buffer : NULL);
+	return ret;
+}
+
+static lba_t cache_erase(struct BlockDevOps *me, lba_t start, lba_t count)
+{
+	BdevCache *cache = container_of(me, BdevCache, dev.ops);
+	BlockDevOps *parent = &cache->parent_dev->ops;
+
+	update_range(cache, start, count, NULL);
+	return parent->erase(parent, start, count);
+}
+
+static int cache_get_health_info(struct BlockDevOps *me, struct HealthInfo *info)
+{
+	BdevCache *cache = container_of(me, BdevCache, dev.ops);
+	BlockDevOps *parent = &cache->parent_dev->ops;
+
+	/* Drivers find their own state from the ops they are called with */
+	return parent->get_health_info(parent, info);
+}
+
+static int cache_get_test_log(struct BlockDevOps *me,
+			      enum BlockDevTestOpsType ops,
+			      struct StorageTestLog *result)
+{
+	BdevCache *cache = container_of(me, BdevCache, dev.ops);
+	BlockDevOps *parent = &cache->parent_dev->ops;
+
+	return parent->get_test_log(parent, ops, result);
+}
+
+static int cache_test_control(struct BlockDevOps *me,
+			      enum BlockDevTestOpsType ops)
+{
+	BdevCache *cache = container_of(me, BdevCache, dev.ops);
+	BlockDevOps *parent = &cache->parent_dev->ops;
+
+	return parent->test_control(parent, ops);
+}
+
+BlockDev *new_blockdev_cache(BlockDev *parent, size_t cache_bytes)
+{
+	assert(parent);
+
+	int nentries = 1;
+
+	while (nentries * 2 * parent->block_size <= cache_bytes)
+		nentries *= 2;
+
+	BdevCache *cache = xzalloc(sizeof(*cache));
+	cache->dev.name = parent->name;
+	cache->dev.ops.read = parent->ops.read ? &cache_read : NULL;
+	cache->dev.ops.write = parent->ops.write ? &cache_write : NULL;
+	cache->dev.ops.erase = parent->ops.erase ? &cache_erase : NULL;
+	/* Streams read through the cache as well */
+	cache->dev.ops.new_stream = parent->ops.new_stream ? &new_simple_stream : NULL;
+	cache->dev.ops.get_health_info =
+		parent->ops.get_health_info ? &cache_get_health_info : NULL;
+	cache->dev.ops.get_test_log =
+		parent->ops.get_test_log ? &cache_get_test_log : NULL;
+	cache->dev.ops.test_control =
+		parent->ops.test_control ? &cache_test_control : NULL;
+	/* Doesn't take the ops, the parent's can be used as is */
+	cache->dev.ops.test_support = parent->ops.test_support;
+	cache->dev.removable = parent->removable;
+	cache->dev.block_size = parent->block_size;
+	cache->dev.block_count = parent->block_count;
+	cache->dev.erase_zeroes = parent->erase_zeroes;
+	cache->parent_dev = parent;
+
+	cache->nentries = nentries;
+	cache->entries = xzalloc(nentries * sizeof(*cache->entries));
+	cache->buckets = xmalloc(nentries * sizeof(*cache->buckets));
+	cache->data = xmemalign(ARCH_DMA_MINALIGN,
+				(size_t)nentries * parent->block_size);
+	cache->lru_head = cache->lru_tail = NO_ENTRY;
+	for (int i = 0; i < nentries; i++) {
+		cache->buckets[i] = NO_ENTRY;
+		lru_push_tail(cache, i);
+	}
+
+	return &cache->dev;
+}
+
+void free_blockdev_cache(BlockDev *dev)
+{
+	BdevCache *cache = container_of(dev, BdevCache, dev);
+
+	free(cache->data);
+	free(cache->buckets);
+	free(cache->entries);
+	free(cache);
+}
+
+const BlockDevCacheStats *blockdev_cache_stats(BlockDev *dev)
+{
+	BdevCache *cache = container_of(dev, BdevCache, dev);
+
+	return &cache->stats;
+}
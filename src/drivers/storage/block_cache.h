@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef __DRIVERS_STORAGE_BLOCK_CACHE_H__
+#define __DRIVERS_STORAGE_BLOCK_CACHE_H__
+
+#include "drivers/storage/blockdev.h"
+
+/* Default amount of memory used for cached blocks */
+#define BLOCKDEV_CACHE_BYTES	(256 * 1024)
+
+typedef struct BlockDevCacheStats {
+	uint64_t hits;		/* reads served from the cache */
+	uint64_t misses;	/* reads passed to the parent device */
+	uint64_t uncached;	/* reads too large to be cached */
+	uint64_t evictions;	/* blocks dropped to make room */
+} BlockDevCacheStats;
+
+/*
+ * Create a block device which caches small reads of 'parent' in an LRU cache
+ * of 'cache_bytes' bytes. Writes and erases are passed through to 'parent'
+ * and update or drop the affected cached blocks, so the cache never holds
+ * stale data as long as 'parent' is only modified through the returned
+ * device. Reads larger than half of the cache bypass it.
+ */
+BlockDev *new_blockdev_cache(BlockDev *parent, size_t cache_bytes);
+
+/* Free a block device created by new_blockdev_cache(). */
+void free_blockdev_cache(BlockDev *dev);
+
+/* Return the hit/miss statistics of a cache created by new_blockdev_cache(). */
+const BlockDevCacheStats *blockdev_cache_stats(BlockDev *dev);
+
+#endif /* __DRIVERS_STORAGE_BLOCK_CACHE_H__ */
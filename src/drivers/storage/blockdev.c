@@ -21,6 +21,7 @@
 #include <libpayload.h>
 #include <stdio.h>
 
+#include "base/timestamp.h"
 #include "drivers/storage/bouncebuf.h"
 
 struct list_node fixed_block_devices;
@@ -32,113 +33,155 @@ struct list_node removable_block_dev_controllers;
 typedef struct {
 	StreamOps stream;
 	BlockDev *blockdev;
-	lba_t current_sector;
+	lba_t start_sector;
 	lba_t end_sector;
-	void *block_buf;
-	size_t buf_used;
+	uint64_t pos;		/* byte offset from start_sector */
+	lba_t window_blocks;	/* read-ahead window size */
+	void *window;
+	uint64_t window_pos;	/* byte offset of the window from start_sector */
+	size_t window_used;	/* valid bytes in the window */
 } SimpleStream;
 
+uint64_t simple_stream_skip(StreamOps *me, uint64_t count);
+
+static uint64_t simple_stream_size(SimpleStream *stream)
+{
+	return (stream->end_sector - stream->start_sector) *
+	       stream->blockdev->block_size;
+}
+
+/* Read the blocks following the one at the current position into the window */
+static int simple_stream_fill_window(SimpleStream *stream)
+{
+	BlockDevOps *ops = &stream->blockdev->ops;
+	unsigned block_size = stream->blockdev->block_size;
+	lba_t sector = stream->start_sector + stream->pos / block_size;
+	lba_t blocks = MIN(stream->window_blocks, stream->end_sector - sector);
+
+	if (!stream->window)
+		stream->window = xmemalign(ARCH_DMA_MINALIGN,
+					   stream->window_blocks * block_size);
+
+	stream->window_used = 0;
+	if (ops->read(ops, sector, blocks, stream->window) != blocks)
+		return -1;
+	stream->window_pos = ALIGN_DOWN(stream->pos, block_size);
+	stream->window_used = blocks * block_size;
+	return 0;
+}
+
 /*
  * Read bytes from a stream. Returns number of bytes successfully written to
  * the buffer. If buffer is NULL, then skip 'count' number of bytes from the stream.
+ *
+ * Small reads are served from a window of up to window_blocks blocks read
+ * ahead of the current position, so that parsing headers costs one device
+ * read instead of one per header. Reads at least as large as the window go
+ * straight to the caller's buffer.
  */
 uint64_t simple_stream_read(StreamOps *me, uint64_t count, void *buffer)
 {
 	SimpleStream *stream = container_of(me, SimpleStream, stream);
+	BlockDevOps *ops = &stream->blockdev->ops;
 	unsigned block_size = stream->blockdev->block_size;
+	uint64_t window_size = stream->window_blocks * block_size;
 	uint64_t bytes_read = 0;
 
-	/* Handle bytes that are left from previous partial block read */
-	if (stream->buf_used < block_size) {
-		bytes_read = MIN(count, block_size - stream->buf_used);
-		if (buffer) {
-			memcpy(buffer, stream->block_buf + stream->buf_used, bytes_read);
-			buffer += bytes_read;
-		}
-		stream->buf_used += bytes_read;
-		count -= bytes_read;
-		if (stream->buf_used == block_size)
-			stream->current_sector++;
-	}
-
-	if (count == 0)
-		return bytes_read;
+	if (!buffer)
+		return simple_stream_skip(me, count);
 
-	/* Handle sectors that are block aligned */
-	uint64_t sectors = count / block_size;
-	if (sectors > stream->end_sector - stream->current_sector) {
+	if (count > simple_stream_size(stream) - stream->pos) {
 		printf("read_stream_simple past the end, "
-		       "end_sector=%lld, current_sector=%lld, sectors=%lld\n",
-		       stream->end_sector, stream->current_sector, sectors);
-		return bytes_read;
+		       "end_sector=%lld, pos=%lld, count=%lld\n",
+		       stream->end_sector, stream->pos, count);
+		count = simple_stream_size(stream) - stream->pos;
 	}
 
-	if (buffer && sectors > 0) {
-		if (stream->blockdev->ops.read(&stream->blockdev->ops,
-					       stream->current_sector, sectors,
-					       buffer) != sectors)
-			return bytes_read;
-		buffer += sectors * block_size;
-	}
-	bytes_read += sectors * block_size;
-	count -= sectors * block_size;
-	stream->current_sector += sectors;
-
-	/* Handle partial block read */
-	if (count) {
-		if (stream->current_sector == stream->end_sector) {
-			printf("read_stream_simple past the end, "
-			       "end_sector=%lld, current_sector=%lld\n",
-			       stream->end_sector, stream->current_sector);
-			return bytes_read;
+	while (count) {
+		uint64_t chunk;
+
+		/* Serve what the window already holds */
+		if (stream->pos >= stream->window_pos &&
+		    stream->pos < stream->window_pos + stream->window_used) {
+			uint64_t offset = stream->pos - stream->window_pos;
+
+			chunk = MIN(count, stream->window_used - offset);
+			memcpy(buffer, stream->window + offset, chunk);
+		} else if (IS_ALIGNED(stream->pos, block_size) &&
+			   count >= window_size) {
+			lba_t sector = stream->start_sector +
+				       stream->pos / block_size;
+			lba_t sectors = count / block_size;
+
+			if (ops->read(ops, sector, sectors, buffer) != sectors)
+				break;
+			chunk = sectors * block_size;
+		} else {
+			if (simple_stream_fill_window(stream))
+				break;
+			continue;
 		}
-		if (stream->blockdev->ops.read(&stream->blockdev->ops,
-					       stream->current_sector, 1,
-					       stream->block_buf) != 1)
-			return bytes_read;
-		if (buffer)
-			memcpy(buffer, stream->block_buf, count);
-		bytes_read += count;
-		stream->buf_used = count;
+
+		buffer += chunk;
+		bytes_read += chunk;
+		count -= chunk;
+		stream->pos += chunk;
 	}
 
 	return bytes_read;
 }
 
+/* Skip bytes without reading them. Returns number of bytes skipped. */
 uint64_t simple_stream_skip(StreamOps *me, uint64_t count)
 {
-	/* Calling read with NULL buffer will skip bytes from stream */
-	return simple_stream_read(me, count, NULL);
+	SimpleStream *stream = container_of(me, SimpleStream, stream);
+
+	if (count > simple_stream_size(stream) - stream->pos) {
+		printf("skip_stream_simple past the end, "
+		       "end_sector=%lld, pos=%lld, count=%lld\n",
+		       stream->end_sector, stream->pos, count);
+		count = simple_stream_size(stream) - stream->pos;
+	}
+
+	stream->pos += count;
+	return count;
 }
 
 static void simple_stream_close(StreamOps *me)
 {
 	SimpleStream *stream = container_of(me, SimpleStream, stream);
 
-	free(stream->block_buf);
+	free(stream->window);
 	free(stream);
 }
 
-StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count)
+StreamOps *new_simple_stream_window(BlockDevOps *me, lba_t start, lba_t count,
+				    lba_t window_blocks)
 {
 	BlockDev *blockdev = (BlockDev *)me;
 	SimpleStream *stream = xzalloc(sizeof(*stream));
 	stream->blockdev = blockdev;
-	stream->current_sector = start;
+	stream->start_sector = start;
 	stream->end_sector = start + count;
+	stream->window_blocks = MAX(MIN(window_blocks, count), 1);
 	stream->stream.read = simple_stream_read;
 	stream->stream.close = simple_stream_close;
 	stream->stream.skip = simple_stream_skip;
-	/* Mark that there is no data in the block_buf to read right away */
-	stream->buf_used = blockdev->block_size;
-	stream->block_buf = xmalloc(blockdev->block_size);
 	/* Check that block size is a power of 2 */
 	assert((blockdev->block_size & (blockdev->block_size - 1)) == 0);
 	return &stream->stream;
 }
 
+StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count)
+{
+	BlockDev *blockdev = (BlockDev *)me;
+
+	return new_simple_stream_window(me, start, count,
+			SIMPLE_STREAM_READAHEAD_BYTES / blockdev->block_size);
+}
+
 static int blockdev_write_unaligned(BlockDevOps *me, const lba_t lba, const uint64_t offset,
-				    void *data, size_t data_len)
+				    const void *data, size_t data_len)
 {
 	BlockDev *blockdev = (BlockDev *)me;
 	uint8_t *block = xmalloc(blockdev->block_size);
@@ -247,7 +290,8 @@ uint64_t blockdev_fill_write_bytes(BlockDevOps *me, uint64_t start, uint64_t cou
 	return written;
 }
 
-uint64_t blockdev_write_bytes(BlockDevOps *me, uint64_t addr, void *data, size_t data_len)
+uint64_t blockdev_write_bytes(BlockDevOps *me, uint64_t addr, const void *data,
+			      size_t data_len)
 {
 	const BlockDev *blockdev = (BlockDev *)me;
 	const uint32_t block_size = blockdev->block_size;
@@ -284,6 +328,63 @@ uint64_t blockdev_write_bytes(BlockDevOps *me, uint64_t addr, void *data, size_t
 	return written;
 }
 
+/* Minimum buffer alignment for DMA straight into the caller's buffer */
+#define BLOCKDEV_INPLACE_DMA_ALIGN	4
+
+lba_t blockdev_split_rw(BlockDevOps *me, lba_t start, lba_t count, void *buffer,
+			bool read, BlockDevRwFn rw)
+{
+	BlockDev *blockdev = (BlockDev *)me;
+	const uint32_t block_size = blockdev->block_size;
+	const uintptr_t addr = (uintptr_t)buffer;
+	uint8_t *edge;
+	lba_t ret;
+
+	blockdev->dma_bytes += count * block_size;
+
+	if (dma_coherent(buffer) || IS_ALIGNED(addr, ARCH_DMA_MINALIGN))
+		return rw(me, start, count, buffer, read, 0);
+
+	/* Device can't DMA to this address, let the driver bounce all of it */
+	if (!IS_ALIGNED(addr, BLOCKDEV_INPLACE_DMA_ALIGN) ||
+	    !IS_ALIGNED(block_size, ARCH_DMA_MINALIGN) || (read && count < 3)) {
+		blockdev->bounced_bytes += count * block_size;
+		return rw(me, start, count, buffer, read, 0);
+	}
+
+	/* DMA only reads the buffer, cleaning partial cache lines is harmless */
+	if (!read)
+		return rw(me, start, count, buffer, read, GEN_BB_INPLACE);
+
+	/*
+	 * The partial cache lines at both ends of the middle blocks are only
+	 * shared with the first and the last block, which are copied in after
+	 * the middle has been invalidated.
+	 */
+	ret = rw(me, start + 1, count - 2, buffer + block_size, read,
+		 GEN_BB_INPLACE);
+	if (ret != count - 2)
+		return 0;
+
+	edge = xmemalign(ARCH_DMA_MINALIGN, block_size);
+	blockdev->bounced_bytes += 2 * block_size;
+
+	if (rw(me, start, 1, edge, read, 0) != 1) {
+		free(edge);
+		return 0;
+	}
+	memcpy(buffer, edge, block_size);
+
+	if (rw(me, start + count - 1, 1, edge, read, 0) != 1) {
+		free(edge);
+		return 0;
+	}
+	memcpy(buffer + (count - 1) * block_size, edge, block_size);
+
+	free(edge);
+	return count;
+}
+
 int get_all_bdevs(blockdev_type_t type, struct list_node **bdevs)
 {
 	struct list_node *ctrlrs, *devs;
@@ -296,14 +397,38 @@ int get_all_bdevs(blockdev_type_t type, struct list_node **bdevs)
 		ctrlrs = &removable_block_dev_controllers;
 	}
 
-	/* Update any controllers that need it. */
+	/*
+	 * Start resetting all fixed controllers before waiting for any of
+	 * them, so that they come up in parallel. Removable controllers are
+	 * polled for media repeatedly and are not worth the overhead.
+	 */
 	BlockDevCtrlr *ctrlr;
+	bool kicked = false;
+	if (type == BLOCKDEV_FIXED) {
+		list_for_each(ctrlr, *ctrlrs, list_node) {
+			if (!ctrlr->ops.kick || !ctrlr->need_update)
+				continue;
+			if (!kicked) {
+				timestamp_add_now(TS_STORAGE_KICK_START);
+				kicked = true;
+			}
+			if (ctrlr->ops.kick(&ctrlr->ops))
+				printf("Starting storage controller failed.\n");
+		}
+		if (kicked)
+			timestamp_add_now(TS_STORAGE_KICK_DONE);
+	}
+
+	/* Update any controllers that need it. */
 	list_for_each(ctrlr, *ctrlrs, list_node) {
 		if (ctrlr->ops.update && ctrlr->need_update &&
 		    ctrlr->ops.update(&ctrlr->ops))
 			printf("Updating storage controller failed.\n");
 	}
 
+	if (kicked)
+		timestamp_add_now(TS_STORAGE_FINISH_DONE);
+
 	if (bdevs)
 		*bdevs = devs;
 	return list_length(devs);
@@ -19,6 +19,7 @@
 #define __DRIVERS_STORAGE_BLOCKDEV_H__
 
 #include <commonlib/list.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "drivers/storage/stream.h"
@@ -61,6 +62,9 @@ typedef struct BlockDev {
 	int removable;
 	unsigned block_size;
 	lba_t block_count;		/* size addressable by read/write */
+	int erase_zeroes;		/* erased blocks read back as zeroes */
+	uint64_t dma_bytes;		/* bytes moved by blockdev_split_rw() */
+	uint64_t bounced_bytes;		/* ... of which went through a bounce buffer */
 	struct list_node list_node;
 } BlockDev;
 
@@ -68,6 +72,13 @@ extern struct list_node fixed_block_devices;
 extern struct list_node removable_block_devices;
 
 typedef struct BlockDevCtrlrOps {
+	/*
+	 * Optional. Start resetting the controller without waiting for it to
+	 * come up, so that all fixed controllers can reset in parallel.
+	 * update() then finishes the initialization, or returns the failure
+	 * kick() ran into. 0 = success, nonzero = failure
+	 */
+	int (*kick)(struct BlockDevCtrlrOps *me);
 	int (*update)(struct BlockDevCtrlrOps *me);
 	/*
 	 * Check if a block device is owned by the ctrlr. 1 = success, 0 =
@@ -93,6 +104,15 @@ typedef struct BlockDevCtrlr {
 extern struct list_node fixed_block_dev_controllers;
 extern struct list_node removable_block_dev_controllers;
 
+/* Default read-ahead window of streams created by new_simple_stream() */
+#define SIMPLE_STREAM_READAHEAD_BYTES	(64 * 1024)
+
+/*
+ * Create a stream over 'count' blocks starting at 'start' which serves reads
+ * smaller than 'window_blocks' blocks from a read-ahead window.
+ */
+StreamOps *new_simple_stream_window(BlockDevOps *me, lba_t start, lba_t count,
+				    lba_t window_blocks);
 StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count);
 
 typedef enum {
@@ -110,11 +130,30 @@ int get_all_bdevs(blockdev_type_t type, struct list_node **bdevs);
 uint64_t blockdev_fill_write_bytes(BlockDevOps *me, uint64_t start, uint64_t count,
 				   uint32_t fill_pattern);
 
+/*
+ * Driver transfer function used by blockdev_split_rw(). 'bbflags' has to be
+ * added to the flags the driver passes to bounce_buffer_start().
+ */
+typedef lba_t (*BlockDevRwFn)(BlockDevOps *me, lba_t start, lba_t count,
+			      void *buffer, bool read, unsigned int bbflags);
+
+/*
+ * Read or write 'count' blocks with 'rw', avoiding a bounce copy of the whole
+ * transfer when 'buffer' is not aligned for DMA. Reads bounce only the first
+ * and the last block, which share cache lines with memory outside the buffer,
+ * and DMA the blocks in between straight into 'buffer'. Writes never need to
+ * bounce, as the device only reads the buffer. Updates the dma_bytes and
+ * bounced_bytes counters of the device.
+ */
+lba_t blockdev_split_rw(BlockDevOps *me, lba_t start, lba_t count, void *buffer,
+			bool read, BlockDevRwFn rw);
+
 /*
  * Write 'data' starting at byte 'addr'. Writes unaligned to block size are handled by reading
  * unaligned block, copying data to be written at offset and writing whole block back to
  * the block device.
  */
-uint64_t blockdev_write_bytes(BlockDevOps *me, uint64_t addr, void *data, size_t data_len);
+uint64_t blockdev_write_bytes(BlockDevOps *me, uint64_t addr, const void *data,
+			      size_t data_len);
 
 #endif /* __DRIVERS_STORAGE_BLOCKDEV_H__ */
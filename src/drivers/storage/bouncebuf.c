@@ -66,7 +66,7 @@ int bounce_buffer_start(struct bounce_buffer *state, void *data,
 	if (dma_coherent(data))
 		return 0;
 
-	if (!addr_aligned(state)) {
+	if (!(state->flags & GEN_BB_INPLACE) && !addr_aligned(state)) {
 		state->bounce_buffer = memalign(ARCH_DMA_MINALIGN,
 						state->len_aligned);
 		if (!state->bounce_buffer)
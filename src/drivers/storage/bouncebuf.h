@@ -50,6 +50,13 @@
  * used directly) upon stop() call.
  */
 #define GEN_BB_RW	(GEN_BB_READ | GEN_BB_WRITE)
+/*
+ * GEN_BB_INPLACE -- The buffer is used for DMA directly even if it is not
+ * aligned. Only valid if the cache lines partially covered by the buffer hold
+ * nothing but data that the caller overwrites after the transfer, see
+ * blockdev_split_rw().
+ */
+#define GEN_BB_INPLACE	(1 << 2)
 
 struct bounce_buffer {
 	/* Copy of data parameter passed to start() */
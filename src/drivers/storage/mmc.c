@@ -1237,6 +1237,10 @@ static int mmc_startup(MmcMedia *media)
 			(extract_uint32_bits(media->csd, 86, 5) + 1);
 
 	media->trim_mult = ext_csd[EXT_CSD_TRIM_MULT];
+	/* Trimmed blocks read back as ERASED_MEM_CONT */
+	media->dev.erase_zeroes = !IS_SD(media) &&
+				  media->version >= MMC_VERSION_4 &&
+				  !ext_csd[EXT_CSD_ERASED_MEM_CONT];
 
 	return 0;
 }
@@ -1294,7 +1298,11 @@ static int mmc_early_init(MmcMedia *media)
 	return err;
 }
 
-int mmc_setup_media(MmcCtrlr *ctrlr)
+/*
+ * Reset the card and send the first operating condition command. Returns 0
+ * or MMC_IN_PROGRESS and the new media in 'media_out' on success.
+ */
+static int mmc_start_media(MmcCtrlr *ctrlr, MmcMedia **media_out)
 {
 	int err;
 
@@ -1332,6 +1340,40 @@ int mmc_setup_media(MmcCtrlr *ctrlr)
 		return err;
 	}
 
+	*media_out = media;
+	return err;
+}
+
+int mmc_kick_media(MmcCtrlr *ctrlr)
+{
+	int err;
+
+	if (ctrlr->kicked_media)
+		return 0;
+
+	err = mmc_start_media(ctrlr, &ctrlr->kicked_media);
+	if (err && err != MMC_IN_PROGRESS)
+		return err;
+
+	ctrlr->kick_status = err;
+	return 0;
+}
+
+int mmc_setup_media(MmcCtrlr *ctrlr)
+{
+	MmcMedia *media;
+	int err;
+
+	if (ctrlr->kicked_media) {
+		media = ctrlr->kicked_media;
+		err = ctrlr->kick_status;
+		ctrlr->kicked_media = NULL;
+	} else {
+		err = mmc_start_media(ctrlr, &media);
+		if (err && err != MMC_IN_PROGRESS)
+			return err;
+	}
+
 	if (err == MMC_IN_PROGRESS)
 		err = mmc_complete_op_cond(media);
 
@@ -168,6 +168,7 @@ enum {
 #define EXT_CSD_PARTITIONING_SUPPORT	160	/* RO */
 #define EXT_CSD_ERASE_GROUP_DEF		175	/* R/W */
 #define EXT_CSD_PART_CONF		179	/* R/W */
+#define EXT_CSD_ERASED_MEM_CONT		181	/* RO */
 #define EXT_CSD_BUS_WIDTH		183	/* R/W */
 #define EXT_CSD_STROBE_SUPPORT		184	/* RO */
 #define EXT_CSD_HS_TIMING		185	/* R/W */
@@ -343,6 +344,10 @@ typedef struct MmcCtrlr {
 	 */
 	uint32_t hardcoded_voltage;
 
+	/* Media started by mmc_kick_media(), finished by mmc_setup_media() */
+	MmcMedia *kicked_media;
+	int kick_status;
+
 	int (*send_cmd)(struct MmcCtrlr *me, MmcCommand *cmd, MmcData *data);
 	void (*set_ios)(struct MmcCtrlr *me);
 	int (*execute_tuning)(MmcMedia *media);
@@ -388,6 +393,11 @@ int mmc_busy_wait_io(volatile uint32_t *address, uint32_t *output,
 int mmc_busy_wait_io_until(volatile uint32_t *address, uint32_t *output,
 			   uint32_t io_mask, uint32_t timeout_ms);
 
+/*
+ * Start powering up the card without waiting for it to become ready. The next
+ * mmc_setup_media() call finishes the setup.
+ */
+int mmc_kick_media(MmcCtrlr *ctrlr);
 int mmc_setup_media(MmcCtrlr *ctrlr);
 
 lba_t block_mmc_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer);
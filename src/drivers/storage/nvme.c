@@ -21,28 +21,30 @@
  * 2.
  * This driver is limited to a single IO queue pair (in addition to the
  * mandatory Admin queue pair). The IO queue depth is configurable, but has
- * shallow defaults to minimize host memory consumption. This driver only
- * supports a maximum of one PRP List, limiting the maximum transfer size to
- * 2MB (assuming 4KB memory pages).
+ * shallow defaults to minimize host memory consumption. This driver chains up
+ * to MAX_PRP_LISTS PRP Lists per command, limiting the maximum transfer size
+ * to NVME_MAX_XFER_BYTES (4MB, assuming 4KB memory pages).
  *
  * Operation:
  * At initialization this driver allocates a pool of host memory and overlays
  * the queue pair structures. It also statically allocates a block of memory
- * for a PRP List, avoiding the need to allocate/free memory at IO time.
+ * for the PRP Lists of each IO queue slot, avoiding the need to allocate/free
+ * memory at IO time.
  * Each identified NVMe namespace has a corresponding depthcharge BlockDev
  * structure, effectively creating a new "drive" visible to higher levels.
  *
  * The depthcharge read/write callbacks split host requests into chunks
  * satisfying the NVMe device's maximum transfer size limitations. Then they
  * call the corresponding _internal_ functions to facilitate formatting of the
- * NVMe structures in host memory. After all of the commands have been created
- * in host memory the Submission Queue tail pointer is updated allowing the
- * drive to process the newly submitted commands. Queuing commands allows the
- * drive to internally optimize accesses, increasing performance. Finally, the
- * Completion Queue phase bit is polled until it inverts, indicating that the
- * command has completed. If the SQ is full, outstanding commands will be
- * completed before the _internal_ function proceeds. This situation reduces
- * effective performance and should be avoided by increasing SQ/CQ depth.
+ * NVMe structures in host memory. The Submission Queue tail doorbell is rung
+ * as soon as each command has been created, so the drive starts working on the
+ * first chunk while later ones are still being prepared. Keeping several
+ * commands in flight allows the drive to internally optimize accesses,
+ * increasing performance. Once the SQ is full (or the request is done) the
+ * whole batch is reaped: the Completion Queue phase bit is polled until it
+ * inverts for every outstanding command, and the CQ head doorbell is rung once.
+ * Bounce buffers of queued commands are only released after the batch has
+ * completed, so unaligned transfers are queued as well.
  */
 
 #include <assert.h>
@@ -125,8 +127,8 @@ static NVME_STATUS nvme_disable_controller(NvmeCtrlr *ctrlr)
 	return nvme_wait_status(ctrlr, NVME_CSTS_RDY, 0);
 }
 
-/* Enables controller and verifies that it's ready */
-static NVME_STATUS nvme_enable_controller(NvmeCtrlr *ctrlr)
+/* Enables controller without waiting for it to become ready */
+static void nvme_enable_controller(NvmeCtrlr *ctrlr)
 {
 	NVME_CC cc = 0;
 
@@ -135,8 +137,6 @@ static NVME_STATUS nvme_enable_controller(NvmeCtrlr *ctrlr)
 	cc |= NVME_CC_IOCQES(4); /* Spec. recommended values */
 	/* Write controller configuration. */
 	write32_with_flush(ctrlr->ctrlr_regs + NVME_CC_OFFSET, cc);
-
-	return nvme_wait_status(ctrlr, NVME_CSTS_RDY, NVME_CSTS_RDY);
 }
 
 /* Shutdown controller before power cycle */
@@ -188,6 +188,22 @@ static NVME_STATUS nvme_submit_cmd(NvmeCtrlr *ctrlr, uint16_t qid,
 	return NVME_SUCCESS;
 }
 
+/*
+ * Ring SQ doorbell by writing SQ tail index to controller,
+ * submitting all outstanding commands to HW
+ */
+static void nvme_ring_sq_doorbell(NvmeCtrlr *ctrlr, uint16_t qid)
+{
+	uint32_t offset;
+
+	if (ctrlr->sq_t_dbl_hw[qid] == ctrlr->sq_t_dbl[qid])
+		return;
+
+	offset = NVME_SQTDBL_OFFSET(qid, NVME_CAP_DSTRD(ctrlr->cap));
+	write32_with_flush(ctrlr->ctrlr_regs + offset, ctrlr->sq_t_dbl[qid]);
+	ctrlr->sq_t_dbl_hw[qid] = ctrlr->sq_t_dbl[qid];
+}
+
 static NVME_STATUS nvme_sync_cmd(NvmeCtrlr *ctrlr, uint16_t qid,
 				 uint32_t sqsize, uint32_t cqsize,
 				 uint32_t timeout_ms)
@@ -203,12 +219,8 @@ static NVME_STATUS nvme_sync_cmd(NvmeCtrlr *ctrlr, uint16_t qid,
 	if (!timeout_ms)
 		timeout_ms = 1;
 
-	/*
-	 * Ring SQ doorbell by writing SQ tail index to controller,
-	 * submitting all outstanding command to HW
-	 */
-	offset = NVME_SQTDBL_OFFSET(qid, NVME_CAP_DSTRD(ctrlr->cap));
-	write32_with_flush(ctrlr->ctrlr_regs + offset, ctrlr->sq_t_dbl[qid]);
+	/* Submit anything that hasn't been handed to HW yet */
+	nvme_ring_sq_doorbell(ctrlr, qid);
 
 	/* Poll for completion of all commands from HW */
 	if (ctrlr->cq_h_dbl[qid] < ctrlr->sq_t_dbl[qid])
@@ -407,19 +419,28 @@ static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint64_t *prp, void *buffer,
 		return NVME_SUCCESS;
 	}
 
-	/* Case 2: Need to build up to one PRP List */
+	/* Case 2: Need to build up to MAX_PRP_LISTS chained PRP Lists */
 	xfer_pages = (ALIGN((size + offset), NVME_PAGE_SIZE) >> NVME_PAGE_SHIFT);
 	/* Don't count first prp entry as it is the beginning of buffer */
 	xfer_pages--;
-	/* Make sure this transfer fits into one PRP list */
-	if (xfer_pages > (NVME_MAX_XFER_BYTES/NVME_PAGE_SIZE))
+	/* Make sure this transfer fits into the chained PRP lists */
+	if (xfer_pages > MAX_PRP_LISTS * (PRP_ENTRIES_PER_LIST - 1) + 1)
 		return NVME_INVALID_PARAMETER;
 
-	/* Fill the PRP List */
+	/* Fill the PRP Lists */
 	prp[1] = (uintptr_t)virt_to_phys(prp_list);
-	for (uint32_t entry_index = 0; entry_index < xfer_pages; entry_index++) {
-		prp_list->prp_entry[entry_index] = buffer_phys;
+	uint32_t entry_index = 0;
+	while (xfer_pages) {
+		/* Last entry points to the next list if more than 1 page is left */
+		if (entry_index == PRP_ENTRIES_PER_LIST - 1 && xfer_pages > 1) {
+			prp_list->prp_entry[entry_index] =
+				(uintptr_t)virt_to_phys(prp_list + 1);
+			prp_list++;
+			entry_index = 0;
+		}
+		prp_list->prp_entry[entry_index++] = buffer_phys;
 		buffer_phys += NVME_PAGE_SIZE;
+		xfer_pages--;
 	}
 	return NVME_SUCCESS;
 }
@@ -441,7 +462,7 @@ static NVME_STATUS nvme_block_rw(NvmeDrive *drive, void *buffer, lba_t start,
 		DEBUG("%s: Too many outstanding commands. Completing in-flights\n",
 		      __func__);
 		status = nvme_sync_cmd(ctrlr, NVME_IO_QUEUE_INDEX,
-				       ctrlr->iosq_sz, NVME_CCQ_SIZE,
+				       ctrlr->iosq_sz, ctrlr->iocq_sz,
 				       NVME_GENERIC_TIMEOUT);
 		if (NVME_ERROR(status)) {
 			printf("%s: error %d completing outstanding commands\n",
@@ -475,15 +496,45 @@ static NVME_STATUS nvme_block_rw(NvmeDrive *drive, void *buffer, lba_t start,
 	sq->cdw11 = (start >> 32);
 	sq->cdw12 = (count - 1) & 0xFFFF;
 
-	return nvme_submit_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
+	status = nvme_submit_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
+	if (NVME_ERROR(status))
+		return status;
+
+	/* Let the drive start on this command while the next one is built */
+	nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
+	return NVME_SUCCESS;
+}
+
+/*
+ * Reap a batch of queued IO commands and release their bounce buffers
+ *
+ * ctrlr: NVMe controller handle
+ * bbstate: bounce buffer states of the queued commands
+ * ncmds: number of queued commands
+ */
+static NVME_STATUS nvme_complete_io(NvmeCtrlr *ctrlr,
+				    struct bounce_buffer *bbstate,
+				    unsigned int ncmds)
+{
+	NVME_STATUS status;
+
+	DEBUG("%s: reaping %u queued commands\n", __func__, ncmds);
+	status = nvme_sync_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz,
+			       ctrlr->iocq_sz, NVME_GENERIC_TIMEOUT);
+
+	for (unsigned int i = 0; i < ncmds; i++)
+		bounce_buffer_stop(&bbstate[i]);
+
+	return status;
 }
 
 /*
  * Read/write operation entrypoint
- * Cut operation into max_transfer chunks and do it
+ * Cut operation into max_transfer chunks, keep up to a full SQ of them in
+ * flight and complete them in batches
  */
 static lba_t nvme_rw(BlockDevOps *me, lba_t start, lba_t count, void *buffer,
-		     bool read)
+		     bool read, unsigned int extra_bbflags)
 {
 	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 	NvmeCtrlr *ctrlr = drive->ctrlr;
@@ -492,18 +543,23 @@ static lba_t nvme_rw(BlockDevOps *me, lba_t start, lba_t count, void *buffer,
 	lba_t orig_count = count;
 	lba_t blocks;
 	int status = NVME_SUCCESS;
-	bool needs_sync = false;
-
-	struct bounce_buffer bbstate;
+	NVME_STATUS reap_status;
+
+	/* One bounce buffer state per queued command */
+	struct bounce_buffer bbstate[NVME_CSQ_SIZE];
+	unsigned int queued = 0;
+	size_t bounced_bytes = 0;
+	/* One SQ slot always stays empty to tell a full queue from an empty one */
+	const unsigned int max_queued = ctrlr->iosq_sz - 1;
 	/* Read operation writes to bounce buffer (GEN_BB_WRITE) */
-	unsigned int bbflags = read ? GEN_BB_WRITE : GEN_BB_READ;
+	unsigned int bbflags = (read ? GEN_BB_WRITE : GEN_BB_READ) | extra_bbflags;
 
 	DEBUG("%s: %s namespace %d\n", __func__,
 	      read ? "Reading from" : "Writing to", drive->namespace_id);
 
 	if (ctrlr->controller_data->mdts != 0)
 		max_transfer_blocks = ((1 << (ctrlr->controller_data->mdts)) * (1 << NVME_CAP_MPSMIN(ctrlr->cap))) / block_size;
-	/* Artificially limit max_transfer_blocks to 1 PRP List */
+	/* Artificially limit max_transfer_blocks to the chained PRP Lists */
 	if ((max_transfer_blocks == 0) ||
 	    (max_transfer_blocks > NVME_MAX_XFER_BYTES / block_size))
 		max_transfer_blocks = NVME_MAX_XFER_BYTES / block_size;
@@ -512,49 +568,57 @@ static lba_t nvme_rw(BlockDevOps *me, lba_t start, lba_t count, void *buffer,
 	while (count > 0) {
 		blocks = MIN(count, max_transfer_blocks);
 
-		needs_sync = true;
-		const int ret = bounce_buffer_start(&bbstate, buffer,
+		struct bounce_buffer *bb = &bbstate[queued];
+		const int ret = bounce_buffer_start(bb, buffer,
 					blocks * drive->dev.block_size,
 					bbflags);
 		if (ret) {
 			printf("%s: error: Failed to allocate bounce buffer.\n",
 				__func__);
-			return 0;
+			status = NVME_OUT_OF_RESOURCES;
+			break;
 		}
 
 		DEBUG("%s: %s %s of %llu blocks\n",
 			__func__, (count > blocks) ? "partial" : "final", op, blocks);
-		status = nvme_block_rw(drive, bbstate.bounce_buffer, start,
+		status = nvme_block_rw(drive, bb->bounce_buffer, start,
 					blocks, read);
+		if (NVME_ERROR(status)) {
+			bounce_buffer_stop(bb);
+			printf("%s: Internal %s failed\n", __func__, op);
+			break;
+		}
+		queued++;
+		if (bounce_buffer_did_bounce(bb))
+			bounced_bytes += bb->len_aligned;
+
 		count -= blocks;
 		buffer += blocks * block_size;
 		start += blocks;
 
-		if (!NVME_ERROR(status) && bounce_buffer_did_bounce(&bbstate)) {
-			status = nvme_sync_cmd(ctrlr, NVME_IO_QUEUE_INDEX,
-					       ctrlr->iosq_sz, NVME_CCQ_SIZE,
-					       NVME_GENERIC_TIMEOUT);
-			needs_sync = false;
-		}
-
-		bounce_buffer_stop(&bbstate);
+		/* Keep queuing until the SQ or the bounce budget is used up */
+		if (count > 0 && queued < max_queued &&
+		    bounced_bytes < NVME_MAX_BOUNCE_INFLIGHT_BYTES)
+			continue;
 
+		status = nvme_complete_io(ctrlr, bbstate, queued);
+		queued = 0;
+		bounced_bytes = 0;
 		if (NVME_ERROR(status)) {
-			printf("%s: Internal %s failed\n", __func__, op);
-			goto out;
+			printf("%s: error %d failed to sync command\n",
+			       __func__, status);
+			break;
 		}
 	}
 
-	if (needs_sync) {
-		status = nvme_sync_cmd(ctrlr, NVME_IO_QUEUE_INDEX,
-				       ctrlr->iosq_sz, NVME_CCQ_SIZE,
-				       NVME_GENERIC_TIMEOUT);
-		if (NVME_ERROR(status))
+	/* Don't leave commands in flight after an error */
+	if (queued) {
+		reap_status = nvme_complete_io(ctrlr, bbstate, queued);
+		if (NVME_ERROR(reap_status))
 			printf("%s: error %d failed to sync command\n",
-			__func__, status);
+			       __func__, reap_status);
 	}
 
-out:
 	DEBUG("%s: lba = %#08x, Original = %#08x, Remaining = %#08x, BlockSize = %#x Status = %d\n",
 	      __func__, (uint32_t)start, (uint32_t)orig_count, (uint32_t)count,
 	      block_size, status);
@@ -567,13 +631,83 @@ out:
 
 static lba_t nvme_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
 {
-	return nvme_rw(me, start, count, buffer, true);
+	return blockdev_split_rw(me, start, count, buffer, true, &nvme_rw);
 }
 
 static lba_t nvme_write(BlockDevOps *me, lba_t start, lba_t count,
 			const void *buffer)
 {
-	return nvme_rw(me, start, count, (void *)buffer, false);
+	return blockdev_split_rw(me, start, count, (void *)buffer, false,
+				 &nvme_rw);
+}
+
+/*
+ * Erase entrypoint
+ * Deallocate the blocks with Dataset Management, up to NVME_DSM_MAX_RANGES
+ * ranges per command
+ */
+static lba_t nvme_erase(BlockDevOps *me, lba_t start, lba_t count)
+{
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
+	NvmeCtrlr *ctrlr = drive->ctrlr;
+	NVME_DSM_RANGE *ranges;
+	lba_t orig_count = count;
+	int status = NVME_SUCCESS;
+	NVME_SQ *sq;
+
+	DEBUG("%s: Deallocating %llu blocks at %llu of namespace %d\n",
+	      __func__, count, start, drive->namespace_id);
+
+	ranges = dma_memalign(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+	if (ranges == NULL) {
+		printf("%s: ERROR - out of memory\n", __func__);
+		return 0;
+	}
+
+	while (count > 0) {
+		unsigned int nr = 0;
+
+		memset(ranges, 0, NVME_PAGE_SIZE);
+		while (count > 0 && nr < NVME_DSM_MAX_RANGES) {
+			uint32_t blocks = MIN(count, UINT32_MAX);
+
+			ranges[nr].nlb = blocks;
+			ranges[nr].slba = start;
+			nr++;
+			start += blocks;
+			count -= blocks;
+		}
+
+		/* Reads and writes complete all their commands, the SQ is empty */
+		sq = ctrlr->sq_buffer[NVME_IO_QUEUE_INDEX] +
+		     ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX];
+		memset(sq, 0, sizeof(NVME_SQ));
+
+		sq->opc = NVME_IO_DSM_OPC;
+		sq->cid = ctrlr->cid[NVME_IO_QUEUE_INDEX]++;
+		sq->nsid = drive->namespace_id;
+		/* The range list fits in one aligned page */
+		sq->prp[0] = (uintptr_t)virt_to_phys(ranges);
+		sq->cdw10 = nr - 1;
+		sq->cdw11 = NVME_DSM_ATTR_DEALLOCATE;
+
+		status = nvme_do_one_cmd_synchronous(ctrlr, NVME_IO_QUEUE_INDEX,
+						     ctrlr->iosq_sz,
+						     ctrlr->iocq_sz,
+						     NVME_GENERIC_TIMEOUT);
+		if (NVME_ERROR(status)) {
+			printf("%s: error %d deallocating blocks\n", __func__,
+			       status);
+			break;
+		}
+	}
+
+	free(ranges);
+
+	if (NVME_ERROR(status))
+		return 0;
+	else
+		return orig_count;
 }
 
 static NVME_STATUS nvme_read_log_page(NvmeDrive *drive, int log_page_id,
@@ -790,7 +924,8 @@ static uint32_t nvme_test_support(void)
 }
 
 static NVME_STATUS nvme_create_drive(NvmeCtrlr *ctrlr, uint32_t namespace_id,
-				     unsigned int block_size, lba_t block_count)
+				     unsigned int block_size, lba_t block_count,
+				     uint8_t dlfeat)
 {
 	/* Create drive node. */
 	NvmeDrive *nvme_drive = xzalloc(sizeof(*nvme_drive));
@@ -806,6 +941,12 @@ static NVME_STATUS nvme_create_drive(NvmeCtrlr *ctrlr, uint32_t namespace_id,
 		nvme_drive->dev.ops.test_control = &nvme_test_control;
 		nvme_drive->dev.ops.test_support = &nvme_test_support;
 	}
+	if (CONFIG(SPARSE_WRITE_ERASE) &&
+	    ISSET(ctrlr->controller_data->oncs, NVME_ONCS_DSM)) {
+		nvme_drive->dev.ops.erase = &nvme_erase;
+		nvme_drive->dev.erase_zeroes = (dlfeat & NVME_DLFEAT_READ_MASK) ==
+					       NVME_DLFEAT_READ_ZEROES;
+	}
 	nvme_drive->dev.name = name;
 	nvme_drive->dev.removable = 0;
 	nvme_drive->dev.block_size = block_size;
@@ -922,7 +1063,8 @@ static NVME_STATUS nvme_identify_namespaces(NvmeCtrlr *ctrlr)
 				2 << (namespace_data->lba_format[
 				      namespace_data->flbas & 0xF].lbads - 1);
 			status = nvme_create_drive(ctrlr, index, block_size,
-						   namespace_data->nsze);
+						   namespace_data->nsze,
+						   namespace_data->dlfeat);
 			if (NVME_ERROR(status))
 				goto exit;
 		}
@@ -991,28 +1133,31 @@ static int nvme_shutdown(struct CleanupFunc *cleanup, CleanupType type)
 	}
 	free(prev);
 	free(ctrlr->controller_data);
-	free(ctrlr->prp_list);
+	for (unsigned int i = 0; i < ctrlr->iosq_sz; i++)
+		free(ctrlr->prp_list[i]);
 	free(ctrlr->buffer);
 	free(ctrlr);
 	return 0;
 }
 
 /* Initialization entrypoint */
-static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
+/*
+ * Finds and resets the controller, sets up the admin queues and enables it.
+ * Does not wait for the controller to become ready, which can take a while.
+ */
+static NVME_STATUS nvme_ctrlr_start(NvmeCtrlr *ctrlr)
 {
-	NvmeCtrlr *ctrlr = container_of(me, NvmeCtrlr, ctrlr.ops);
 	pcidev_t dev = ctrlr->dev;
-	int status = NVME_SUCCESS;
+	NVME_STATUS status;
 
 	/* If this is not an NVMe device, check if it is a root port */
 	if (!is_nvme_ctrlr(dev)) {
 		uint8_t header_type = pci_read_config8(dev, REG_HEADER_TYPE);
 		header_type &= 0x7f;
 		if (header_type != HEADER_TYPE_BRIDGE) {
-			status = NVME_NOT_FOUND;
 			printf("PCIe bridge not found @ %02x:%02x:%02x\n",
 			       PCI_BUS(dev), PCI_SLOT(dev), PCI_FUNC(dev));
-			goto exit;
+			return NVME_NOT_FOUND;
 		}
 
 		/* Look for NVMe device on this root port */
@@ -1020,10 +1165,9 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 		bus = (bus >> 8) & 0xff;
 		dev = PCI_DEV(bus, 0, 0);
 		if (!is_nvme_ctrlr(dev)) {
-			status = NVME_NOT_FOUND;
 			printf("NVMe device not found @ %02x:%02x:%02x\n",
 			       PCI_BUS(dev), PCI_SLOT(dev), PCI_FUNC(dev));
-			goto exit;
+			return NVME_NOT_FOUND;
 		}
 
 		/* Update the device pointer */
@@ -1043,15 +1187,13 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	/* Verify that the NVM command set is supported */
 	if (NVME_CAP_CSS(ctrlr->cap) != NVME_CAP_CSS_NVM) {
 		printf("NVMe Cap CSS not NVMe (CSS=%01x.\n",(uint8_t)NVME_CAP_CSS(ctrlr->cap));
-		status = NVME_UNSUPPORTED;
-		goto exit;
+		return NVME_UNSUPPORTED;
 	}
 
 	/* Driver only supports 4k page size */
 	if (NVME_CAP_MPSMIN(ctrlr->cap) > NVME_PAGE_SHIFT) {
 		printf("NVMe driver only supports 4k page size.\n");
-		status = NVME_UNSUPPORTED;
-		goto exit;
+		return NVME_UNSUPPORTED;
 	}
 
 	/* Calculate max io sq/cq sizes based on MQES */
@@ -1061,28 +1203,28 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 
 	/* Allocate enough PRP List memory for max queue depth commands */
 	for (unsigned int list_index = 0; list_index < ctrlr->iosq_sz; list_index++) {
-		ctrlr->prp_list[list_index] = dma_memalign(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+		ctrlr->prp_list[list_index] = dma_memalign(NVME_PAGE_SIZE,
+						MAX_PRP_LISTS * NVME_PAGE_SIZE);
 		if (!(ctrlr->prp_list[list_index])) {
 			printf("NVMe driver failed to allocate prp list %u memory\n",list_index);
-			status = NVME_OUT_OF_RESOURCES;
-			goto exit;
+			return NVME_OUT_OF_RESOURCES;
 		}
-		memset(ctrlr->prp_list[list_index], 0, NVME_PAGE_SIZE);
+		memset(ctrlr->prp_list[list_index], 0,
+		       MAX_PRP_LISTS * NVME_PAGE_SIZE);
 	}
 
 	/* Allocate queue memory block */
 	ctrlr->buffer = dma_memalign(NVME_PAGE_SIZE, (NVME_NUM_QUEUES * 2) * NVME_PAGE_SIZE);
 	if (!(ctrlr->buffer)) {
 		printf("NVMe driver failed to allocate queue buffer\n");
-		status = NVME_OUT_OF_RESOURCES;
-		goto exit;
+		return NVME_OUT_OF_RESOURCES;
 	}
 	memset(ctrlr->buffer, 0, (NVME_NUM_QUEUES * 2) * NVME_PAGE_SIZE);
 
 	/* Disable controller */
 	status = nvme_disable_controller(ctrlr);
 	if (NVME_ERROR(status))
-		goto exit;
+		return status;
 
 	/* Create Admin queue pair */
 	NVME_AQA aqa = 0;
@@ -1137,7 +1279,36 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	write32x2le(ctrlr->ctrlr_regs + NVME_ACQ_OFFSET, acq);
 
 	/* Enable controller */
-	status = nvme_enable_controller(ctrlr);
+	nvme_enable_controller(ctrlr);
+
+	return NVME_SUCCESS;
+}
+
+static int nvme_ctrlr_kick(BlockDevCtrlrOps *me)
+{
+	NvmeCtrlr *ctrlr = container_of(me, NvmeCtrlr, ctrlr.ops);
+
+	ctrlr->kick_status = nvme_ctrlr_start(ctrlr);
+	ctrlr->kicked = 1;
+
+	return NVME_ERROR(ctrlr->kick_status);
+}
+
+static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
+{
+	NvmeCtrlr *ctrlr = container_of(me, NvmeCtrlr, ctrlr.ops);
+	int status;
+
+	if (ctrlr->kicked)
+		status = ctrlr->kick_status;
+	else
+		status = nvme_ctrlr_start(ctrlr);
+	ctrlr->kicked = 0;
+	if (NVME_ERROR(status))
+		goto exit;
+
+	/* Wait for the controller to become ready */
+	status = nvme_wait_status(ctrlr, NVME_CSTS_RDY, NVME_CSTS_RDY);
 	if (NVME_ERROR(status))
 		goto exit;
 	ctrlr->enabled = 1;
@@ -1166,7 +1337,7 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 		/* Create drive based on static namespace data */
 		DEBUG("Skip Identify Namespace and use static data\n");
 		status = nvme_create_drive(ctrlr, model->namespace_id,
-				   model->block_size, model->block_count);
+				   model->block_size, model->block_count, 0);
 	} else {
 		/* Identify Namespace and create drive nodes */
 		status = nvme_identify_namespaces(ctrlr);
@@ -1210,6 +1381,7 @@ NvmeCtrlr *new_nvme_ctrlr(pcidev_t dev)
 	printf("Looking for NVMe Controller %p @ %02x:%02x:%02x\n",
 		ctrlr, PCI_BUS(dev),PCI_SLOT(dev),PCI_FUNC(dev));
 
+	ctrlr->ctrlr.ops.kick = &nvme_ctrlr_kick;
 	ctrlr->ctrlr.ops.update = &nvme_ctrlr_init;
 	ctrlr->ctrlr.need_update = 1;
 	ctrlr->dev = dev;
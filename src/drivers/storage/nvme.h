@@ -40,8 +40,6 @@
 #define NVME_PAGE_SHIFT		12
 #define NVME_PAGE_SIZE		(1UL << NVME_PAGE_SHIFT)
 
-/* Max 1 PRP list per transfer */
-#define MAX_PRP_LISTS 1
 /* 8 bytes per entry */
 #define PRP_ENTRY_SHIFT 3
 /* 1 page per list */
@@ -49,7 +47,18 @@
 /* 1 page of memory addressed per entry*/
 #define PRP_ENTRY_XFER_SHIFT NVME_PAGE_SHIFT
 #define PRP_ENTRIES_PER_LIST (1UL << (PRP_LIST_SHIFT - PRP_ENTRY_SHIFT))
-#define NVME_MAX_XFER_BYTES  ((MAX_PRP_LISTS * PRP_ENTRIES_PER_LIST ) << PRP_ENTRY_XFER_SHIFT)
+/* Max 4MB per transfer (further limited by MDTS) */
+#define NVME_MAX_XFER_BYTES  (1UL << 22)
+/*
+ * Number of chained PRP lists needed for one max sized transfer. The last entry
+ * of every list except the final one points to the next list, and PRP1 covers
+ * the first (potentially unaligned) page.
+ */
+#define MAX_PRP_LISTS DIV_ROUND_UP(NVME_MAX_XFER_BYTES >> PRP_ENTRY_XFER_SHIFT, \
+				   PRP_ENTRIES_PER_LIST - 1)
+
+/* Upper bound of bounce buffer memory held by queued IO commands */
+#define NVME_MAX_BOUNCE_INFLIGHT_BYTES	(2 * NVME_MAX_XFER_BYTES)
 
 /* Loop used to poll for command completions
  * timeout in milliseconds
@@ -204,6 +213,19 @@ typedef uint32_t NVME_CQHDBL;
 #define NVME_IO_FLUSH_OPC	0
 #define NVME_IO_WRITE_OPC	1
 #define NVME_IO_READ_OPC	2
+#define NVME_IO_DSM_OPC		9
+
+/* Dataset Management attributes (CDW11) */
+#define NVME_DSM_ATTR_DEALLOCATE	(1 << 2)
+/* Maximum number of ranges in one Dataset Management command */
+#define NVME_DSM_MAX_RANGES	256
+
+/* Dataset Management range */
+typedef struct {
+	uint32_t cattr;	/* Context Attributes */
+	uint32_t nlb;	/* Length in logical blocks */
+	uint64_t slba;	/* Starting LBA */
+} NVME_DSM_RANGE;
 
 /* NVMe log page ID */
 #define NVME_LOG_SMART	0x02
@@ -254,6 +276,11 @@ typedef struct {
 #define NVME_SERIAL_NUMBER_LEN	20
 
 #define NVME_OACS_DEVICE_SELF_TEST	(1 << 4)
+#define NVME_ONCS_DSM			(1 << 2)
+
+/* Deallocated logical blocks read as all zeroes (DLFEAT bits 2:0) */
+#define NVME_DLFEAT_READ_MASK		0x7
+#define NVME_DLFEAT_READ_ZEROES		0x1
 
 /* Identify Controller Data */
 typedef struct {
@@ -333,7 +360,9 @@ typedef struct {
 	uint8_t  dps;	/* End-to-end Data Protection Type Settings */
 	uint8_t  nmic;	/* Namespace Multi-path I/O + NS Sharing Caps */
 	uint8_t  rescap;	/* Reservation Capabilities */
-	uint8_t  rsvd1[88];	/* Reserved as of Nvm Express 1.1 Spec */
+	uint8_t  fpi;	/* Format Progress Indicator */
+	uint8_t  dlfeat;	/* Deallocate Logical Block Features */
+	uint8_t  rsvd1[86];	/* Reserved as of Nvm Express 1.1 Spec */
 	uint64_t eui64;	/* IEEE Extended Unique Identifier */
 
 	NVME_LBAFORMAT lba_format[16];
@@ -416,6 +445,9 @@ typedef struct NvmeCtrlr {
 	struct list_node drives;
 
 	int enabled;
+	/* nvme_ctrlr_kick() ran, kick_status holds its result */
+	int kicked;
+	NVME_STATUS kick_status;
 	pcidev_t dev;
 	void *ctrlr_regs;
 
@@ -428,7 +460,7 @@ typedef struct NvmeCtrlr {
 	/* virtual address of identify controller data */
 	NVME_ADMIN_CONTROLLER_DATA *controller_data;
 
-	/* virtual address of pre-allocated PRP Lists */
+	/* virtual address of pre-allocated PRP Lists, MAX_PRP_LISTS per command */
 	PrpList *prp_list[NVME_CSQ_SIZE];
 
 	/* virtual address of raw buffer, split into queues below */
@@ -439,6 +471,8 @@ typedef struct NvmeCtrlr {
 
 	NVME_SQTDBL sq_t_dbl[NVME_NUM_QUEUES];
 	NVME_CQHDBL cq_h_dbl[NVME_NUM_QUEUES];
+	/* SQ tail as last written to the doorbell register */
+	NVME_SQTDBL sq_t_dbl_hw[NVME_NUM_QUEUES];
 
 	/* current phase of each queue */
 	uint8_t pt[NVME_NUM_QUEUES];
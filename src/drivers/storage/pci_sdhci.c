@@ -147,6 +147,8 @@ SdhciHost *probe_pci_sdhci_host(pcidev_t dev, unsigned int platform_info)
 	 * call. */
 	pci_host->update = pci_host->host.mmc_ctrlr.ctrlr.ops.update;
 	pci_host->host.mmc_ctrlr.ctrlr.ops.update = sdhci_pci_init;
+	/* The controller can't be kicked before sdhci_pci_init found it */
+	pci_host->host.mmc_ctrlr.ctrlr.ops.kick = NULL;
 
 	/*
 	 * We return SdhciHost because SdhciPciHost is an implementation detail
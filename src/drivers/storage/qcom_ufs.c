@@ -390,6 +390,7 @@ struct qcom_ufs_ctlr *new_qcom_ufs_ctlr(uintptr_t hci_base)
 	struct qcom_ufs_ctlr *qcom_ufs = xzalloc(sizeof(*qcom_ufs));
 
 	qcom_ufs->ufs.bctlr.type        = BLOCK_CTRL_UFS;
+	qcom_ufs->ufs.bctlr.ops.kick    = ufs_kick;
 	qcom_ufs->ufs.bctlr.ops.update  = ufs_update;
 	qcom_ufs->ufs.bctlr.need_update = 1;
 	qcom_ufs->ufs.hci_base          = (void *)hci_base;
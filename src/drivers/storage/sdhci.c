@@ -1147,6 +1147,24 @@ static int sdhci_init(SdhciHost *host)
 	return 0;
 }
 
+/* Start bringing up an embedded card, sdhci_update() waits for it */
+static int sdhci_kick(BlockDevCtrlrOps *me)
+{
+	SdhciHost *host = container_of
+		(me, SdhciHost, mmc_ctrlr.ctrlr.ops);
+
+	if (host->mmc_ctrlr.slot_type == MMC_SLOT_TYPE_REMOVABLE ||
+	    host->initialized)
+		return 0;
+
+	if (sdhci_init(host))
+		return -1;
+
+	host->initialized = 1;
+
+	return mmc_kick_media(&host->mmc_ctrlr);
+}
+
 static int sdhci_update(BlockDevCtrlrOps *me)
 {
 	SdhciHost *host = container_of
@@ -1227,6 +1245,7 @@ void add_sdhci(SdhciHost *host)
 		!!(host->platform_info & SDHCI_PLATFORM_VALID_PRESETS);
 
 	host->mmc_ctrlr.ctrlr.ops.is_bdev_owned = block_mmc_is_bdev_owned;
+	host->mmc_ctrlr.ctrlr.ops.kick = &sdhci_kick;
 	host->mmc_ctrlr.ctrlr.ops.update = &sdhci_update;
 	host->mmc_ctrlr.ctrlr.need_update = 1;
 
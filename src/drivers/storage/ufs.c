@@ -17,10 +17,11 @@
  *	support for SCSI READ (10) / WRITE (10)
  *	retry SCSI commands upon Unit Attention Condition
  *	up to slightly under 256 MiB per data transfer
+ *	up to UFS_NUM_TFR_TAGS data transfer commands in flight
  * Caveats / not supported:
  *	no error recovery
  *	non-fatal errors are ignored
- *	only transfer list slot 0 is used
+ *	only transfer list slot 0 is used for non data transfer requests
  *	no task management support
  *	no support for changing UFS device power mode (it is assumed to be active)
  *	DEVICE WLUN, BOOT WLUN and RPMB WLUN are not supported
@@ -79,11 +80,32 @@ static void ufs_read_err_regs(UfsCtlr *ufs, UfsErrRegs *regs)
 	}
 }
 
+static int ufs_check_err_status(UfsCtlr *ufs, uint32_t status)
+{
+	UfsErrRegs regs;
+
+	if (!(status & UFS_IS_MASK_ALL_ERROR))
+		return 0;
+
+	// UFSHCI_IS is RWC i.e. write 1's to clear bits
+	ufs_write32(ufs, UFSHCI_IS, UFS_IS_MASK_ALL_ERROR);
+	// Read and (if UFS_DEBUG) dump error registers
+	ufs_read_err_regs(ufs, &regs);
+	// Check for fatal error interrupts
+	if (status & UFS_IS_MASK_FATAL_ERROR)
+		return ufs_err("Fatal error status %#x", UFS_EIO, status);
+	// Check for fatal data link errors
+	if (regs.uecdl & UFS_UECDL_FATAL_MSK)
+		return ufs_err("Fatal data link error", UFS_EIO);
+
+	return 0;
+}
+
 static int ufs_poll_completion(UfsCtlr *ufs, uint32_t mask, uint32_t drbl, uint64_t timeout_us)
 {
 	uint64_t start = timer_us(0);
-	UfsErrRegs regs;
 	uint32_t status;
+	int rc;
 
 	while (1) {
 		bool timed_out = timer_us(start) > timeout_us;
@@ -98,18 +120,36 @@ static int ufs_poll_completion(UfsCtlr *ufs, uint32_t mask, uint32_t drbl, uint6
 		// Return timed out error only after checking for success
 		if (timed_out)
 			return ufs_err("Timed out", UFS_ETIMEDOUT);
-		if (status & UFS_IS_MASK_ALL_ERROR) {
+		rc = ufs_check_err_status(ufs, status);
+		if (rc)
+			return rc;
+	}
+}
+
+// Wait until at least one of the 'busy' Request List slots completes and
+// return the completed ones in 'done'
+static int ufs_poll_any_completion(UfsCtlr *ufs, uint32_t busy, uint32_t *done,
+				   uint64_t timeout_us)
+{
+	uint64_t start = timer_us(0);
+	int rc;
+
+	while (1) {
+		bool timed_out = timer_us(start) > timeout_us;
+
+		// Check for success (including once after timed_out is true)
+		*done = busy & ~ufs_read32(ufs, UFSHCI_UTRLDBR);
+		if (*done) {
 			// UFSHCI_IS is RWC i.e. write 1's to clear bits
-			ufs_write32(ufs, UFSHCI_IS, UFS_IS_MASK_ALL_ERROR);
-			// Read and (if UFS_DEBUG) dump error registers
-			ufs_read_err_regs(ufs, &regs);
-			// Check for fatal error interrupts
-			if (status & UFS_IS_MASK_FATAL_ERROR)
-				return ufs_err("Fatal error status %#x", UFS_EIO, status);
-			// Check for fatal data link errors
-			if (regs.uecdl & UFS_UECDL_FATAL_MSK)
-				return ufs_err("Fatal data link error", UFS_EIO);
+			ufs_write32(ufs, UFSHCI_IS, BMSK_UTRCS);
+			return 0;
 		}
+		// Return timed out error only after checking for success
+		if (timed_out)
+			return ufs_err("Timed out", UFS_ETIMEDOUT);
+		rc = ufs_check_err_status(ufs, ufs_read32(ufs, UFSHCI_IS));
+		if (rc)
+			return rc;
 	}
 }
 
@@ -361,23 +401,34 @@ static int ufs_wait_device_awake(UfsCtlr *ufs)
 	return rc ? ufs_err("NOP OUT failed", rc) : 0;
 }
 
-// Set the fDeviceInit field in the flags and wait for the bit to clear
+// Set the fDeviceInit field in the flags to start device initialization
 static int ufs_set_fDeviceInit(UfsCtlr *ufs)
 {
 	UfsQryReq req = {
 		.idn = UFS_IDN_FDEVICEINIT,
 	};
-	uint64_t start;
 	int rc;
 
 	rc = ufs_dev_query_op(ufs, &req, UPIU_QUERY_OP_SET_FLAG);
 	if (rc)
 		return ufs_err("Failed to set fDeviceInit", rc);
 
+	ufs->devinit_start_us = timer_us(0);
+	return 0;
+}
+
+// Wait for the fDeviceInit bit to clear
+static int ufs_wait_fDeviceInit(UfsCtlr *ufs)
+{
+	UfsQryReq req = {
+		.idn = UFS_IDN_FDEVICEINIT,
+	};
+	int rc;
+
 	// Loop until flag is cleared
-	start = timer_us(0);
 	while (1) {
-		bool timed_out = timer_us(start) > UFS_DEVICEINIT_TIMEOUT_US;
+		bool timed_out = timer_us(ufs->devinit_start_us) >
+				 UFS_DEVICEINIT_TIMEOUT_US;
 
 		rc = ufs_dev_query_op(ufs, &req, UPIU_QUERY_OP_READ_FLAG);
 		if (rc)
@@ -436,21 +487,21 @@ static int ufs_build_prdt(UfsCtlr *ufs, UfsPRDT *prdt, uint64_t addr, uint32_t l
 	return cnt;
 }
 
-// Issue a SCSI command
-static int ufs_do_scsi_command(UfsCtlr *ufs, UfsCmdReq *req)
+// Set up a SCSI command in Request List slot 'tag' without submitting it
+static int ufs_prep_scsi_command(UfsCtlr *ufs, int tag, UfsCmdReq *req)
 {
-	int tag = UFS_DFLT_TAG;
-	UfsUTRD *utrd = ufs_utrd(ufs, tag);
+	UfsUTRD *utrd;
 	UfsCUPIU *c = ufs_ucd(ufs, tag);
 	UfsCRespUPIU *r = (void *)c + UFS_RESP_UPIU_OFFS;
 	UfsPRDT *prdt = (void *)c + UFS_PRDT_OFFS;
 	uint16_t prdt_len;
-	int rc;
 
 	// Check the destination buffer for DWORD alignment
 	if (!IS_ALIGNED(req->data_buf_phy, 4) || !IS_ALIGNED(req->expected_len, 4))
 		return ufs_err("Data buffer not aligned to 4-byte boundary", UFS_EINVAL);
 
+	utrd = ufs_utrd(ufs, tag);
+
 	memset(c, 0, UFS_CMD_UPIU_LEN);
 
 	c->type		= UPIU_TYPE_COMMAND;
@@ -475,9 +526,14 @@ static int ufs_do_scsi_command(UfsCtlr *ufs, UfsCmdReq *req)
 	prdt_len = ufs_build_prdt(ufs, prdt, req->data_buf_phy, req->expected_len);
 	utrd->prdt_len = htole16(prdt_len);
 
-	rc = ufs_process_request(ufs, tag);
-	if (rc)
-		return rc;
+	return 0;
+}
+
+// Check the result of a completed SCSI command in Request List slot 'tag'
+static int ufs_check_scsi_response(UfsCtlr *ufs, int tag)
+{
+	UfsUTRD *utrd = (UfsUTRD *)ufs->ufs_req_list + tag;
+	UfsCRespUPIU *r = ufs_ucd(ufs, tag) + UFS_RESP_UPIU_OFFS;
 
 	// Check Overall Command Status
 	if (utrd->ocs)
@@ -505,6 +561,23 @@ static int ufs_do_scsi_command(UfsCtlr *ufs, UfsCmdReq *req)
 	return 0;
 }
 
+// Issue a SCSI command
+static int ufs_do_scsi_command(UfsCtlr *ufs, UfsCmdReq *req)
+{
+	int tag = UFS_DFLT_TAG;
+	int rc;
+
+	rc = ufs_prep_scsi_command(ufs, tag, req);
+	if (rc)
+		return rc;
+
+	rc = ufs_process_request(ufs, tag);
+	if (rc)
+		return rc;
+
+	return ufs_check_scsi_response(ufs, tag);
+}
+
 static int ufs_scsi_command(UfsCtlr *ufs, UfsCmdReq *req)
 {
 	int busy_retries = 3; // Busy is not expected, but allow 3 retries
@@ -537,14 +610,16 @@ static int ufs_scsi_unit_rdy(UfsCtlr *ufs, uint32_t lun)
 	return ufs_scsi_command(ufs, &req);
 }
 
-static int ufs_scsi_tfr_block(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t blocks, bool read)
+// Build a SCSI READ (10) / WRITE (10) request
+static int ufs_tfr_req(UfsDevice *ufs_dev, UfsCmdReq *req, void *buf, lba_t lba,
+		       lba_t blocks, bool read)
 {
 	if (lba + blocks > UINT32_MAX || blocks > UINT16_MAX) {
 		printf("Invalid UFS tfr_block parameters: lba=%llu, blocks=%llu", lba, blocks);
 		return UFS_EINVAL;
 	}
 
-	UfsCmdReq req = {
+	*req = (UfsCmdReq){
 		.lun = ufs_dev->lun,
 		.expected_len = blocks * ufs_dev->dev.block_size,
 		.data_buf_phy = virt_to_phys(buf),
@@ -561,20 +636,130 @@ static int ufs_scsi_tfr_block(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t bl
 	// Note SCSI READ (10) / WRITE (10) support is specified as mandatory
 	// whereas SCSI READ(16) / WRITE (16) is optional.
 	if (read) {
-		req.cdb[0] = SCSI_CMD_READ10;
-		req.cdb[1] = SCSI_FLAG_FUA;
-		req.flags = UFS_XFER_FLAGS_READ;
+		req->cdb[0] = SCSI_CMD_READ10;
+		req->cdb[1] = SCSI_FLAG_FUA;
+		req->flags = UFS_XFER_FLAGS_READ;
 	} else {
-		req.cdb[0] = SCSI_CMD_WRITE10;
+		req->cdb[0] = SCSI_CMD_WRITE10;
 		// Use FUA to avoid write cache because we never flush the cache
-		req.cdb[1] = SCSI_FLAG_FUA;
-		req.flags = UFS_XFER_FLAGS_WRITE;
+		req->cdb[1] = SCSI_FLAG_FUA;
+		req->flags = UFS_XFER_FLAGS_WRITE;
 	}
 
+	return 0;
+}
+
+static int ufs_scsi_tfr_block(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t blocks, bool read)
+{
+	UfsCmdReq req;
+	int rc;
+
+	rc = ufs_tfr_req(ufs_dev, &req, buf, lba, blocks, read);
+	if (rc)
+		return rc;
+
 	return ufs_scsi_command(ufs_dev->ufs, &req);
 }
 
-static int ufs_scsi_tfr(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t total_blocks, bool read)
+// Transfer a DMA-ready buffer using up to ufs->nutrs Request List slots at
+// once. The buffer is cut into UFS_TFR_CHUNK_BYTES commands, all free slots
+// are submitted with a single doorbell write and each slot is refilled as soon
+// as the device completes it, in whatever order that happens. Commands that
+// fail (e.g. with a Unit Attention Condition) are retried one at a time, with
+// the usual retry policy of ufs_scsi_command(), once the slots have drained.
+static int ufs_scsi_tfr_queued(UfsDevice *ufs_dev, void *buf, lba_t lba,
+			       lba_t total_blocks, bool read)
+{
+	UfsCtlr *ufs = ufs_dev->ufs;
+	const uint32_t block_size = ufs_dev->dev.block_size;
+	const lba_t chunk_blocks = MAX(UFS_TFR_CHUNK_BYTES / block_size, 1);
+	struct {
+		void *buf;
+		lba_t lba;
+		lba_t blocks;
+	} slot[UFS_NUM_TFR_TAGS];
+	uint32_t busy = 0, retry = 0, done, drbl;
+	UfsCmdReq req;
+	int tag, rc = 0;
+
+	// No slot count read from the controller, transfer one command at a time
+	if (!ufs->nutrs) {
+		while (total_blocks && !rc) {
+			lba_t blocks = MIN(chunk_blocks, total_blocks);
+
+			rc = ufs_scsi_tfr_block(ufs_dev, buf, lba, blocks, read);
+			buf += blocks * block_size;
+			lba += blocks;
+			total_blocks -= blocks;
+		}
+		return rc;
+	}
+
+	while (1) {
+		// Fill every free slot
+		drbl = 0;
+		for (tag = 0; tag < ufs->nutrs && total_blocks && !rc; tag++) {
+			if ((busy | retry) & BIT(tag))
+				continue;
+
+			slot[tag].buf = buf;
+			slot[tag].lba = lba;
+			slot[tag].blocks = MIN(chunk_blocks, total_blocks);
+			rc = ufs_tfr_req(ufs_dev, &req, buf, lba, slot[tag].blocks, read);
+			if (!rc)
+				rc = ufs_prep_scsi_command(ufs, tag, &req);
+			if (rc)
+				break;
+
+			drbl |= BIT(tag);
+			buf += slot[tag].blocks * block_size;
+			lba += slot[tag].blocks;
+			total_blocks -= slot[tag].blocks;
+		}
+
+		if (drbl) {
+			int submit_rc = ufs_utp_submit(ufs, drbl);
+			if (submit_rc)
+				rc = ufs_err("Submit failed", submit_rc);
+			else
+				busy |= drbl;
+		}
+
+		if (!busy) {
+			if (rc || !retry)
+				break;
+			// All slots drained, retry failed commands one by one
+			for (tag = 0; tag < ufs->nutrs && !rc; tag++) {
+				if (retry & BIT(tag))
+					rc = ufs_scsi_tfr_block(ufs_dev, slot[tag].buf,
+								slot[tag].lba,
+								slot[tag].blocks, read);
+			}
+			retry = 0;
+			continue;
+		}
+
+		int poll_rc = ufs_poll_any_completion(ufs, busy, &done,
+						      HCI_UTRD_POLL_TIMEOUT_US);
+		if (poll_rc) {
+			// A transfer is aborted by writing 0 to the corresponding bit
+			// in UTRL Clear Register.
+			ufs_write32(ufs, UFSHCI_UTRLCLR, ~busy);
+			return ufs_err("Completion failed", poll_rc);
+		}
+
+		busy &= ~done;
+		for (tag = 0; tag < ufs->nutrs; tag++) {
+			if ((done & BIT(tag)) && ufs_check_scsi_response(ufs, tag))
+				retry |= BIT(tag);
+		}
+	}
+
+	return rc;
+}
+
+static int ufs_scsi_tfr(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t total_blocks, bool read,
+			unsigned int extra_bbflags)
 {
 	int rc = 0;
 	lba_t blocks;
@@ -585,13 +770,13 @@ static int ufs_scsi_tfr(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t total_bl
 			     total_blocks);
 
 		rc = bounce_buffer_start(&bbstate, buf, blocks * ufs_dev->dev.block_size,
-					 read ? GEN_BB_WRITE : GEN_BB_READ);
+					 (read ? GEN_BB_WRITE : GEN_BB_READ) | extra_bbflags);
 		if (rc) {
 			printf("%s: error: Failed to allocate bounce buffer.\n", __func__);
 			return UFS_ENOMEM;
 		}
 
-		rc = ufs_scsi_tfr_block(ufs_dev, bbstate.bounce_buffer, lba, blocks, read);
+		rc = ufs_scsi_tfr_queued(ufs_dev, bbstate.bounce_buffer, lba, blocks, read);
 
 		bounce_buffer_stop(&bbstate);
 
@@ -606,21 +791,117 @@ static int ufs_scsi_tfr(UfsDevice *ufs_dev, void *buf, lba_t lba, lba_t total_bl
 	return rc;
 }
 
-static lba_t block_ufs_read(BlockDevOps *me, lba_t start, lba_t count,
-			    void *buffer)
+static lba_t block_ufs_rw(BlockDevOps *me, lba_t start, lba_t count,
+			  void *buffer, bool read, unsigned int bbflags)
 {
 	UfsDevice *ufs_dev = container_of(me, UfsDevice, dev.ops);
 
-	return ufs_scsi_tfr(ufs_dev, buffer, start, count, true) ? 0 : count;
+	return ufs_scsi_tfr(ufs_dev, buffer, start, count, read, bbflags) ? 0 : count;
+}
+
+static lba_t block_ufs_read(BlockDevOps *me, lba_t start, lba_t count,
+			    void *buffer)
+{
+	return blockdev_split_rw(me, start, count, buffer, true, &block_ufs_rw);
 }
 
 static lba_t block_ufs_write(BlockDevOps *me, lba_t start, lba_t count,
 			     const void *buffer)
 {
-	UfsDevice *ufs_dev = container_of(me, UfsDevice, dev.ops);
 	uint8_t *buf = (uint8_t *)buffer;
 
-	return ufs_scsi_tfr(ufs_dev, buf, start, count, false) ? 0 : count;
+	return blockdev_split_rw(me, start, count, buf, false, &block_ufs_rw);
+}
+
+// Read MAXIMUM UNMAP LBA COUNT from the Block Limits VPD page
+static uint32_t ufs_max_unmap_blocks(UfsDevice *ufs_dev)
+{
+	UfsVpdBlockLimits *vpd;
+	uint32_t max_blocks = 0;
+
+	if (ufs_dev->max_unmap_blocks)
+		return ufs_dev->max_unmap_blocks;
+
+	vpd = dma_memalign(UFS_DMA_ALIGN, sizeof(*vpd));
+	if (!vpd)
+		return 0;
+	memset(vpd, 0, sizeof(*vpd));
+
+	UfsCmdReq req = {
+		.lun = ufs_dev->lun,
+		.flags = UFS_XFER_FLAGS_READ,
+		.expected_len = sizeof(*vpd),
+		.data_buf_phy = virt_to_phys(vpd),
+		.cdb = {
+			[0] = SCSI_CMD_INQUIRY,
+			[1] = 0x01,	// EVPD
+			[2] = SCSI_VPD_BLOCK_LIMITS,
+			[3] = sizeof(*vpd) >> 8,
+			[4] = sizeof(*vpd),
+		},
+	};
+
+	// page_len counts the bytes after it, which must cover max_unmap_lba_count
+	if (!ufs_scsi_command(ufs_dev->ufs, &req) &&
+	    vpd->page_code == SCSI_VPD_BLOCK_LIMITS &&
+	    be16toh(vpd->page_len) >= offsetof(UfsVpdBlockLimits, max_unmap_desc_count) - 4)
+		max_blocks = be32toh(vpd->max_unmap_lba_count);
+	else
+		printf("UFS LUN %d: Can't read Block Limits VPD page\n", ufs_dev->lun);
+
+	free(vpd);
+	ufs_dev->max_unmap_blocks = max_blocks;
+
+	return max_blocks;
+}
+
+// Unmap blocks, one UNMAP command per descriptor of at most MAXIMUM UNMAP LBA COUNT
+static lba_t block_ufs_erase(BlockDevOps *me, lba_t start, lba_t count)
+{
+	UfsDevice *ufs_dev = container_of(me, UfsDevice, dev.ops);
+	uint32_t max_blocks = ufs_max_unmap_blocks(ufs_dev);
+	UfsUnmapParams *params;
+	lba_t left = count;
+	int rc = 0;
+
+	// A limit of 0 means UNMAP isn't supported
+	if (!max_blocks)
+		return 0;
+
+	params = dma_memalign(UFS_DMA_ALIGN, sizeof(*params));
+	if (!params)
+		return 0;
+
+	while (left && !rc) {
+		uint32_t blocks = MIN(left, max_blocks);
+
+		*params = (UfsUnmapParams){
+			.data_len = htobe16(sizeof(*params) - sizeof(params->data_len)),
+			.desc_data_len = htobe16(sizeof(*params) - 8),
+			.lba = htobe64(start),
+			.blocks = htobe32(blocks),
+		};
+
+		UfsCmdReq req = {
+			.lun = ufs_dev->lun,
+			.flags = UFS_XFER_FLAGS_WRITE,
+			.expected_len = sizeof(*params),
+			.data_buf_phy = virt_to_phys(params),
+			.cdb = {
+				[0] = SCSI_CMD_UNMAP,
+				[7] = sizeof(*params) >> 8,
+				[8] = sizeof(*params),
+			},
+		};
+
+		rc = ufs_scsi_command(ufs_dev->ufs, &req);
+		start += blocks;
+		left -= blocks;
+	}
+
+	free(params);
+
+	return rc ? 0 : count;
 }
 
 static inline bool ufs_fast(uint32_t pwr_mode)
@@ -1123,16 +1404,18 @@ static int ufs_utp_init(UfsCtlr *ufs)
 	// Enable the UTP transfer request list
 	ufs_write32(ufs, UFSHCI_UTRLRSR, BMSK_RSR);
 
+	// Use as many slots for data transfers as the controller provides
+	ufs->nutrs = MIN(UFS_NUM_TFR_TAGS,
+			 (ufs_read32(ufs, UFSHCI_CAP) & BMSK_NUTRS) + 1);
+
 	return 0;
 }
 
-static int ufs_ctrlr_setup(UfsCtlr *ufs)
+// Bring up the link and start device initialization, without waiting for it
+static int ufs_ctrlr_start(UfsCtlr *ufs)
 {
 	int rc;
 
-	if (ufs->ctlr_initialized)
-		return 0;
-
 	// Force re-read of tfr_mode and device descriptor when retrying
 	ufs->tfr_mode.initialized = false;
 	ufs->dev_desc.read_already = false;
@@ -1145,7 +1428,26 @@ static int ufs_ctrlr_setup(UfsCtlr *ufs)
 	if (rc)
 		return rc;
 
-	rc = ufs_set_fDeviceInit(ufs);
+	return ufs_set_fDeviceInit(ufs);
+}
+
+static int ufs_ctrlr_setup(UfsCtlr *ufs)
+{
+	int rc;
+
+	if (ufs->ctlr_initialized)
+		return 0;
+
+	if (ufs->devinit_started) {
+		// Started by ufs_kick(), only the first attempt may skip it
+		ufs->devinit_started = false;
+	} else {
+		rc = ufs_ctrlr_start(ufs);
+		if (rc)
+			return rc;
+	}
+
+	rc = ufs_wait_fDeviceInit(ufs);
 	if (rc)
 		return rc;
 
@@ -1340,6 +1642,12 @@ static int ufs_add_device(UfsCtlr *ufs, uint32_t lun)
 	ufs_dev->dev.ops.get_test_log = &block_ufs_send_diagnostics;
 	ufs_dev->dev.ops.test_control = &block_ufs_test_control;
 	ufs_dev->dev.ops.test_support = &block_ufs_self_test_support;
+	if (CONFIG(SPARSE_WRITE_ERASE) &&
+	    (ufs_ud(ufs_dev)->bProvisioningType & UFS_PROVISIONING_THIN)) {
+		ufs_dev->dev.ops.erase = &block_ufs_erase;
+		ufs_dev->dev.erase_zeroes = ufs_ud(ufs_dev)->bProvisioningType ==
+					    UFS_PROVISIONING_THIN_TPRZ;
+	}
 	/* No need to set get_test_log for UFS */
 	printf("Adding UFS block device LUN %02x block size %u block count %llu\n",
 		lun, ufs_dev->dev.block_size, (unsigned long long)ufs_dev->dev.block_count);
@@ -1368,6 +1676,22 @@ UfsCtlr *ufs_get_ctlr(void)
 	return NULL;
 }
 
+int ufs_kick(BlockDevCtrlrOps *bdev_ops)
+{
+	UfsCtlr *ufs = container_of(bdev_ops, UfsCtlr, bctlr.ops);
+	int rc;
+
+	if (ufs->ctlr_initialized || ufs->devinit_started)
+		return 0;
+
+	rc = ufs_ctrlr_start(ufs);
+	if (rc)
+		return rc;
+
+	ufs->devinit_started = true;
+	return 0;
+}
+
 int ufs_update(BlockDevCtrlrOps *bdev_ops)
 {
 	UfsCtlr *ufs = container_of(bdev_ops, UfsCtlr, bctlr.ops);
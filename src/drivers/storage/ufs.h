@@ -47,6 +47,9 @@
 #define UFSHCI_UICCMDARG2		0x98
 #define UFSHCI_UICCMDARG3		0x9C
 
+/* Bit field of UFSHCI_CAP register */
+#define BMSK_NUTRS			0x1f
+
 /* Bit field of UFSHCI_IS register */
 #define BMSK_UTRCS			BIT(0)
 #define BMSK_UDEPRI			BIT(1)
@@ -481,12 +484,16 @@ typedef enum {
 #define UFS_PRDT_SZ			(MAX_PRDT_ENTRIES * PRDT_ENTRY_SZ)
 // UTP Command Descriptor is 2 UPIU and 1 PRDT
 #define UFS_UCD_SZ			(UFS_CMD_UPIU_LEN + UFS_RESP_UPIU_LEN + UFS_PRDT_SZ)
-// Memory size for Request List plus one UTP Command Descriptor
-#define UFS_MEM_SZ			(UFS_REQ_LIST_SZ + UFS_UCD_SZ)
+// Maximum number of Request List slots used at once for data transfers
+#define UFS_NUM_TFR_TAGS		4
+// Memory size for Request List plus one UTP Command Descriptor per slot
+#define UFS_MEM_SZ			(UFS_REQ_LIST_SZ + UFS_NUM_TFR_TAGS * UFS_UCD_SZ)
 // UFSHCI requires 1KB alignment for Request List
 #define UFS_DMA_ALIGN			1024
 // Maximum number of bytes allocated in the bounce buffer
 #define UFS_MAX_BOUNCE_BUFFER_BYTES	(16 * MiB)
+// Data transfers are split into commands of this size to keep slots busy
+#define UFS_TFR_CHUNK_BYTES		(2 * MiB)
 
 // Maximum number of LUNs (excluding Well-Known LUNs)
 #define MAX_LUN				32
@@ -566,6 +573,34 @@ typedef struct __packed {
 	uint8_t		bLargeUnitGranularity_M1;
 } UfsDescUnit;
 
+// bProvisioningType: thin provisioning, UNMAP supported
+#define UFS_PROVISIONING_THIN		0x02
+// Unmapped blocks read back as zeroes (TPRZ)
+#define UFS_PROVISIONING_THIN_TPRZ	0x03
+
+// SBC-3 UNMAP parameter list with a single block descriptor (big-endian)
+typedef struct __packed {
+	uint16_t	data_len;		// Bytes following this field
+	uint16_t	desc_data_len;		// Bytes of block descriptors
+	uint32_t	rsrvd1;
+	uint64_t	lba;			// First block to unmap
+	uint32_t	blocks;			// Number of blocks to unmap
+	uint32_t	rsrvd2;
+} UfsUnmapParams;
+
+// SBC-3 Block Limits VPD page
+#define SCSI_VPD_BLOCK_LIMITS		0xB0
+
+typedef struct __packed {
+	uint8_t		peripheral;
+	uint8_t		page_code;
+	uint16_t	page_len;
+	uint8_t		rsrvd1[16];
+	uint32_t	max_unmap_lba_count;	// Blocks per UNMAP command
+	uint32_t	max_unmap_desc_count;	// Block descriptors per UNMAP command
+	uint8_t		rsrvd2[36];
+} UfsVpdBlockLimits;
+
 // JESD220B Table 14.16 - Geometry Descriptor (big-endian)
 typedef struct __packed {
 	uint8_t		bLength;
@@ -754,6 +789,7 @@ typedef struct UfsDevice {
 	UfsCtlr		*ufs;			// UFS Controller
 	int		lun;			// Logical Unit Number
 	UfsDesc		unit_desc;		// Unit Descriptor
+	uint32_t	max_unmap_blocks;	// MAXIMUM UNMAP LBA COUNT, 0 if unknown
 } UfsDevice;
 
 // Hook operations
@@ -776,7 +812,10 @@ typedef struct UfsCtlr {
 	UfsRefClkFreq	refclkfreq;		// bRefClkFreq attribute value
 	UfsTfrMode	tfr_mode;		// Transfer mode (gear, lanes etc)
 	uint8_t		*ufs_req_list;		// Request List
+	int		nutrs;			// Request List slots used for data
 	bool		ctlr_initialized;	// Controller is initialized
+	bool		devinit_started;	// fDeviceInit set by ufs_kick()
+	uint64_t	devinit_start_us;	// When fDeviceInit was set
 	UfsDesc		dev_desc;		// Device Descriptor
 	UfsDevice	*ufs_dev[MAX_LUN];	// Block devices
 	UfsDevice	*ufs_wlun_dev;		// Device Well Known LUN
@@ -857,6 +896,7 @@ int ufs_write_descriptor(UfsCtlr *ufs, uint8_t idn, uint8_t idx,
 int ufs_read_descriptor(UfsCtlr *ufs, uint8_t idn, uint8_t idx,
 			uint8_t *buf, uint64_t len, uint8_t *resp_len);
 UfsCtlr *ufs_get_ctlr(void);
+int ufs_kick(BlockDevCtrlrOps *bdev_ops);
 int ufs_update(BlockDevCtrlrOps *bdev_ops);
 int ufs_pwr_mode_change(UfsCtlr *ufs);
 
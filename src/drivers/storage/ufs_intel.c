@@ -29,7 +29,7 @@ static int intel_ufs_hook_fn(UfsCtlr *ufs, UfsHookOp op, void *data)
 	return 0;
 }
 
-static int intel_ufs_update(BlockDevCtrlrOps *bdev_ops)
+static int intel_ufs_probe(BlockDevCtrlrOps *bdev_ops)
 {
 	IntelUfsCtlr *intel_ufs = container_of(bdev_ops, IntelUfsCtlr,
 					       ufs.bctlr.ops);
@@ -50,6 +50,22 @@ static int intel_ufs_update(BlockDevCtrlrOps *bdev_ops)
 		pci_set_bus_master(dev);
 	}
 
+	return 0;
+}
+
+static int intel_ufs_kick(BlockDevCtrlrOps *bdev_ops)
+{
+	if (intel_ufs_probe(bdev_ops))
+		return -1;
+
+	return ufs_kick(bdev_ops);
+}
+
+static int intel_ufs_update(BlockDevCtrlrOps *bdev_ops)
+{
+	if (intel_ufs_probe(bdev_ops))
+		return -1;
+
 	return ufs_update(bdev_ops);
 }
 
@@ -61,6 +77,7 @@ IntelUfsCtlr *new_intel_ufs_ctlr(pcidev_t dev, UfsRefClkFreq ref_clk_freq)
 			PCI_BUS(dev),PCI_SLOT(dev),PCI_FUNC(dev));
 
 	intel_ufs->ufs.bctlr.type = BLOCK_CTRL_UFS;
+	intel_ufs->ufs.bctlr.ops.kick = intel_ufs_kick;
 	intel_ufs->ufs.bctlr.ops.update = intel_ufs_update;
 	intel_ufs->ufs.bctlr.need_update = 1;
 	intel_ufs->ufs.refclkfreq = ref_clk_freq;
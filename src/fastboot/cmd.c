@@ -15,6 +15,8 @@
  * GNU General Public License for more details.
  */
 
+#include <cbfs_glue.h>
+#include <libpayload.h>
 #include <stdlib.h>
 #include <string.h>
 #include <vb2_gpt.h>
@@ -71,7 +73,8 @@ static void fastboot_cmd_download(struct FastbootOps *fb, char *arg)
 		return;
 	}
 
-	if (size > FASTBOOT_MAX_DOWNLOAD_SIZE) {
+	/* Streamed downloads don't go through the memory buffer, so they aren't limited */
+	if (size > FASTBOOT_MAX_DOWNLOAD_SIZE && !fb->stream_flash) {
 		fastboot_fail(fb, "File too big");
 		return;
 	}
@@ -111,25 +114,54 @@ static void fastboot_cmd_flash(struct FastbootOps *fb, char *arg)
 	fastboot_write(fb, arg, 0, data, data_len);
 }
 
+static void fastboot_cmd_oem_flash_streaming(struct FastbootOps *fb, char *arg)
+{
+	fastboot_stream_flash_start(fb, arg);
+}
+
+/* Upper bound on the number of digests "oem sha256" reports in chunked mode */
+#define FASTBOOT_SHA256_MAX_CHUNKS 4096
+
+static void fastboot_sha256_to_str(const uint8_t *digest, char *str)
+{
+	for (int i = 0; i < VB2_SHA256_DIGEST_SIZE; i++)
+		snprintf(str + i * 2, 3, "%02x", digest[i]);
+}
+
+static vb2_error_t fastboot_sha256_init(struct vb2_digest_context *ctx, uint64_t size)
+{
+	/* Hardware engines are told the size up front, which has to fit in 32 bits */
+	return vb2_digest_init(ctx, cbfs_hwcrypto_allowed() && size <= UINT32_MAX, VB2_HASH_SHA256,
+			MIN(size, UINT32_MAX));
+}
+
 static void fastboot_cmd_oem_sha256(struct FastbootOps *fb, char *arg)
 {
 	const char *part_name = strsep(&arg, ":");
 	const char *offset_str = strsep(&arg, ":");
 	const char *len_str = strsep(&arg, ":");
+	const char *chunk_str = strsep(&arg, ":");
 	char digest_str[VB2_SHA256_DIGEST_SIZE * 2 + 1];
 	uint8_t digest[VB2_SHA256_DIGEST_SIZE];
-	struct vb2_sha256_context ctx;
+	struct vb2_digest_context ctx;
+	uint8_t *chunk_digests = NULL;
+	uint64_t read_us = 0, hash_us = 0;
+	uint64_t chunk_count = 0;
+	uint64_t chunk_size = 0;
+	uint64_t read_size;
+	uint64_t start_us;
 	char *arg_end = NULL;
 	enum gpt_io_ret ret;
 	StreamOps *stream;
 	uint64_t to_read;
 	uint64_t offset = 0;
 	uint64_t len = 0;
-	void *buf;
+	vb2_error_t rv = VB2_SUCCESS;
+	uint8_t *buf;
 
 	if (!part_name || arg != NULL) {
 		fastboot_fail(fb, "Invalid arguments. Use: oem "
-				  "sha256:<part_name>[:<offset>[:<len>]]");
+				  "sha256:<part_name>[:<offset>[:<len>[:<chunk_size>]]]");
 		return;
 	}
 
@@ -149,6 +181,16 @@ static void fastboot_cmd_oem_sha256(struct FastbootOps *fb, char *arg)
 		}
 	}
 
+	if (chunk_str) {
+		chunk_size = strtoull(chunk_str, &arg_end, 0);
+		if (arg_end == chunk_str || *arg_end != '\0' || chunk_size == 0 ||
+		    chunk_size > FASTBOOT_MAX_DOWNLOAD_SIZE) {
+			fastboot_fail(fb, "Chunk size \"%s\" not between 1 and %lld", chunk_str,
+				      FASTBOOT_MAX_DOWNLOAD_SIZE);
+			return;
+		}
+	}
+
 	if (!strncmp(part_name, FASTBOOT_RAW_WRITE_ARG, FASTBOOT_RAW_WRITE_ARG_LEN - 1)) {
 		part_name = NULL;
 		if (fastboot_disk_init(fb))
@@ -173,26 +215,98 @@ static void fastboot_cmd_oem_sha256(struct FastbootOps *fb, char *arg)
 	if (len != 0)
 		to_read = len;
 
+	read_size = FASTBOOT_MAX_DOWNLOAD_SIZE;
+	if (chunk_size) {
+		if (DIV_ROUND_UP(to_read, chunk_size) > FASTBOOT_SHA256_MAX_CHUNKS) {
+			stream->close(stream);
+			fastboot_fail(fb, "More than %d chunks, use a bigger chunk size",
+				      FASTBOOT_SHA256_MAX_CHUNKS);
+			return;
+		}
+		/* Read whole chunks at a time, so that every chunk is hashed in one go */
+		read_size -= read_size % chunk_size;
+		chunk_digests = xmalloc(DIV_ROUND_UP(to_read, chunk_size) *
+					VB2_SHA256_DIGEST_SIZE);
+	}
+
 	fastboot_reset_staging(fb);
 	buf = fastboot_get_memory_buffer(fb, NULL);
 
-	vb2_sha256_init(&ctx, VB2_HASH_SHA256);
+	if (!chunk_size) {
+		rv = fastboot_sha256_init(&ctx, to_read);
+		if (rv) {
+			stream->close(stream);
+			fastboot_fail(fb, "Failed to start hashing (%#x)", rv);
+			return;
+		}
+	}
 
-	while (to_read) {
-		size_t chunk_len = MIN(to_read, FASTBOOT_MAX_DOWNLOAD_SIZE);
-		if (stream->read(stream, chunk_len, buf) != chunk_len) {
+	for (uint64_t pos = 0; to_read; ) {
+		size_t read_len = MIN(to_read, read_size);
+
+		start_us = timer_us(0);
+		if (stream->read(stream, read_len, buf) != read_len) {
 			stream->close(stream);
+			free(chunk_digests);
 			fastboot_fail_with_logs(fb, "Failed to read stream");
 			return;
 		}
-		vb2_sha256_update(&ctx, buf, chunk_len);
-		to_read -= chunk_len;
+		read_us += timer_us(start_us);
+
+		start_us = timer_us(0);
+		if (!chunk_size) {
+			rv = vb2_digest_extend(&ctx, buf, read_len);
+		} else {
+			/* Report a digest per chunk, so the host can tell which ones differ */
+			for (size_t i = 0; i < read_len; i += chunk_size) {
+				uint8_t *chunk_digest =
+					chunk_digests + chunk_count * VB2_SHA256_DIGEST_SIZE;
+				size_t hash_len = MIN(chunk_size, read_len - i);
+
+				rv = fastboot_sha256_init(&ctx, hash_len);
+				if (!rv)
+					rv = vb2_digest_extend(&ctx, buf + i, hash_len);
+				if (!rv)
+					rv = vb2_digest_finalize(&ctx, chunk_digest,
+								 VB2_SHA256_DIGEST_SIZE);
+				if (rv)
+					break;
+				fastboot_sha256_to_str(chunk_digest, digest_str);
+				fastboot_info(fb, "0x%llx:%s", offset + pos + i, digest_str);
+				chunk_count++;
+			}
+		}
+		hash_us += timer_us(start_us);
+		if (rv) {
+			stream->close(stream);
+			free(chunk_digests);
+			fastboot_fail(fb, "Failed to hash data (%#x)", rv);
+			return;
+		}
+		pos += read_len;
+		to_read -= read_len;
 	}
 	stream->close(stream);
 
-	vb2_sha256_finalize(&ctx, digest, VB2_HASH_SHA256);
-	for (int i = 0; i < sizeof(digest); i++)
-		snprintf(digest_str + i * 2, 3, "%02x", digest[i]);
+	if (chunk_size) {
+		/* The final digest covers the list of chunk digests */
+		rv = fastboot_sha256_init(&ctx, chunk_count * VB2_SHA256_DIGEST_SIZE);
+		if (!rv)
+			rv = vb2_digest_extend(&ctx, chunk_digests,
+					       chunk_count * VB2_SHA256_DIGEST_SIZE);
+		free(chunk_digests);
+	}
+	if (!rv)
+		rv = vb2_digest_finalize(&ctx, digest, sizeof(digest));
+	if (rv) {
+		fastboot_fail(fb, "Failed to hash data (%#x)", rv);
+		return;
+	}
+	fastboot_sha256_to_str(digest, digest_str);
+
+	printf("oem sha256: read %llu ms, hash %llu ms, %llu chunks, hwcrypto %s\n",
+	       read_us / USECS_PER_MSEC, hash_us / USECS_PER_MSEC, chunk_count,
+	       cbfs_hwcrypto_allowed() ? "allowed" : "not allowed");
 
 	fastboot_info(fb, digest_str);
 	fastboot_succeed(fb);
@@ -821,6 +935,7 @@ struct fastboot_cmd fastboot_cmds[] = {
 	CMD_ARGS("oem bootconfig set", ' ', fastboot_cmd_oem_bootconfig_set),
 	CMD_NO_ARGS("oem bootconfig", fastboot_cmd_oem_bootconfig_get),
 	CMD_NO_ARGS("oem logs", fastboot_cmd_oem_logs),
+	CMD_ARGS("oem flash-streaming", ':', fastboot_cmd_oem_flash_streaming),
 	CMD_ARGS("oem read-ufs-descriptor", ':', fastboot_cmd_oem_read_ufs_descriptor),
 	CMD_ARGS("oem write-ufs-descriptor", ':', fastboot_cmd_oem_write_ufs_descriptor),
 	CMD_ARGS("oem set-successful", ':', fastboot_cmd_oem_set_successful),
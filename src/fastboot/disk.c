@@ -25,6 +25,7 @@
 #include "base/gpt.h"
 #include "base/sparse.h"
 #include "ctype.h"
+#include "drivers/storage/block_cache.h"
 #include "drivers/storage/blockdev.h"
 #include "fastboot/disk.h"
 #include "fastboot/fastboot.h"
@@ -61,6 +62,10 @@ int fastboot_do_disk_init(struct FastbootOps *fb, bool send_fail)
 
 	FB_DEBUG("Using disk '%s'\n", fb->disk->name);
 
+	/* All disk access of fastboot goes through fb->disk, so caching is safe */
+	if (CONFIG(DRIVER_STORAGE_BLOCK_CACHE))
+		fb->disk = new_blockdev_cache(fb->disk, BLOCKDEV_CACHE_BYTES);
+
 	return 0;
 }
 
@@ -122,6 +127,9 @@ static void fastboot_handle_gpt_io_ret(enum gpt_io_ret ret, struct FastbootOps *
 	case GPT_IO_SPARSE_WRONG_CHUNK_TYPE:
 		fastboot_fail(fb, "Unrecognised sparse chunk type");
 		break;
+	case GPT_IO_SPARSE_WRONG_MAGIC:
+		fastboot_fail(fb, "Not a sparse image");
+		break;
 	default:
 		fastboot_fail_with_logs(fb, "Unknown error while writing");
 	}
@@ -203,6 +211,53 @@ void fastboot_erase(struct FastbootOps *fb, const char *partition_name)
 	}
 }
 
+void fastboot_stream_flash_start(struct FastbootOps *fb, const char *partition_name)
+{
+	GptEntry *e;
+
+	if (fastboot_disk_gpt_init(fb))
+		return;
+
+	e = gpt_find_partition(fb->gpt, partition_name);
+	if (!e) {
+		fastboot_fail(fb, "Could not find partition \"%s\"", partition_name);
+		return;
+	}
+
+	fastboot_stream_flash_abort(fb);
+	fb->stream_flash = xmalloc(sizeof(*fb->stream_flash));
+	sparse_stream_init(fb->stream_flash, fb->disk, e->starting_lba * fb->disk->block_size,
+			   GptGetEntrySizeBytes(fb->gpt, e), sparse_default_policy());
+
+	fastboot_succeed(fb);
+}
+
+bool fastboot_stream_flash_feed(struct FastbootOps *fb, void *data, uint64_t len)
+{
+	/* The decoder keeps the error, fastboot_stream_flash_finish() reports it */
+	return sparse_stream_feed(fb->stream_flash, data, len) == GPT_IO_SUCCESS;
+}
+
+void fastboot_stream_flash_finish(struct FastbootOps *fb)
+{
+	enum gpt_io_ret ret = sparse_stream_finish(fb->stream_flash);
+
+	free(fb->stream_flash);
+	fb->stream_flash = NULL;
+
+	fastboot_handle_gpt_io_ret(ret, fb, NULL, 0);
+}
+
+void fastboot_stream_flash_abort(struct FastbootOps *fb)
+{
+	if (!fb->stream_flash)
+		return;
+
+	sparse_stream_finish(fb->stream_flash);
+	free(fb->stream_flash);
+	fb->stream_flash = NULL;
+}
+
 /************************* SLOT LOGIC ******************************/
 
 /* Returns 0 if the partition is not valid */
@@ -32,6 +32,17 @@ void fastboot_write_raw(struct FastbootOps *fb, const uint64_t start_block, void
 void fastboot_write(struct FastbootOps *fb, const char *partition_name,
 		    const uint64_t offset, void *data, size_t data_len);
 void fastboot_erase(struct FastbootOps *fb, const char *partition_name);
+/* Flash the next download to the partition while it is received. Image must be sparse. */
+void fastboot_stream_flash_start(struct FastbootOps *fb, const char *partition_name);
+/*
+ * Decode a piece of the download. Returns false on failure, the error is reported by
+ * fastboot_stream_flash_finish().
+ */
+bool fastboot_stream_flash_feed(struct FastbootOps *fb, void *data, uint64_t len);
+/* Complete the download and report the result */
+void fastboot_stream_flash_finish(struct FastbootOps *fb);
+/* Drop the streaming flash without reporting anything */
+void fastboot_stream_flash_abort(struct FastbootOps *fb);
 int fastboot_get_slot_count(GptData *gpt);
 char fastboot_get_slot_for_partition_name(const char *partition_name);
 GptEntry *fastboot_get_kernel_for_slot(GptData *gpt, char slot);
@@ -24,6 +24,7 @@
 #include "drivers/ec/cros/ec.h"
 #include "drivers/input/mkbp/buttons.h"
 #include "fastboot/cmd.h"
+#include "fastboot/disk.h"
 #include "fastboot/fastboot.h"
 #include "fastboot/log.h"
 #include "fastboot/tcp.h"
@@ -112,10 +113,30 @@ void fastboot_multiline_info(struct FastbootOps *fb, const char *msg)
 void fastboot_prepare_download(struct FastbootOps *fb, uint32_t bytes) {
 	fb->memory_buffer_len = bytes;
 	fb->download_progress = 0;
+	fb->download_start_us = timer_us(0);
+	fb->stream_staged = 0;
+	fb->stream_flash_us = 0;
+	fb->stream_flash_chunks = 0;
+	fb->stream_flash_failed = false;
 	fb->has_staged_data = false;
 	fb->state = DOWNLOAD;
 }
 
+void *fastboot_get_download_dest(struct FastbootOps *fb, uint64_t *len)
+{
+	if (fb->state != DOWNLOAD)
+		return NULL;
+
+	*len = fb->memory_buffer_len - fb->download_progress;
+	if (fb->stream_flash) {
+		/* Streamed downloads are received into the stage buffer only */
+		*len = MIN(*len, FASTBOOT_STREAM_STAGE_SIZE - fb->stream_staged);
+		return fastboot_get_memory_buffer(fb, NULL) + fb->stream_staged;
+	}
+
+	return fastboot_get_memory_buffer(fb, NULL) + fb->download_progress;
+}
+
 bool fastboot_is_finished(struct FastbootOps *fb)
 {
 	return fb->state == FINISHED || fb->state == REBOOT || fb->state == DISCONNECTED;
@@ -130,24 +151,103 @@ void *fastboot_get_memory_buffer(struct FastbootOps *fb, uint64_t *len)
 
 /***************************** PROTOCOL HANDLING *****************************/
 
+/* Flash the staged data and start staging from the beginning again */
+static bool fastboot_stream_flush(struct FastbootOps *fb)
+{
+	uint64_t start_us = timer_us(0);
+	bool ok = fastboot_stream_flash_feed(fb, fastboot_get_memory_buffer(fb, NULL),
+					     fb->stream_staged);
+
+	fb->stream_flash_us += timer_us(start_us);
+	fb->stream_flash_chunks++;
+	fb->stream_staged = 0;
+
+	return ok;
+}
+
+/*
+ * Stage a piece of a streamed download. Whenever the stage buffer is full, or the download
+ * is complete, it is flashed before more data is received. Receiving and flashing don't
+ * overlap, but the transport can receive with large transfers and the decoder gets large
+ * pieces it can write to the disk without copying them.
+ */
+static bool fastboot_stream_download(struct FastbootOps *fb, const uint8_t *data,
+				     uint64_t len, bool last)
+{
+	while (len) {
+		uint8_t *dest = (uint8_t *)fastboot_get_memory_buffer(fb, NULL) +
+				fb->stream_staged;
+		uint64_t chunk = MIN(len, FASTBOOT_STREAM_STAGE_SIZE - fb->stream_staged);
+
+		/* The transport may have received the data in place already */
+		if (data != dest)
+			memcpy(dest, data, chunk);
+		fb->stream_staged += chunk;
+		data += chunk;
+		len -= chunk;
+
+		if ((fb->stream_staged == FASTBOOT_STREAM_STAGE_SIZE || (last && !len)) &&
+		    !fastboot_stream_flush(fb))
+			return false;
+	}
+
+	return true;
+}
+
+static void fastboot_stream_download_finish(struct FastbootOps *fb)
+{
+	uint64_t start_us = timer_us(0);
+	uint64_t total_us;
+
+	fastboot_stream_flash_finish(fb);
+
+	fb->stream_flash_us += timer_us(start_us);
+	total_us = timer_us(fb->download_start_us);
+	/* Printed to the console, so that "oem logs" can show where the time went */
+	printf("fastboot: streamed %llu bytes in %llu ms: flash %llu ms (%u chunks), "
+	       "receive %llu ms\n", fb->memory_buffer_len, total_us / USECS_PER_MSEC,
+	       fb->stream_flash_us / USECS_PER_MSEC, fb->stream_flash_chunks,
+	       (total_us - MIN(total_us, fb->stream_flash_us)) / USECS_PER_MSEC);
+}
+
 static void fastboot_handle_download(struct FastbootOps *fb, void *data,
 				     uint64_t len)
 {
 	uint64_t left = fb->memory_buffer_len - fb->download_progress;
 	if (len > left) {
+		fastboot_stream_flash_abort(fb);
 		fastboot_fail(fb, "Too much data");
 		fb->state = COMMAND;
 		return;
 	}
 
-	void *buf = fastboot_get_memory_buffer(fb, NULL);
-	memcpy(buf + fb->download_progress, data, len);
+	if (fb->stream_flash) {
+		/*
+		 * Write the data to the disk as it arrives, nothing stays staged. The host keeps
+		 * sending after a decode error, so the rest of the download is dropped and the
+		 * error is reported once all of it has been received.
+		 */
+		if (!fb->stream_flash_failed &&
+		    !fastboot_stream_download(fb, data, len, len == left))
+			fb->stream_flash_failed = true;
+	} else {
+		void *dest = fastboot_get_memory_buffer(fb, NULL) + fb->download_progress;
+		/* The transport may have received the data in place already */
+		if (data != dest)
+			memcpy(dest, data, len);
+	}
 	fb->download_progress += len;
 	if (len == left) {
-		fb->has_staged_data = true;
+		fb->last_download_bytes = fb->memory_buffer_len;
+		fb->last_download_us = timer_us(fb->download_start_us);
 		fb->download_progress = 0;
 		fb->state = COMMAND;
-		fastboot_succeed(fb);
+		if (fb->stream_flash) {
+			fastboot_stream_download_finish(fb);
+		} else {
+			fb->has_staged_data = true;
+			fastboot_succeed(fb);
+		}
 	}
 }
 
@@ -226,6 +326,7 @@ void fastboot_reset_session(struct FastbootOps *fb)
 	/* Reset common fastboot session */
 	fb->state = COMMAND;
 	fb->download_progress = 0;
+	fastboot_stream_flash_abort(fb);
 
 	/* Reset transport layer specific data */
 	if (fb->reset)
@@ -45,6 +45,12 @@
 #define FASTBOOT_MAX_DOWNLOAD_SIZE ((uint64_t)CONFIG_KERNEL_SIZE)
 /* Maximum length of command packet as stated in the Fastboot documentation */
 #define FASTBOOT_COMMAND_MAX 4096
+/*
+ * Streamed downloads are staged at the start of the memory buffer, up to this size at a
+ * time. The storage drivers are synchronous, so a full stage is flashed before more data
+ * is received.
+ */
+#define FASTBOOT_STREAM_STAGE_SIZE MIN(FASTBOOT_MAX_DOWNLOAD_SIZE, (uint64_t)8 * MiB)
 
 enum fastboot_state {
 	/* Expecting a command. This is the initial state. */
@@ -73,6 +79,7 @@ enum fastboot_connection_type {
 
 /* Forward declare fastboot_log, so we can have pointer to it in FastbootOps */
 struct fastboot_log;
+struct sparse_stream;
 
 /* State of a fastboot session and functions that abstract transport layer */
 struct FastbootOps {
@@ -93,6 +100,23 @@ struct FastbootOps {
 	uint64_t memory_buffer_len;
 	/* Actual number of bytes received when in DOWNLOAD state */
 	uint64_t download_progress;
+	/* timer_us() when the current download was started */
+	uint64_t download_start_us;
+	/* Size and duration of the last completed download, for getvar */
+	uint64_t last_download_bytes;
+	uint64_t last_download_us;
+	/*
+	 * Sparse decoder the next download is flashed through instead of being staged in the
+	 * memory buffer. Maybe NULL.
+	 */
+	struct sparse_stream *stream_flash;
+	/* Bytes of the streamed download staged in the memory buffer */
+	uint64_t stream_staged;
+	/* Time spent flashing the streamed download and number of stages flashed */
+	uint64_t stream_flash_us;
+	unsigned int stream_flash_chunks;
+	/* Decoding failed, the rest of the streamed download is dropped */
+	bool stream_flash_failed;
 	/*
 	 * Poll for new fastboot messages. This function should call
 	 * fastboot_handle_packet(). It should return the state of transport layer which is
@@ -136,6 +160,13 @@ void fastboot(void);
 void *fastboot_get_memory_buffer(struct FastbootOps *fb, uint64_t *len);
 /* Prepares the staging buffer for download */
 void fastboot_prepare_download(struct FastbootOps *fb, uint32_t bytes);
+/*
+ * Returns where the next chunk of the download belongs in the staging buffer and how
+ * many bytes fit there (at most the rest of the download), or NULL if no download is in
+ * progress. A transport may receive straight into it and pass the same pointer to
+ * fastboot_handle_packet(), which then doesn't copy the data.
+ */
+void *fastboot_get_download_dest(struct FastbootOps *fb, uint64_t *len);
 /* Reset fastboot session to initial state */
 void fastboot_reset_session(struct FastbootOps *fb);
 /* Resets the state of the data staging area */
@@ -33,12 +33,50 @@
 
 /********************** PACKET BOOKKEEPING FUNCTIONS **************************/
 
-// Destroy a packet.
-static void fastboot_tcp_packet_destroy(struct fastboot_tcp_packet *p)
+// Get a packet able to hold len bytes, from the pool if possible.
+static struct fastboot_tcp_packet *
+fastboot_tcp_packet_alloc(struct fastboot_tcp_session *tcp, size_t len)
+{
+	struct fastboot_tcp_packet *p;
+
+	if (len <= FASTBOOT_TCP_PACKET_DATA_MAX && !list_is_empty(&tcp->free_packets)) {
+		struct list_node *first = list_first(&tcp->free_packets);
+		p = container_of(first, struct fastboot_tcp_packet, node);
+		list_remove(first);
+	} else {
+		p = xzalloc(sizeof(*p));
+	}
+
+	p->data = len <= FASTBOOT_TCP_PACKET_DATA_MAX ? p->buf : xmalloc(len);
+	p->len = len;
+
+	return p;
+}
+
+// Destroy a packet, or return it to the pool.
+static void fastboot_tcp_packet_destroy(struct fastboot_tcp_session *tcp,
+					struct fastboot_tcp_packet *p)
 {
-	free((void *)p->data);
+	if (p->data != p->buf)
+		free(p->data);
 	p->data = NULL;
-	free(p);
+
+	if (p->pooled)
+		list_insert_after(&p->node, &tcp->free_packets);
+	else
+		free(p);
+}
+
+// Destroy all packets on a list.
+static void fastboot_tcp_packet_destroy_all(struct fastboot_tcp_session *tcp,
+					    struct list_node *list)
+{
+	while (!list_is_empty(list)) {
+		struct list_node *first = list_first(list);
+		list_remove(first);
+		fastboot_tcp_packet_destroy(
+			tcp, container_of(first, struct fastboot_tcp_packet, node));
+	}
 }
 
 // Take a packet off the transmit queue.
@@ -60,26 +98,60 @@ static void fastboot_tcp_txq_append(struct fastboot_tcp_session *tcp,
 	list_append(&p->node, &tcp->txq);
 }
 
-// Send a single packet from the packet queue if we can.
+// (Re)send the packets in flight as one segment.
+static void fastboot_tcp_send_inflight(struct fastboot_tcp_session *tcp)
+{
+	struct fastboot_tcp_packet *p;
+	size_t len = 0;
+
+	p = container_of(list_first(&tcp->inflight), struct fastboot_tcp_packet, node);
+	if (p->node.next == NULL) {
+		// Just one packet, no need to combine anything.
+		uip_send(p->data, p->len);
+		return;
+	}
+
+	list_for_each(p, tcp->inflight, node) {
+		memcpy(tcp->tx_buf + len, p->data, p->len);
+		len += p->len;
+	}
+	uip_send(tcp->tx_buf, len);
+}
+
+// Send as many packets from the packet queue as fit in a segment, if we can.
 static void fastboot_tcp_send_packet(struct fastboot_tcp_session *tcp)
 {
-	// If we already sent a packet, there's no packets left to send, or
-	// we're not connected to anyone, return.
-	if (tcp->last_packet || list_is_empty(&tcp->txq) ||
+	size_t len = 0;
+
+	// If we already have a segment in flight, there's no packets left to
+	// send, or we're not connected to anyone, return.
+	if (!list_is_empty(&tcp->inflight) || list_is_empty(&tcp->txq) ||
 	    tcp->state == WAIT_FOR_HANDSHAKE)
 		return;
 
-	struct fastboot_tcp_packet *p = fastboot_tcp_txq_pop(tcp);
-	tcp->last_packet = p;
-	if (p->len > 8) {
-		// Skip the 8-byte size field.
-		FB_TRACE_IO("[to host] %.*s\n", p->len - 8,
-			    ((char *)p->data) + 8);
-	} else {
-		// Handshake, send the whole thing.
-		FB_TRACE_IO("[to host] %.*s\n", p->len, (char *)p->data);
+	while (!list_is_empty(&tcp->txq)) {
+		struct fastboot_tcp_packet *p = container_of(
+			list_first(&tcp->txq), struct fastboot_tcp_packet, node);
+
+		// A packet bigger than a segment goes out alone, as before.
+		if (!list_is_empty(&tcp->inflight) &&
+		    (len + p->len > uip_mss() || len + p->len > sizeof(tcp->tx_buf)))
+			break;
+
+		fastboot_tcp_txq_pop(tcp);
+		if (p->len > 8) {
+			// Skip the 8-byte size field.
+			FB_TRACE_IO("[to host] %.*s\n", p->len - 8,
+				    ((char *)p->data) + 8);
+		} else {
+			// Handshake, send the whole thing.
+			FB_TRACE_IO("[to host] %.*s\n", p->len, (char *)p->data);
+		}
+		list_append(&p->node, &tcp->inflight);
+		len += p->len;
 	}
-	uip_send(p->data, p->len);
+
+	fastboot_tcp_send_inflight(tcp);
 }
 
 // Should we keep handling packets? Returns false if we're currently looking
@@ -104,15 +176,11 @@ static int fastboot_tcp_send(struct FastbootOps *fb, void *data, size_t datalen)
 	struct fastboot_tcp_session *tcp =
 		container_of(fb, struct fastboot_tcp_session, fb_session);
 	uint64_t size = htobe64(datalen);
-	void *packet_data = xmalloc(sizeof(size) + datalen);
+	struct fastboot_tcp_packet *p =
+		fastboot_tcp_packet_alloc(tcp, sizeof(size) + datalen);
 
-	memcpy(packet_data, &size, sizeof(size));
-	memcpy(packet_data + sizeof(size), data, datalen);
-
-	struct fastboot_tcp_packet *p = xmalloc(sizeof(*p));
-	memset(p, 0, sizeof(*p));
-	p->data = packet_data;
-	p->len = datalen + sizeof(size);
+	memcpy(p->data, &size, sizeof(size));
+	memcpy(p->data + sizeof(size), data, datalen);
 	fastboot_tcp_txq_append(tcp, p);
 
 	return 0;
@@ -128,15 +196,9 @@ static void fastboot_tcp_enter_state(struct fastboot_tcp_session *tcp,
 {
 	switch (new_state) {
 	case WAIT_FOR_HANDSHAKE:
-		if (tcp->last_packet) {
-			fastboot_tcp_packet_destroy(tcp->last_packet);
-			tcp->last_packet = NULL;
-		}
-		/* Drain packet queue */
-		while (!list_is_empty(&tcp->txq)) {
-			struct fastboot_tcp_packet *top = fastboot_tcp_txq_pop(tcp);
-			fastboot_tcp_packet_destroy(top);
-		}
+		/* Drain packets in flight and the packet queue */
+		fastboot_tcp_packet_destroy_all(tcp, &tcp->inflight);
+		fastboot_tcp_packet_destroy_all(tcp, &tcp->txq);
 		break;
 	case WAIT_FOR_HEADER:
 		tcp->state_data.wait_for_header.header_bytes_collected = 0;
@@ -171,10 +233,8 @@ static uint64_t fastboot_tcp_handshake(struct fastboot_tcp_session *tcp, char *b
 	}
 
 	/* Looks good, reply */
-	struct fastboot_tcp_packet *p = xmalloc(sizeof(*p));
-	memset(p, 0, sizeof(*p));
-	p->data = handshake;
-	p->len = handshake_len;
+	struct fastboot_tcp_packet *p = fastboot_tcp_packet_alloc(tcp, handshake_len);
+	memcpy(p->data, handshake, handshake_len);
 	fastboot_tcp_txq_append(tcp, p);
 
 	/* Take note of the remote end's information */
@@ -363,7 +423,7 @@ static enum fastboot_transport_state fastboot_tcp_handle_session(
 
 	// Check for TCP state.
 	if (uip_rexmit()) {
-		uip_send(tcp->last_packet->data, tcp->last_packet->len);
+		fastboot_tcp_send_inflight(tcp);
 		return state;
 	}
 	// Note that uip_closed() can be true even if there's still data left.
@@ -377,9 +437,8 @@ static enum fastboot_transport_state fastboot_tcp_handle_session(
 	}
 
 	if (uip_acked()) {
-		// Last packet was sent successfully.
-		fastboot_tcp_packet_destroy(tcp->last_packet);
-		tcp->last_packet = NULL;
+		// Last segment was sent successfully.
+		fastboot_tcp_packet_destroy_all(tcp, &tcp->inflight);
 	}
 
 	if (uip_newdata()) {
@@ -477,6 +536,16 @@ struct FastbootOps *fastboot_setup_tcp(void)
 	/* Set up the network stack */
 	uip_init();
 
+	if (!tcp_session.packet_pool) {
+		tcp_session.packet_pool = xzalloc(FASTBOOT_TCP_PACKET_POOL_SIZE *
+						  sizeof(*tcp_session.packet_pool));
+		for (int i = 0; i < FASTBOOT_TCP_PACKET_POOL_SIZE; i++) {
+			tcp_session.packet_pool[i].pooled = true;
+			list_insert_after(&tcp_session.packet_pool[i].node,
+					  &tcp_session.free_packets);
+		}
+	}
+
 	uip_ipaddr_t my_ip, next_ip, server_ip;
 	const char *dhcp_bootfile;
 	if (dhcp_request(&next_ip, &server_ip, &dhcp_bootfile)) {
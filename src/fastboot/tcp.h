@@ -26,6 +26,14 @@
 
 #define FASTBOOT_PORT 5554
 
+/* Capacity of a pooled packet: a fastboot response with its 8 byte length header */
+#define FASTBOOT_TCP_PACKET_DATA_MAX (sizeof(uint64_t) + FASTBOOT_MSG_MAX)
+/*
+ * Number of preallocated packets. A single command may queue many responses (e.g.
+ * "getvar all"), any beyond this are allocated from the heap.
+ */
+#define FASTBOOT_TCP_PACKET_POOL_SIZE 64
+
 enum fastboot_tcp_state {
 	/* Waiting for the "FB01" handshake */
 	WAIT_FOR_HANDSHAKE = 0,
@@ -80,20 +88,32 @@ struct fastboot_tcp_session {
 	// machine that initiated our connection.
 	uip_ipaddr_t ripaddr;
 	uint16_t rport;
-	// The last packet we sent, in case we have to retransmit it.
-	// NULL once the packet has been acked.
-	struct fastboot_tcp_packet *last_packet;
+	// The packets sent in the last segment, in case we have to retransmit
+	// them. Empty once the segment has been acked.
+	struct list_node inflight;
 
 	// The queue of packets that are waiting to be sent.
-	// This is necessary because uIP only sends a packet once per callback.
+	// This is necessary because uIP only sends a segment once per callback
+	// and keeps only one segment in flight.
 	struct list_node txq;
+
+	// Packets preallocated for txq, and the ones currently free.
+	struct fastboot_tcp_packet *packet_pool;
+	struct list_node free_packets;
+
+	// Buffer for combining several packets into one segment.
+	char tx_buf[CONFIG_UIP_TCP_MSS];
 };
 
 // These are entries in the packet queue.
 struct fastboot_tcp_packet {
-	const void *data;
+	void *data;
 	int len;
+	// Taken from the session's packet pool rather than the heap.
+	bool pooled;
 	struct list_node node;
+	// Holds the data unless it didn't fit.
+	char buf[FASTBOOT_TCP_PACKET_DATA_MAX];
 };
 
 struct FastbootOps *fastboot_setup_tcp(void);
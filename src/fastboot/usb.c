@@ -30,6 +30,18 @@
 /* Wait 100ms for transaction. If it timeouts, probably other side doesn't send anything. */
 #define BULK_POLL_TIMEOUT_US 100000
 
+/*
+ * Download data is received straight into the staging buffer in transfers of up to this
+ * size. The host is streaming at this point, so allow a transfer more time to complete.
+ */
+#define DOWNLOAD_XFER_MAX (4 * MiB)
+#define DOWNLOAD_POLL_TIMEOUT_US 1000000
+/*
+ * USB controllers bounce buffers outside of DMA memory through their own 64 KiB buffer,
+ * so don't ask for more than that in one transfer into such a buffer.
+ */
+#define DOWNLOAD_BOUNCE_XFER_MAX (64 * KiB)
+
 typedef struct UsbFastbootDevice {
 	struct list_node list_node;
 	struct FastbootOps fb_session;
@@ -52,12 +64,12 @@ static int usb_fastboot_send(struct FastbootOps *fb, void *buf, size_t len)
 }
 
 static int usb_fastboot_recv(UsbFastbootDevice *usb_fb_dev, void *buf, size_t *len,
-			     int maxlen)
+			     int maxlen, int timeout_us)
 {
 	int32_t buf_size;
 
 	buf_size = usb_fb_dev->usb_dev->controller->bulk_timeout(
-			usb_fb_dev->bulk_in, maxlen, buf, BULK_POLL_TIMEOUT_US);
+			usb_fb_dev->bulk_in, maxlen, buf, timeout_us);
 	if (buf_size == USB_TIMEOUT) {
 		return buf_size;
 	} else if (buf_size < 0) {
@@ -95,6 +107,11 @@ static enum fastboot_transport_state usb_fastboot_poll(struct FastbootOps *fb)
 static void usb_fastboot_dev_poll(usbdev_t *dev)
 {
 	char packet_buffer[FASTBOOT_COMMAND_MAX];
+	void *buf = packet_buffer;
+	int maxlen = sizeof(packet_buffer);
+	int timeout_us = BULK_POLL_TIMEOUT_US;
+	uint64_t download_left;
+	void *download_dest;
 	size_t len;
 	GenericUsbDevice *gen_dev = (GenericUsbDevice *)dev->data;
 	UsbFastbootDevice *usb_fb_dev = (UsbFastbootDevice *)gen_dev->dev_data;
@@ -107,14 +124,23 @@ static void usb_fastboot_dev_poll(usbdev_t *dev)
 
 	fastboot_log_set_active(usb_fb_dev->fb_session.log);
 
-	if (usb_fastboot_recv(usb_fb_dev, packet_buffer, &len, sizeof(packet_buffer)))
+	/* Receive a download in place instead of going through packet_buffer */
+	download_dest = fastboot_get_download_dest(&usb_fb_dev->fb_session, &download_left);
+	if (download_dest) {
+		buf = download_dest;
+		maxlen = MIN(download_left, dma_coherent(download_dest) ?
+			     DOWNLOAD_XFER_MAX : DOWNLOAD_BOUNCE_XFER_MAX);
+		timeout_us = DOWNLOAD_POLL_TIMEOUT_US;
+	}
+
+	if (usb_fastboot_recv(usb_fb_dev, buf, &len, maxlen, timeout_us))
 		goto exit;
 
 	/* Fastboot protocol documentation says that zero-length packets should be ignored */
 	if (len == 0)
 		goto exit;
 
-	fastboot_handle_packet(&usb_fb_dev->fb_session, packet_buffer, len);
+	fastboot_handle_packet(&usb_fb_dev->fb_session, buf, len);
 	/* We received something, assume that it is a good idea to check for more data */
 	usb_fb_dev->state = FASTBOOT_TRANSPORT_RX_IN_PROGRESS;
 exit:
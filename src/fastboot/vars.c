@@ -63,6 +63,7 @@ static fastboot_getvar_info_t fastboot_vars[] = {
 	VAR_NO_ARGS("sku", VAR_SKU),
 	VAR_NO_ARGS("oem", VAR_OEM_ID),
 	VAR_NO_ARGS("partner-custom", VAR_PARTNER_CUSTOM),
+	VAR_NO_ARGS("download-throughput", VAR_DOWNLOAD_THROUGHPUT),
 	{.name = NULL},
 };
 
@@ -529,6 +530,15 @@ fastboot_getvar_result_t fastboot_getvar(struct FastbootOps *fb, fastboot_var_t
 			used_len = snprintf(outbuf, outbuf_len, "unknown");
 		break;
 	}
+	case VAR_DOWNLOAD_THROUGHPUT:
+		/* Speed of the last completed download in KiB/s */
+		if (fb->last_download_us)
+			used_len = snprintf(outbuf, outbuf_len, "%llu KiB/s",
+					    fb->last_download_bytes * USECS_PER_SEC / KiB /
+					    fb->last_download_us);
+		else
+			used_len = snprintf(outbuf, outbuf_len, "unknown");
+		break;
 	default:
 		return STATE_UNKNOWN_VAR;
 	}
@@ -44,6 +44,19 @@ static int tftp_blocknum;
 static uint32_t tftp_total_size;
 static uint32_t tftp_max_size;
 
+// Largest data block that fits in a single frame on this link.
+static const int TftpMaxLinkBlockSize =
+	CONFIG_UIP_BUFSIZE - CONFIG_UIP_LLH_LEN - UIP_IPUDPH_LEN - 4;
+
+// Option negotiation state (RFC 2347, 2348, 2349 and 7440).
+static int tftp_options_pending;
+static int tftp_options_refused;
+static int tftp_oack_received;
+static int tftp_blksize;
+static int tftp_windowsize;
+static int tftp_window_count;
+static int tftp_gap_acked;
+
 typedef struct TftpAckPacket
 {
 	uint16_t opcode;
@@ -99,6 +112,103 @@ static void tftp_print_error_pkt(void)
 	}
 }
 
+static void tftp_send_ack(uint16_t block)
+{
+	TftpAckPacket ack = {
+		htonw(TftpAck),
+		htonw(block)
+	};
+	memcpy(uip_appdata, &ack, sizeof(ack));
+	uip_udp_send(sizeof(ack));
+}
+
+static void tftp_send_error(uint16_t code, const char *message)
+{
+	uint16_t hdr[2] = { htonw(TftpError), htonw(code) };
+	int message_len = strlen(message) + 1;
+
+	memcpy(uip_appdata, hdr, sizeof(hdr));
+	memcpy((uint8_t *)uip_appdata + sizeof(hdr), message, message_len);
+	uip_udp_send(sizeof(hdr) + message_len);
+}
+
+// Returns 0 if the options are acceptable, or the error code to send back.
+static int tftp_parse_oack(void)
+{
+	const char *opt = (const char *)uip_appdata + 2;
+	const char *end = (const char *)uip_appdata + uip_datalen();
+
+	while (opt < end) {
+		const char *opt_end = memchr(opt, 0, end - opt);
+		if (!opt_end)
+			return TftpOptionNegotiation;
+		const char *val = opt_end + 1;
+		const char *val_end = memchr(val, 0, end - val);
+		if (!val_end)
+			return TftpOptionNegotiation;
+
+		char *num_end;
+		uint32_t value = strtoul(val, &num_end, 10);
+		if (num_end == val || num_end != val_end)
+			return TftpOptionNegotiation;
+
+		if (!strcasecmp(opt, "blksize")) {
+			// The server may only lower the value we asked for.
+			if (value < 8 || value > TftpMaxLinkBlockSize)
+				return TftpOptionNegotiation;
+			tftp_blksize = value;
+		} else if (!strcasecmp(opt, "windowsize")) {
+			if (value < 1 ||
+			    value > CONFIG_NETBOOT_TFTP_WINDOWSIZE)
+				return TftpOptionNegotiation;
+			tftp_windowsize = value;
+		} else if (!strcasecmp(opt, "tsize")) {
+			if (value > tftp_max_size) {
+				printf("TFTP file too large (%u bytes, %u "
+				       "available).\n", value, tftp_max_size);
+				return TftpNoSpace;
+			}
+		} else {
+			return TftpOptionNegotiation;
+		}
+
+		opt = val_end + 1;
+	}
+
+	return 0;
+}
+
+static void tftp_handle_oack(void)
+{
+	// A repeated OACK means our ACK of it got lost. Send it again.
+	if (!tftp_options_pending) {
+		if (tftp_oack_received && tftp_blocknum == 1)
+			tftp_send_ack(0);
+		return;
+	}
+
+	int error = tftp_parse_oack();
+	if (error == TftpNoSpace) {
+		tftp_send_error(error, "File too large");
+		tftp_status = TftpFailure;
+		return;
+	} else if (error) {
+		tftp_send_error(error, "Unacceptable options");
+		tftp_status = TftpFailure;
+		printf(" options rejected!\n");
+		return;
+	}
+
+	tftp_options_pending = 0;
+	tftp_oack_received = 1;
+	printf("(blksize %d, windowsize %d) ", tftp_blksize,
+	       tftp_windowsize);
+
+	// Acknowledging block 0 starts the data transfer.
+	tftp_send_ack(0);
+	tftp_got_response = 1;
+}
+
 static void tftp_callback(void)
 {
 	// If there isn't at least an opcode, ignore the packet.
@@ -121,31 +231,65 @@ static void tftp_callback(void)
 
 	// If there was an error, report it and stop the transfer.
 	if (opcode == TftpError) {
+		uint16_t error = 0;
+		if (uip_datalen() >= 4) {
+			memcpy(&error, (uint8_t *)uip_appdata + 2,
+			       sizeof(error));
+			error = ntohw(error);
+		}
+		// Servers which don't like our options may refuse the whole
+		// request. Let tftp_read() ask again without them.
+		if (tftp_options_pending && error == TftpOptionNegotiation) {
+			tftp_options_refused = 1;
+			return;
+		}
 		tftp_status = TftpFailure;
 		printf(" error!\n");
 		tftp_print_error_pkt();
 		return;
 	}
 
+	if (opcode == TftpOack) {
+		tftp_handle_oack();
+		return;
+	}
+
 	// We should only get data packets. Those are at least 4 bytes long.
 	if (opcode != TftpData || uip_datalen() < 4)
 		return;
 
+	// Data instead of an OACK means the server ignored our options.
+	if (tftp_options_pending) {
+		tftp_options_pending = 0;
+		tftp_blksize = TftpDefaultBlockSize;
+		tftp_windowsize = 1;
+	}
+
 	// Get the block number.
 	uint16_t blocknum;
 	memcpy(&blocknum, (uint8_t *)uip_appdata + 2, sizeof(blocknum));
 	blocknum = ntohw(blocknum);
 
 	// Ignore blocks which are duplicated or out of order, taking into
-	// account 16-bit block number overflow.
-	if (blocknum != (tftp_blocknum & 0xFFFF))
+	// account 16-bit block number overflow. If a block in the middle of
+	// a window went missing, acknowledge the last one we have so the
+	// server restarts the window from there instead of timing out.
+	if (blocknum != (tftp_blocknum & 0xFFFF)) {
+		uint16_t ahead = blocknum - tftp_blocknum;
+		if (tftp_windowsize > 1 && ahead < 0x8000 &&
+		    !tftp_gap_acked) {
+			tftp_send_ack(tftp_blocknum - 1);
+			tftp_gap_acked = 1;
+			tftp_window_count = 0;
+		}
 		return;
+	}
 
 	void *new_data = (uint8_t *)uip_appdata + 4;
 	int new_data_len = uip_datalen() - 4;
 
 	// If the block is too big, reject it.
-	if (new_data_len > TftpMaxBlockSize)
+	if (new_data_len > tftp_blksize)
 		return;
 
 	// If we're out of space give up.
@@ -161,19 +305,20 @@ static void tftp_callback(void)
 		tftp_dest += new_data_len;
 	}
 	tftp_total_size += new_data_len;
+	tftp_gap_acked = 0;
 
-	// Prepare an ack.
-	TftpAckPacket ack = {
-		htonw(TftpAck),
-		htonw(tftp_blocknum)
-	};
-	memcpy(uip_appdata, &ack, sizeof(ack));
-	uip_udp_send(sizeof(ack));
+	// If this block was less than the maximum size, the transfer is done.
+	int last_block = new_data_len < tftp_blksize;
+
+	// Acknowledge the end of each window and the last block.
+	if (last_block || ++tftp_window_count >= tftp_windowsize) {
+		tftp_send_ack(tftp_blocknum);
+		tftp_window_count = 0;
+	}
 
 	tftp_got_response = 1;
 
-	// If this block was less than the maximum size, the transfer is done.
-	if (new_data_len < TftpMaxBlockSize) {
+	if (last_block) {
 		tftp_status = TftpSuccess;
 		return;
 	}
@@ -187,6 +332,14 @@ static void tftp_callback(void)
 	}
 }
 
+static int tftp_add_option(uint8_t *buf, const char *name, uint32_t value)
+{
+	int name_len = strlen(name) + 1;
+
+	memcpy(buf, name, name_len);
+	return name_len + sprintf((char *)buf + name_len, "%u", value) + 1;
+}
+
 int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 	uint32_t *size, uint32_t max_size)
 {
@@ -199,13 +352,25 @@ int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 	const char mode[] = "Octet";
 	int mode_len = sizeof(mode);
 
-	int read_req_len = opcode_len + name_len + mode_len;
-	uint8_t *read_req = xmalloc(read_req_len);
+	int plain_req_len = opcode_len + name_len + mode_len;
+
+	// Room for the blksize, windowsize and tsize options.
+	const int options_max_len = 64;
+	uint8_t *read_req = xmalloc(plain_req_len + options_max_len);
 
 	memcpy(read_req, &opcode, opcode_len);
 	memcpy(read_req + opcode_len, bootfile, name_len);
 	memcpy(read_req + opcode_len + name_len, mode, mode_len);
 
+	// The options follow the mode, so dropping them if the server refuses
+	// them is just a matter of sending a shorter request.
+	int read_req_len = plain_req_len;
+	read_req_len += tftp_add_option(read_req + read_req_len, "blksize",
+					TftpMaxLinkBlockSize);
+	read_req_len += tftp_add_option(read_req + read_req_len, "windowsize",
+					CONFIG_NETBOOT_TFTP_WINDOWSIZE);
+	read_req_len += tftp_add_option(read_req + read_req_len, "tsize", 0);
+
 	// Set up the UDP connection.
 	struct uip_udp_conn *conn = uip_udp_new(server_ip, htonw(TftpPort));
 	if (!conn) {
@@ -227,6 +392,13 @@ int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 	tftp_blocknum = 1;
 	tftp_total_size = 0;
 	tftp_max_size = max_size;
+	tftp_options_pending = 1;
+	tftp_options_refused = 0;
+	tftp_oack_received = 0;
+	tftp_blksize = TftpDefaultBlockSize;
+	tftp_windowsize = 1;
+	tftp_window_count = 0;
+	tftp_gap_acked = 0;
 
 	// Poll the network driver until the transaction is done.
 
@@ -235,25 +407,42 @@ int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 	while (tftp_status == TftpPending) {
 		tftp_got_response = 0;
 		net_poll();
-		if (tftp_got_response)
+
+		if (tftp_options_refused) {
+			// Ask again for the file with classic TFTP.
+			printf("options refused, retrying... ");
+			tftp_options_refused = 0;
+			tftp_options_pending = 0;
+			read_req_len = plain_req_len;
+			conn->rport = htonw(TftpPort);
+			uip_udp_packet_send(conn, read_req, read_req_len);
+			conn->rport = 0;
+			resend_timer = timer_us(0);
 			continue;
+		}
+
+		if (tftp_got_response) {
+			resend_timer = timer_us(0);
+			continue;
+		}
 
 		if (timer_us(resend_timer) < TfTpRespTimeoutUs)
 			continue;
 
 		// No response. Resend our last packet and try again.
-		if (tftp_blocknum == 1) {
+		if (tftp_blocknum == 1 && !tftp_oack_received) {
 			// Resend the read request.
 			conn->rport = htonw(TftpPort);
 			uip_udp_packet_send(conn, read_req, read_req_len);
 			conn->rport = 0;
 		} else {
-			// Resend the last ack.
+			// Resend the last ack, which also restarts the window.
 			TftpAckPacket ack = {
 				htonw(TftpAck),
 				htonw(tftp_blocknum - 1)
 			};
 			uip_udp_packet_send(conn, &ack, sizeof(ack));
+			tftp_window_count = 0;
 		}
 		resend_timer = timer_us(0);
 	}
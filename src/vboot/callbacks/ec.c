@@ -23,6 +23,7 @@
 #include <vb2_api.h>
 #include <vboot_api.h>
 
+#include "base/late_init_funcs.h"
 #include "base/timestamp.h"
 #include "drivers/ec/vboot_ec.h"
 #include "drivers/flash/flash.h"
@@ -51,6 +52,31 @@ static void *get_file_from_cbfs(
 	return cbfs_map(filename, size);
 }
 
+/*
+ * EC software sync asks for the hash of the active EC image first. Have the EC start
+ * computing it now, so that it runs while the rest of depthcharge and vboot initialize
+ * instead of when sync needs it.
+ */
+static int ec_start_hash(LateInitFunc *init)
+{
+	VbootEcOps *ec = vboot_get_ec();
+
+	if (!ec || !ec->start_hash)
+		return 0;
+
+	if (vb2api_gbb_get_flags(vboot_get_context()) &
+	    VB2_GBB_FLAG_DISABLE_EC_SOFTWARE_SYNC)
+		return 0;
+
+	/* Not fatal, software sync starts the hash itself if needed */
+	if (ec->start_hash(ec, VB_SELECT_FIRMWARE_EC_ACTIVE))
+		printf("Failed to start EC hash computation.\n");
+
+	return 0;
+}
+
+LATE_INIT_FUNC(ec_start_hash);
+
 vb2_error_t vb2ex_ec_running_rw(int *in_rw)
 {
 	VbootEcOps *ec = vboot_get_ec();
@@ -25,6 +25,7 @@
 #include "debug/dev.h"
 #include "drivers/bus/usb/usb.h"
 #include "drivers/flash/flash.h"
+#include "drivers/storage/block_cache.h"
 #include "fastboot/fastboot.h"
 #include "vboot/nvdata.h"
 #include "vboot/secdata_tpm.h"
@@ -110,6 +111,7 @@ vb2_error_t vb2ex_handle_android_misc_partition(struct vb2_context *ctx,
 {
 	enum android_misc_bcb_command cmd;
 	BlockDev *bdev = (BlockDev *)disk;
+	BlockDev *disk_bdev = bdev;
 
 	/* Ignore misc partition on external disks */
 	if (bdev->removable) {
@@ -117,6 +119,10 @@ vb2_error_t vb2ex_handle_android_misc_partition(struct vb2_context *ctx,
 		return VB2_SUCCESS;
 	}
 
+	/* BCB and MTE control live next to each other in the misc partition */
+	if (CONFIG(DRIVER_STORAGE_BLOCK_CACHE))
+		bdev = new_blockdev_cache(disk_bdev, BLOCKDEV_CACHE_BYTES);
+
 	cmd = android_misc_get_bcb_command(bdev, gpt);
 	switch (cmd) {
 	case MISC_BCB_NORMAL_BOOT:
@@ -136,6 +142,11 @@ vb2_error_t vb2ex_handle_android_misc_partition(struct vb2_context *ctx,
 		*bootmode = VB2_ANDROID_NORMAL_BOOT;
 		/* If GBB flag is set, start fastboot */
 		if (vb2api_gbb_get_flags(ctx) & VB2_GBB_FLAG_FORCE_UNLOCK_FASTBOOT) {
+			/* Fastboot may rewrite the disk behind our cache */
+			if (bdev != disk_bdev) {
+				free_blockdev_cache(bdev);
+				bdev = disk_bdev;
+			}
 			dc_usb_initialize();
 			fastboot();
 		}
@@ -145,5 +156,8 @@ vb2_error_t vb2ex_handle_android_misc_partition(struct vb2_context *ctx,
 	if (CONFIG(ANDROID_MTE))
 		android_mte_get_misc_ctrl(bdev, gpt);
 
+	if (bdev != disk_bdev)
+		free_blockdev_cache(bdev);
+
 	return VB2_SUCCESS;
 }
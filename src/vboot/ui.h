@@ -771,6 +771,19 @@ enum ui_archive_type {
 vb2_error_t ui_load_bitmap(enum ui_archive_type type, const char *file,
 			   const char *locale_code, struct ui_bitmap *bitmap);
 
+/*
+ * Load character bitmap from the font archive.
+ *
+ * Glyphs are looked up in a per-character table built when the font archive
+ * is loaded.
+ *
+ * @param c		Character.
+ * @param bitmap	Bitmap struct to be filled.
+ *
+ * @return VB2_SUCCESS on success, non-zero on error.
+ */
+vb2_error_t ui_load_char_bitmap(const char c, struct ui_bitmap *bitmap);
+
 /******************************************************************************/
 /* bitmap.c */
 
@@ -1205,7 +1218,8 @@ vb2_error_t ui_draw_scrollbar(int32_t begin_x, int32_t begin_y, int32_t total_h,
  *
  * @param menu			Menu items.
  * @param state			UI state.
- * @param prev_state		Previous UI state.
+ * @param prev_state		Previous UI state, or NULL to draw every item.
+ *				Otherwise only the items that changed are drawn.
  * @param y			Starting y-coordinate of the descriptions.
  *
  * @return VB2_SUCCESS on success, non-zero on error.
@@ -120,6 +120,36 @@ uint32_t ui_get_locale_count(void)
 	return locale_data->count;
 }
 
+static int compare_dentry(const void *a, const void *b)
+{
+	const struct dentry *entry_a = a;
+	const struct dentry *entry_b = b;
+
+	return strncmp(entry_a->name, entry_b->name, NAME_LENGTH);
+}
+
+/* Binary search for a file in an archive loaded by load_archive(). */
+static const struct dentry *find_dentry(const struct directory *dir,
+					const char *name)
+{
+	const struct dentry *entry = get_first_dentry(dir);
+	uint32_t lo = 0, hi = dir->count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = strncmp(name, entry[mid].name, NAME_LENGTH);
+
+		if (!cmp)
+			return &entry[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
 static vb2_error_t load_archive(const char *name,
 				struct directory **dest,
 				int from_ro)
@@ -172,6 +202,12 @@ static vb2_error_t load_archive(const char *name,
 		entry[i].size = le32toh(entry[i].size);
 	}
 
+	/*
+	 * Sort the file headers by name so that lookups can use binary search.
+	 * Offsets are relative to the archive, so the order doesn't matter.
+	 */
+	qsort(entry, dir->count, sizeof(*entry), compare_dentry);
+
 	*dest = dir;
 	UI_INFO("Loaded %s from %s\n", name, from_ro ? "RO" : "RW");
 
@@ -239,14 +275,24 @@ static vb2_error_t get_localized_graphic_archive(const char *locale_code,
 	return VB2_SUCCESS;
 }
 
-/* Load font graphics. */
-static vb2_error_t get_font_archive(struct directory **dest)
+static vb2_error_t get_bitmap_from_dentry(const struct directory *dir,
+					  const struct dentry *entry,
+					  const char *name,
+					  struct ui_bitmap *bitmap)
 {
-	static struct directory *ro_cache;
-	if (!ro_cache)
-		VB2_TRY(load_archive("font.bin", &ro_cache, 1));
+	/* Validate offset & size */
+	if (entry->offset < get_first_offset(dir) ||
+	    entry->offset + entry->size > dir->size ||
+	    entry->offset > dir->size ||
+	    entry->size > dir->size) {
+		UI_ERROR("Invalid offset or size for '%s'\n", name);
+		return VB2_ERROR_UI_INVALID_ARCHIVE;
+	}
 
-	*dest = ro_cache;
+	bitmap->name[UI_BITMAP_FILENAME_MAX_LEN] = '\0';
+	strncpy(bitmap->name, name, UI_BITMAP_FILENAME_MAX_LEN);
+	bitmap->data = (uint8_t *)dir + entry->offset;
+	bitmap->size = entry->size;
 	return VB2_SUCCESS;
 }
 
@@ -255,37 +301,60 @@ static vb2_error_t find_bitmap_in_archive(const struct directory *dir,
 					  struct ui_bitmap *bitmap,
 					  int show_error)
 {
-	struct dentry *entry;
-	uintptr_t start;
-	int i;
+	const struct dentry *entry = find_dentry(dir, name);
 
-	/* Calculate start of the file content section */
-	start = get_first_offset(dir);
-	entry = get_first_dentry(dir);
-	for (i = 0; i < dir->count; i++) {
-		if (strncmp(entry[i].name, name, NAME_LENGTH))
-			continue;
-		/* Validate offset & size */
-		if (entry[i].offset < start ||
-		    entry[i].offset + entry[i].size > dir->size ||
-		    entry[i].offset > dir->size ||
-		    entry[i].size > dir->size) {
-			UI_ERROR("Invalid offset or size for '%s'\n", name);
-			return VB2_ERROR_UI_INVALID_ARCHIVE;
-		}
-
-		bitmap->name[UI_BITMAP_FILENAME_MAX_LEN] = '\0';
-		strncpy(bitmap->name, name, UI_BITMAP_FILENAME_MAX_LEN);
-		bitmap->data = (uint8_t *)dir + entry[i].offset;
-		bitmap->size = entry[i].size;
-		return VB2_SUCCESS;
-	}
+	if (entry)
+		return get_bitmap_from_dentry(dir, entry, name, bitmap);
 
 	if (show_error)
 		UI_ERROR("File '%s' not found\n", name);
 	return VB2_ERROR_UI_MISSING_IMAGE;
 }
 
+static void get_char_bitmap_name(const char c, char *name, size_t size)
+{
+	snprintf(name, size, "idx%03d_%02x.bmp", c, c);
+}
+
+/* Font glyphs indexed by character, filled when the font is loaded. */
+static const struct dentry *font_glyphs[256];
+
+/* Load font graphics. */
+static vb2_error_t get_font_archive(struct directory **dest)
+{
+	static struct directory *ro_cache;
+	char name[UI_BITMAP_FILENAME_MAX_LEN + 1];
+
+	if (!ro_cache) {
+		VB2_TRY(load_archive("font.bin", &ro_cache, 1));
+		for (int i = 0; i < ARRAY_SIZE(font_glyphs); i++) {
+			get_char_bitmap_name(i, name, sizeof(name));
+			font_glyphs[i] = find_dentry(ro_cache, name);
+		}
+	}
+
+	*dest = ro_cache;
+	return VB2_SUCCESS;
+}
+
+vb2_error_t ui_load_char_bitmap(const char c, struct ui_bitmap *bitmap)
+{
+	struct directory *dir;
+	char name[UI_BITMAP_FILENAME_MAX_LEN + 1];
+	const struct dentry *entry;
+
+	VB2_TRY(get_font_archive(&dir));
+
+	get_char_bitmap_name(c, name, sizeof(name));
+	entry = font_glyphs[(unsigned char)c];
+	if (!entry) {
+		UI_ERROR("File '%s' not found\n", name);
+		return VB2_ERROR_UI_MISSING_IMAGE;
+	}
+
+	return get_bitmap_from_dentry(dir, entry, name, bitmap);
+}
+
 vb2_error_t ui_load_bitmap(enum ui_archive_type type, const char *file,
 			   const char *locale_code, struct ui_bitmap *bitmap)
 {
@@ -44,11 +44,7 @@ vb2_error_t ui_get_language_name_bitmap(const char *locale_code,
 
 vb2_error_t ui_get_char_bitmap(const char c, struct ui_bitmap *bitmap)
 {
-	char file[UI_BITMAP_FILENAME_MAX_LEN + 1];
-	const char pattern[] = "idx%03d_%02x.bmp";
-
-	snprintf(file, sizeof(file), pattern, c, c);
-	return ui_load_bitmap(UI_ARCHIVE_FONT, file, NULL, bitmap);
+	return ui_load_char_bitmap(c, bitmap);
 }
 
 vb2_error_t ui_get_step_icon_bitmap(int step, int focused,
@@ -928,6 +928,30 @@ static vb2_error_t ui_draw_dev_signed_warning(void)
 	return VB2_SUCCESS;
 }
 
+/*
+ * Whether a menu item needs to be redrawn. Items keep their position as long as
+ * the screen, locale and hidden items stay the same, so only the items whose
+ * focus, disabled state or text changed need to be redrawn.
+ */
+static int menu_item_damaged(const struct ui_menu *menu,
+			     const struct ui_state *state,
+			     const struct ui_state *prev_state, int i)
+{
+	const struct ui_menu_item *item = &menu->items[i];
+
+	if (!prev_state ||
+	    prev_state->screen != state->screen ||
+	    prev_state->locale != state->locale ||
+	    prev_state->error_code != state->error_code ||
+	    prev_state->hidden_item_mask != state->hidden_item_mask)
+		return 1;
+
+	return (prev_state->focused_item == i) != (state->focused_item == i) ||
+	       UI_GET_BIT(prev_state->disabled_item_mask, i) !=
+	       UI_GET_BIT(state->disabled_item_mask, i) ||
+	       get_item_file(item, prev_state) != get_item_file(item, state);
+}
+
 vb2_error_t ui_draw_menu_items(const struct ui_menu *menu,
 			       const struct ui_state *state,
 			       const struct ui_state *prev_state,
@@ -946,6 +970,10 @@ vb2_error_t ui_draw_menu_items(const struct ui_menu *menu,
 			continue;
 		if (UI_GET_BIT(state->hidden_item_mask, i))
 			continue;
+		if (!menu_item_damaged(menu, state, prev_state, i)) {
+			y += UI_BUTTON_HEIGHT + UI_BUTTON_MARGIN_V;
+			continue;
+		}
 		clear_help = prev_state &&
 			     prev_state->focused_item == i &&
 			     UI_GET_BIT(prev_state->disabled_item_mask, i);
@@ -966,9 +994,10 @@ vb2_error_t ui_draw_menu_items(const struct ui_menu *menu,
 			continue;
 		if (menu->items[i].type != UI_MENU_ITEM_TYPE_SECONDARY)
 			continue;
-		VB2_TRY(ui_draw_link(&menu->items[i], state,
-				     x, y, UI_BUTTON_HEIGHT,
-				     state->focused_item == i));
+		if (menu_item_damaged(menu, state, prev_state, i))
+			VB2_TRY(ui_draw_link(&menu->items[i], state,
+					     x, y, UI_BUTTON_HEIGHT,
+					     state->focused_item == i));
 		y -= UI_BUTTON_HEIGHT + UI_BUTTON_MARGIN_V;
 	}
 
@@ -990,6 +1019,18 @@ vb2_error_t ui_draw_default(struct ui_context *ui,
 	uint32_t flags = PIVOT_H_LEFT | PIVOT_V_TOP;
 	const char *icon_file;
 	struct ui_bitmap bitmap;
+	static int32_t prev_desc_y;
+	/*
+	 * The icon, title and default description only depend on the screen
+	 * and locale. Unless those changed, the screen was cleared, or the
+	 * screen asked for a refresh (e.g. after something else drew over
+	 * it), they are still on screen and don't need to be decoded and drawn
+	 * again.
+	 */
+	const int redraw = !prev_state || ui->force_display ||
+			   prev_state->screen != state->screen ||
+			   prev_state->locale != state->locale ||
+			   prev_state->error_code != state->error_code;
 
 	if (!prev_state ||
 	    prev_state->locale != state->locale ||
@@ -1072,9 +1113,9 @@ vb2_error_t ui_draw_default(struct ui_context *ui,
 			break;
 		}
 
-		if (screen->icon == UI_ICON_TYPE_STEP) {
+		if (redraw && screen->icon == UI_ICON_TYPE_STEP) {
 			VB2_TRY(ui_draw_step_icons(state, prev_state));
-		} else if (icon_file) {
+		} else if (redraw && icon_file) {
 			VB2_TRY(ui_get_bitmap(icon_file, NULL, 0, &bitmap));
 			VB2_TRY(ui_draw_bitmap(&bitmap, x, y, w, UI_ICON_HEIGHT,
 					       flags, reverse));
@@ -1096,24 +1137,32 @@ vb2_error_t ui_draw_default(struct ui_context *ui,
 	if (screen->title) {
 		VB2_TRY(ui_get_bitmap(screen->title, locale_code, 0, &bitmap));
 		h = title_text_height * ui_get_bitmap_num_lines(&bitmap);
-		VB2_TRY(ui_draw_bitmap(&bitmap, x, y, w, h, flags, reverse));
+		if (redraw)
+			VB2_TRY(ui_draw_bitmap(&bitmap, x, y, w, h, flags,
+					       reverse));
 	} else {
 		h = title_text_height;
 	}
 	y += h + title_margin_bottom;
 
 	/* Description */
-	if (screen->draw_desc)
+	if (screen->draw_desc) {
 		VB2_TRY(screen->draw_desc(ui, prev_state, &y));
-	else
+	} else if (redraw) {
 		VB2_TRY(ui_draw_desc(&screen->desc, state, &y));
+		prev_desc_y = y;
+	} else {
+		y = prev_desc_y;
+	}
 	y += UI_DESC_MARGIN_BOTTOM;
 
 	/* Primary and secondary buttons */
 	if (screen->draw_menu_items)
 		VB2_TRY(screen->draw_menu_items(ui, prev_state));
 	else
-		VB2_TRY(ui_draw_menu_items(menu, state, prev_state, y));
+		VB2_TRY(ui_draw_menu_items(menu, state,
+					   ui->force_display ? NULL : prev_state,
+					   y));
 
 	return VB2_SUCCESS;
 }
@@ -26,8 +26,10 @@
 
 #include "base/ranges.h"
 #include "base/physmem.h"
+#include "base/timestamp.h"
 #include "image/symbols.h"
 #include "vboot/util/memory.h"
+#include "vboot/util/wipe.h"
 
 static Ranges used;
 
@@ -51,22 +53,19 @@ void memory_mark_used(uint64_t start, uint64_t end)
 	ranges_add(&used, start, end);
 }
 
-static void arch_phys_memset_map_func(uint64_t phys_addr, void *s, uint64_t n,
-				      void *data)
+static void arch_phys_zero_map_func(uint64_t phys_addr, void *s, uint64_t n,
+				    void *data)
 {
-	memset(s, *((int *)data), n);
+	wipe_zero(s, n);
 }
 
-static inline uint64_t arch_phys_memset(uint64_t s, int c, uint64_t n)
+static void unused_wipe(uint64_t start, uint64_t end, void *data)
 {
-	arch_phys_map(s, n, arch_phys_memset_map_func, &c);
-	return s;
-}
+	uint64_t *total = data;
 
-static inline void unused_memset(uint64_t start, uint64_t end, void *data)
-{
 	printf("\t[%#016llx, %#016llx)\n", start, end);
-	arch_phys_memset(start, 0, end - start);
+	arch_phys_map(start, end - start, arch_phys_zero_map_func, NULL);
+	*total += end - start;
 }
 
 static int get_unused_memory(Ranges *ranges)
@@ -165,7 +164,15 @@ int memory_wipe_unused(void)
 
 	// Do the wipe.
 	printf("Wipe memory regions:\n");
-	ranges_for_each(&ranges, &unused_memset, NULL);
+	uint64_t total = 0;
+	uint64_t start_us = timer_us(0);
+	timestamp_add_now(TS_WIPE_MEMORY_START);
+	ranges_for_each(&ranges, &unused_wipe, &total);
+	timestamp_add_now(TS_WIPE_MEMORY_DONE);
+	uint64_t elapsed_us = MAX(timer_us(start_us), 1);
+	printf("Wiped %llu MiB in %llu ms (%llu MiB/s)\n", total / MiB,
+	       elapsed_us / USECS_PER_MSEC, total * USECS_PER_SEC / MiB /
+	       elapsed_us);
 	ranges_teardown(&ranges);
 	return result;
 }
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vboot/util/wipe.h"
+
+void wipe_split(uint64_t addr, uint64_t n, uint64_t block_size,
+		WipeSplit *split)
+{
+	uint64_t body_start, body_end;
+
+	memset(split, 0, sizeof(*split));
+
+	if (!block_size) {
+		split->head = n;
+		return;
+	}
+
+	body_start = ALIGN_UP(addr, block_size);
+	body_end = ALIGN_DOWN(addr + n, block_size);
+	if (body_start < addr || body_start >= body_end) {
+		/* Too small (or wraps around), no full block in the range. */
+		split->head = n;
+		return;
+	}
+
+	split->head = body_start - addr;
+	split->body = body_end - body_start;
+	split->tail = addr + n - body_end;
+}
+
+#if CONFIG(ARCH_ARM_V8)
+
+size_t wipe_block_size(void)
+{
+	static size_t block_size = SIZE_MAX;
+	uint64_t dczid;
+
+	if (block_size != SIZE_MAX)
+		return block_size;
+
+	__asm__ __volatile__("mrs %0, dczid_el0" : "=r" (dczid));
+	/* DZP set means DC ZVA is prohibited. */
+	if (dczid & (1 << 4))
+		block_size = 0;
+	else
+		block_size = 4 << (dczid & 0xf);
+
+	return block_size;
+}
+
+/* DC ZVA zeroes a whole block without reading it into the cache first. */
+static void wipe_zero_blocks(void *s, size_t n, size_t block_size)
+{
+	uint8_t *p = s;
+	uint8_t *end = p + n;
+
+	for (; p < end; p += block_size)
+		__asm__ __volatile__("dc zva, %0" : : "r" (p) : "memory");
+	__asm__ __volatile__("dsb sy" : : : "memory");
+}
+
+#elif CONFIG(ARCH_X86_32) || CONFIG(ARCH_X86_64)
+
+size_t wipe_block_size(void)
+{
+	return 64;
+}
+
+/*
+ * Non-temporal stores go straight to memory through the write-combining
+ * buffers instead of pulling every line of the range into the cache.
+ */
+static void wipe_zero_blocks(void *s, size_t n, size_t block_size)
+{
+	unsigned long *p = s;
+	unsigned long *end = (unsigned long *)((uint8_t *)s + n);
+
+	for (; p < end; p++)
+		__asm__ __volatile__("movnti %1, %0"
+				     : "=m" (*p) : "r" (0UL));
+	__asm__ __volatile__("sfence" : : : "memory");
+}
+
+#else
+
+size_t wipe_block_size(void)
+{
+	return 0;
+}
+
+static void wipe_zero_blocks(void *s, size_t n, size_t block_size)
+{
+	memset(s, 0, n);
+}
+
+#endif
+
+void wipe_zero(void *s, size_t n)
+{
+	size_t block_size = wipe_block_size();
+	uint8_t *p = s;
+	WipeSplit split;
+
+	wipe_split((uintptr_t)s, n, block_size, &split);
+
+	memset(p, 0, split.head);
+	p += split.head;
+	if (split.body) {
+		wipe_zero_blocks(p, split.body, block_size);
+		p += split.body;
+	}
+	memset(p, 0, split.tail);
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef __VBOOT_UTIL_WIPE_H__
+#define __VBOOT_UTIL_WIPE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A range to be zeroed, split into an unaligned head and tail that are
+ * cleared with memset() and a block aligned body in between that is cleared
+ * with the architecture's cache-bypassing zeroing primitive.
+ */
+typedef struct WipeSplit {
+	uint64_t head;
+	uint64_t body;
+	uint64_t tail;
+} WipeSplit;
+
+/*
+ * Split the n bytes at addr for a zeroing primitive which works on naturally
+ * aligned blocks of block_size bytes. block_size must be zero (no primitive,
+ * everything goes in the head) or a power of two.
+ */
+void wipe_split(uint64_t addr, uint64_t n, uint64_t block_size,
+		WipeSplit *split);
+
+/* Block size of the zeroing primitive, or 0 if there is none. */
+size_t wipe_block_size(void);
+
+/* Zero n bytes at s, bypassing the cache where the architecture allows. */
+void wipe_zero(void *s, size_t n);
+
+#endif /* __VBOOT_UTIL_WIPE_H__ */
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+#include <string.h>
+
+#include "base/crc32.h"
+#include "helpers/benchmark.h"
+#include "tests/test.h"
+
+#define BUF_SIZE 256
+#define BENCHMARK_SIZE (16 * MiB)
+#define BENCHMARK_ROUNDS 4
+
+static uint8_t buf[BUF_SIZE] __attribute__((aligned(sizeof(uint64_t))));
+
+/* Bit at a time, straight from the definition. */
+static uint32_t reference_crc32_le(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+	}
+	return crc;
+}
+
+static void fill_buf(void)
+{
+	for (int i = 0; i < BUF_SIZE; i++)
+		buf[i] = i * 0x9d + (i >> 3);
+}
+
+static void test_crc32_check_values(void **state)
+{
+	static const char check[] = "123456789";
+
+	assert_int_equal(crc32(0, NULL, 0), 0);
+	assert_int_equal(crc32(0, check, strlen(check)), 0xcbf43926);
+	assert_int_equal(crc32_le(0, check, strlen(check)), 0x2dfd2d88);
+	assert_int_equal(crc32_le(~0, check, strlen(check)), ~0xcbf43926);
+}
+
+static void test_crc32_lengths_and_alignments(void **state)
+{
+	fill_buf();
+
+	for (size_t offset = 0; offset < 8; offset++) {
+		for (size_t len = 0; offset + len <= BUF_SIZE; len++) {
+			uint32_t expected = reference_crc32_le(0x12345678,
+							       buf + offset,
+							       len);
+
+			assert_int_equal(crc32_le_sw(0x12345678, buf + offset,
+						     len), expected);
+			assert_int_equal(crc32_le(0x12345678, buf + offset,
+						  len), expected);
+			assert_int_equal(crc32(0x12345678, buf + offset, len),
+					 ~reference_crc32_le(~0x12345678,
+							     buf + offset,
+							     len));
+		}
+	}
+}
+
+static void test_crc32_chained(void **state)
+{
+	uint32_t whole, crc;
+
+	fill_buf();
+	whole = crc32(0, buf, BUF_SIZE);
+
+	for (size_t split = 0; split <= BUF_SIZE; split += 13) {
+		crc = crc32(0, buf, split);
+		crc = crc32(crc, buf + split, BUF_SIZE - split);
+		assert_int_equal(crc, whole);
+	}
+}
+
+/* What crc32() did before, one table lookup per byte. */
+static uint32_t byte_table[256];
+
+static uint32_t reference_crc32_table(uint32_t crc, const uint8_t *p,
+				      size_t len)
+{
+	while (len--)
+		crc = byte_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void test_crc32_benchmark(void **state)
+{
+	const uint64_t total = (uint64_t)BENCHMARK_SIZE * BENCHMARK_ROUNDS;
+	uint64_t start, slice_us, active_us, table_us;
+	uint32_t crc, ref_crc;
+	char str[3][16];
+	uint8_t *mem;
+
+	skip_unless_benchmark();
+	mem = test_malloc(BENCHMARK_SIZE);
+
+	for (int i = 0; i < 256; i++) {
+		uint8_t byte = i;
+
+		byte_table[i] = reference_crc32_le(0, &byte, 1);
+	}
+	for (size_t i = 0; i < BENCHMARK_SIZE; i++)
+		mem[i] = i * 0x9d + (i >> 11);
+
+	start = timer_us(0);
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+		crc = crc32_le_sw(0, mem, BENCHMARK_SIZE);
+	slice_us = timer_us(start);
+
+	start = timer_us(0);
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+		assert_int_equal(crc32_le(0, mem, BENCHMARK_SIZE), crc);
+	active_us = timer_us(start);
+
+	start = timer_us(0);
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+		ref_crc = reference_crc32_table(0, mem, BENCHMARK_SIZE);
+	table_us = timer_us(start);
+	assert_int_equal(ref_crc, crc);
+
+	print_message("%10s %10s %10s (GB/s)\n", "slice-by-8", "crc32_le",
+		      "byte table");
+	print_message("%10s %10s %10s\n",
+		      gb_per_sec(str[0], sizeof(str[0]), total, slice_us),
+		      gb_per_sec(str[1], sizeof(str[1]), total, active_us),
+		      gb_per_sec(str[2], sizeof(str[2]), total, table_us));
+
+	test_free(mem);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_crc32_check_values),
+		cmocka_unit_test(test_crc32_lengths_and_alignments),
+		cmocka_unit_test(test_crc32_chained),
+		cmocka_unit_test(test_crc32_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -155,6 +155,331 @@ static void test_sparse_unaligned_address(void **state)
 	assert_memory_equal(storage, expected, sizeof(expected));
 }
 
+/* Feed the image to a sparse_stream in pieces of piece_len bytes */
+static enum gpt_io_ret stream_sparse_image(BlockDev *bdev, uint64_t part_start,
+					   uint64_t part_size, const void *image,
+					   size_t image_size, size_t piece_len)
+{
+	struct sparse_stream ss;
+	const char *ptr = image;
+
+	sparse_stream_init(&ss, bdev, part_start, part_size, 0);
+
+	while (image_size) {
+		size_t n = MIN(piece_len, image_size);
+
+		if (sparse_stream_feed(&ss, ptr, n) != GPT_IO_SUCCESS)
+			break;
+		ptr += n;
+		image_size -= n;
+	}
+
+	return sparse_stream_finish(&ss);
+}
+
+static void test_sparse_stream_byte_by_byte(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	char storage[1024];
+	char expected[1024];
+	sts->test_bdev = new_test_blockdev(storage, sizeof(storage), 16);
+
+	prepare_storage_and_expected(storage, expected, sizeof(storage), 48);
+
+	enum gpt_io_ret ret = stream_sparse_image(sts->test_bdev, 48, 192, sparse_image,
+						  sizeof(sparse_image), 1);
+
+	assert_int_equal(ret, 0);
+	assert_memory_equal(storage, expected, sizeof(expected));
+}
+
+static void test_sparse_stream_odd_pieces(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	char storage[1024];
+	char expected[1024];
+	sts->test_bdev = new_test_blockdev(storage, sizeof(storage), 8);
+
+	prepare_storage_and_expected(storage, expected, sizeof(storage), 40);
+
+	enum gpt_io_ret ret = stream_sparse_image(sts->test_bdev, 40, 192, sparse_image,
+						  sizeof(sparse_image), 7);
+
+	assert_int_equal(ret, 0);
+	assert_memory_equal(storage, expected, sizeof(expected));
+}
+
+static void test_sparse_stream_trailing_data(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	char storage[1024];
+	char expected[1024];
+	char image[sizeof(sparse_image) + 16];
+	sts->test_bdev = new_test_blockdev(storage, sizeof(storage), 16);
+
+	prepare_storage_and_expected(storage, expected, sizeof(storage), 48);
+	memcpy(image, sparse_image, sizeof(sparse_image));
+	memset(image + sizeof(sparse_image), 0xaa, sizeof(image) - sizeof(sparse_image));
+
+	enum gpt_io_ret ret = stream_sparse_image(sts->test_bdev, 48, 192, image,
+						  sizeof(image), 5);
+
+	assert_int_equal(ret, 0);
+	assert_memory_equal(storage, expected, sizeof(expected));
+}
+
+static void test_sparse_stream_truncated(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	char storage[1024];
+	char expected[1024];
+	sts->test_bdev = new_test_blockdev(storage, sizeof(storage), 16);
+
+	prepare_storage_and_expected(storage, expected, sizeof(storage), 48);
+
+	enum gpt_io_ret ret = stream_sparse_image(sts->test_bdev, 48, 192, sparse_image,
+						  sizeof(sparse_image) - 5, 3);
+
+	assert_int_equal(ret, GPT_IO_SPARSE_TOO_SMALL);
+	/* Everything before the last chunk was already written */
+	assert_memory_equal(storage, expected, 48 + 6 * 16);
+}
+
+static void test_sparse_stream_wrong_magic(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	char storage[1024];
+	char expected[1024];
+	char image[sizeof(sparse_image)];
+	sts->test_bdev = new_test_blockdev(storage, sizeof(storage), 16);
+
+	prepare_storage_and_expected(storage, expected, sizeof(storage), 48);
+	memcpy(image, sparse_image, sizeof(sparse_image));
+	image[0] = 0;
+
+	enum gpt_io_ret ret = stream_sparse_image(sts->test_bdev, 48, 192, image,
+						  sizeof(image), 64);
+
+	assert_int_equal(ret, GPT_IO_SPARSE_WRONG_MAGIC);
+	for (int i = 0; i < sizeof(storage); i++)
+		assert_int_equal(storage[i], (char)(i & 0xff));
+}
+
+static void test_sparse_stream_out_of_range(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	char storage[1024];
+	char expected[1024];
+	sts->test_bdev = new_test_blockdev(storage, sizeof(storage), 16);
+
+	prepare_storage_and_expected(storage, expected, sizeof(storage), 48);
+
+	enum gpt_io_ret ret = stream_sparse_image(sts->test_bdev, 48, 96, sparse_image,
+						  sizeof(sparse_image), 11);
+
+	assert_int_equal(ret, GPT_IO_OUT_OF_RANGE);
+}
+
+/* Device operation counters for the write policy tests */
+static BlockDevOps orig_ops;
+static int write_calls;
+static int erase_calls;
+
+static lba_t counting_write(BlockDevOps *me, lba_t start, lba_t count, const void *buffer)
+{
+	write_calls++;
+	return orig_ops.write(me, start, count, buffer);
+}
+
+static lba_t counting_erase(BlockDevOps *me, lba_t start, lba_t count)
+{
+	erase_calls++;
+	return orig_ops.erase(me, start, count);
+}
+
+static BlockDev *new_counting_blockdev(char *storage, unsigned int size, int erase_zeroes)
+{
+	BlockDev *bdev = new_test_blockdev(storage, size, 16);
+
+	orig_ops = bdev->ops;
+	bdev->ops.write = counting_write;
+	bdev->ops.erase = counting_erase;
+	bdev->erase_zeroes = erase_zeroes;
+	write_calls = 0;
+	erase_calls = 0;
+
+	return bdev;
+}
+
+struct test_image {
+	uint8_t data[512];
+	size_t len;
+};
+
+static void image_add_chunk(struct test_image *img, uint16_t type, uint32_t blocks,
+			    const void *data, size_t data_len)
+{
+	struct sparse_chunk_hdr hdr = {
+		.type = type,
+		.size_in_blks = blocks,
+		.total_size_bytes = sizeof(hdr) + data_len,
+	};
+
+	memcpy(img->data + img->len, &hdr, sizeof(hdr));
+	memcpy(img->data + img->len + sizeof(hdr), data, data_len);
+	img->len += sizeof(hdr) + data_len;
+}
+
+/*
+ * Image with 16-byte blocks:
+ * RAW 'a' x1, RAW 'b' x2, FILL 0 x4, DONT_CARE x2, RAW 'c' x1, FILL 0x11111111 x1
+ */
+static void build_policy_image(struct test_image *img)
+{
+	struct sparse_image_hdr hdr = {
+		.magic = SPARSE_IMAGE_MAGIC,
+		.major_version = 1,
+		.file_hdr_size = sizeof(struct sparse_image_hdr),
+		.chunk_hdr_size = sizeof(struct sparse_chunk_hdr),
+		.blk_size = 16,
+		.total_blks = 11,
+		.total_chunks = 6,
+	};
+	uint32_t zero = 0;
+	uint32_t ones = 0x11111111;
+	char raw[32];
+
+	memcpy(img->data, &hdr, sizeof(hdr));
+	img->len = sizeof(hdr);
+
+	memset(raw, 'a', 16);
+	image_add_chunk(img, CHUNK_TYPE_RAW, 1, raw, 16);
+	memset(raw, 'b', 32);
+	image_add_chunk(img, CHUNK_TYPE_RAW, 2, raw, 32);
+	image_add_chunk(img, CHUNK_TYPE_FILL, 4, &zero, sizeof(zero));
+	image_add_chunk(img, CHUNK_TYPE_DONT_CARE, 2, NULL, 0);
+	memset(raw, 'c', 16);
+	image_add_chunk(img, CHUNK_TYPE_RAW, 1, raw, 16);
+	image_add_chunk(img, CHUNK_TYPE_FILL, 1, &ones, sizeof(ones));
+}
+
+/* Expected content of the disk after writing build_policy_image() at offset 32 */
+static void prepare_policy_expected(char *storage, char *expected, size_t size,
+				    bool dont_care_erased)
+{
+	for (int i = 0; i < size; i++) {
+		storage[i] = i & 0xff;
+		expected[i] = i & 0xff;
+	}
+
+	memset(expected + 32, 'a', 16);
+	memset(expected + 48, 'b', 32);
+	memset(expected + 80, 0, 64);
+	if (dont_care_erased)
+		memset(expected + 144, 0, 32);
+	memset(expected + 176, 'c', 16);
+	memset(expected + 192, 0x11, 16);
+}
+
+static enum gpt_io_ret write_with_policy(BlockDev *bdev, const struct test_image *img,
+					 unsigned int policy)
+{
+	struct sparse_stream ss;
+
+	sparse_stream_init(&ss, bdev, 32, 512, policy);
+	sparse_stream_feed(&ss, img->data, img->len);
+
+	return sparse_stream_finish(&ss);
+}
+
+static void test_sparse_policy_none(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	struct test_image img;
+	char storage[1024];
+	char expected[1024];
+
+	build_policy_image(&img);
+	prepare_policy_expected(storage, expected, sizeof(storage), false);
+	sts->test_bdev = new_counting_blockdev(storage, sizeof(storage), 1);
+
+	assert_int_equal(write_with_policy(sts->test_bdev, &img, 0), GPT_IO_SUCCESS);
+
+	assert_memory_equal(storage, expected, sizeof(expected));
+	/* Every RAW and FILL chunk is written on its own */
+	assert_int_equal(write_calls, 5);
+	assert_int_equal(erase_calls, 0);
+}
+
+static void test_sparse_policy_erase_and_merge(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	struct test_image img;
+	char storage[1024];
+	char expected[1024];
+
+	build_policy_image(&img);
+	prepare_policy_expected(storage, expected, sizeof(storage), true);
+	sts->test_bdev = new_counting_blockdev(storage, sizeof(storage), 1);
+
+	assert_int_equal(write_with_policy(sts->test_bdev, &img,
+					   SPARSE_WRITE_ERASE_ZERO_FILL |
+					   SPARSE_WRITE_ERASE_DONT_CARE |
+					   SPARSE_WRITE_MERGE_RAW),
+			 GPT_IO_SUCCESS);
+
+	assert_memory_equal(storage, expected, sizeof(expected));
+	/* Both leading RAW chunks in one write, last RAW, non-zero FILL */
+	assert_int_equal(write_calls, 3);
+	/* Zero FILL and DONT_CARE */
+	assert_int_equal(erase_calls, 2);
+}
+
+static void test_sparse_policy_erase_not_zeroing(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	struct test_image img;
+	char storage[1024];
+	char expected[1024];
+
+	build_policy_image(&img);
+	prepare_policy_expected(storage, expected, sizeof(storage), true);
+	sts->test_bdev = new_counting_blockdev(storage, sizeof(storage), 0);
+
+	assert_int_equal(write_with_policy(sts->test_bdev, &img,
+					   SPARSE_WRITE_ERASE_ZERO_FILL |
+					   SPARSE_WRITE_ERASE_DONT_CARE),
+			 GPT_IO_SUCCESS);
+
+	assert_memory_equal(storage, expected, sizeof(expected));
+	/* Zero FILL has to be written when erase doesn't leave zeroes */
+	assert_int_equal(write_calls, 5);
+	assert_int_equal(erase_calls, 1);
+}
+
+static void test_sparse_policy_merge_streamed(void **state)
+{
+	struct sparse_test_state *sts = *state;
+	struct test_image img;
+	struct sparse_stream ss;
+	char storage[1024];
+	char expected[1024];
+
+	build_policy_image(&img);
+	prepare_policy_expected(storage, expected, sizeof(storage), false);
+	sts->test_bdev = new_counting_blockdev(storage, sizeof(storage), 1);
+
+	sparse_stream_init(&ss, sts->test_bdev, 32, 512, SPARSE_WRITE_MERGE_RAW);
+	for (size_t i = 0; i < img.len; i += 5)
+		assert_int_equal(sparse_stream_feed(&ss, img.data + i, MIN(5, img.len - i)),
+				 GPT_IO_SUCCESS);
+	assert_int_equal(sparse_stream_finish(&ss), GPT_IO_SUCCESS);
+
+	assert_memory_equal(storage, expected, sizeof(expected));
+	assert_int_equal(write_calls, 4);
+	assert_int_equal(erase_calls, 0);
+}
+
 #define TEST(test_function_name) \
 	cmocka_unit_test_setup_teardown(test_function_name, setup, teardown)
 
@@ -165,6 +490,16 @@ int main(void)
 		TEST(test_sparse_block_size_smaller),
 		TEST(test_sparse_block_size_equal),
 		TEST(test_sparse_unaligned_address),
+		TEST(test_sparse_stream_byte_by_byte),
+		TEST(test_sparse_stream_odd_pieces),
+		TEST(test_sparse_stream_trailing_data),
+		TEST(test_sparse_stream_truncated),
+		TEST(test_sparse_stream_wrong_magic),
+		TEST(test_sparse_stream_out_of_range),
+		TEST(test_sparse_policy_none),
+		TEST(test_sparse_policy_erase_and_merge),
+		TEST(test_sparse_policy_erase_not_zeroing),
+		TEST(test_sparse_policy_merge_streamed),
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
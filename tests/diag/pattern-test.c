@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+#include <string.h>
+
+#include "diag/pattern.h"
+#include "helpers/benchmark.h"
+#include "tests/test.h"
+
+#define BUF_SIZE (3 * PATTERN_BLOCK_SIZE + 0x123)
+#define BENCHMARK_SIZE (64 * MiB)
+#define BENCHMARK_ROUNDS 4
+
+static uint8_t buf[BUF_SIZE + sizeof(uint64_t)]
+	__attribute__((aligned(sizeof(uint64_t))));
+
+static const uint32_t three_data[] = {0x01234567, 0x89abcdef, 0xdeadbeef};
+static const Pattern three = {
+	.name = "three",
+	.data = three_data,
+	.len = ARRAY_SIZE(three_data),
+};
+
+/* Expected byte at offset pos from the start of the tested region. */
+static uint8_t expected_byte(const Pattern *pattern, uint64_t pos)
+{
+	const uint8_t *data = (const uint8_t *)pattern->data;
+	size_t period = pattern->len * sizeof(*pattern->data);
+
+	return data[(pos % PATTERN_BLOCK_SIZE) % period];
+}
+
+static void check_round_trip(const Pattern *pattern, size_t offset,
+			     size_t size)
+{
+	PatternBlock block;
+	uint8_t *mem = buf + offset;
+
+	pattern_block_fill(&block, pattern);
+	memset(buf, 0x5c, sizeof(buf));
+	pattern_write(mem, size, &block);
+
+	for (size_t i = 0; i < size; i++)
+		if (mem[i] != expected_byte(pattern, i))
+			fail_msg("%s: offset %#zx size %#zx: byte %#zx is %#x",
+				 pattern->name, offset, size, i, mem[i]);
+	assert_int_equal(pattern_check(mem, size, &block), size);
+}
+
+static void test_pattern_block_fill(void **state)
+{
+	PatternBlock block;
+	const uint8_t *data = (const uint8_t *)block.data;
+
+	pattern_block_fill(&block, &three);
+	for (size_t i = 0; i < PATTERN_BLOCK_SIZE; i++)
+		assert_int_equal(data[i], expected_byte(&three, i));
+}
+
+static void test_pattern_round_trip(void **state)
+{
+	const struct list_node *patterns = DiagGetTestPatterns();
+	const Pattern *pattern;
+
+	list_for_each(pattern, *patterns, list_node) {
+		check_round_trip(pattern, 0, BUF_SIZE);
+		check_round_trip(pattern, 3, BUF_SIZE - 3);
+		check_round_trip(pattern, 8, 2 * PATTERN_BLOCK_SIZE);
+		check_round_trip(pattern, 0, 7);
+	}
+	check_round_trip(&three, 0, BUF_SIZE);
+	check_round_trip(&three, 5, BUF_SIZE);
+}
+
+static void check_mismatch(size_t offset, size_t size, size_t bad)
+{
+	PatternBlock block;
+	uint8_t *mem = buf + offset;
+
+	pattern_block_fill(&block, &three);
+	pattern_write(mem, size, &block);
+	mem[bad] ^= 0x10;
+	assert_int_equal(pattern_check(mem, size, &block), bad);
+}
+
+static void test_pattern_check_mismatch(void **state)
+{
+	/* Aligned full blocks */
+	check_mismatch(0, BUF_SIZE, 0);
+	check_mismatch(0, BUF_SIZE, PATTERN_BLOCK_SIZE + 0x3f);
+	check_mismatch(0, BUF_SIZE, 3 * PATTERN_BLOCK_SIZE - 1);
+	/* Partial block at the end */
+	check_mismatch(0, BUF_SIZE, BUF_SIZE - 1);
+	/* Unaligned start */
+	check_mismatch(1, BUF_SIZE, 2 * PATTERN_BLOCK_SIZE + 0x11);
+}
+
+static void test_pattern_check_first_mismatch(void **state)
+{
+	PatternBlock block;
+
+	pattern_block_fill(&block, &three);
+	pattern_write(buf, BUF_SIZE, &block);
+	buf[2 * PATTERN_BLOCK_SIZE + 9] ^= 1;
+	buf[PATTERN_BLOCK_SIZE + 100] ^= 1;
+	assert_int_equal(pattern_check(buf, BUF_SIZE, &block),
+			 PATTERN_BLOCK_SIZE + 100);
+}
+
+/* What the memory test did before, for comparison in the benchmark. */
+static void reference_write(void *dst, uint64_t size, const void *pat)
+{
+	for (uint64_t pos = 0, cur_size; pos < size; pos += cur_size) {
+		cur_size = MIN(size - pos, PATTERN_BLOCK_SIZE);
+		memcpy(dst + pos, pat, cur_size);
+	}
+}
+
+static uint64_t reference_check(const void *src, uint64_t size,
+				const void *pat)
+{
+	for (uint64_t pos = 0, cur_size; pos < size; pos += cur_size) {
+		cur_size = MIN(size - pos, PATTERN_BLOCK_SIZE);
+		if (memcmp(src + pos, pat, cur_size))
+			return pos;
+	}
+	return size;
+}
+
+static void test_pattern_benchmark(void **state)
+{
+	const struct list_node *patterns = DiagGetTestPatterns();
+	const uint64_t total = (uint64_t)BENCHMARK_SIZE * BENCHMARK_ROUNDS;
+	const Pattern *pattern;
+	PatternBlock block;
+	uint64_t start, write_us, check_us, ref_write_us, ref_check_us;
+	char str[4][16];
+	uint8_t *mem;
+
+	skip_unless_benchmark();
+	mem = test_malloc(BENCHMARK_SIZE);
+
+	print_message("%-14s %10s %10s %10s %10s (GB/s)\n", "pattern",
+		      "write", "check", "old write", "old check");
+
+	list_for_each(pattern, *patterns, list_node) {
+		pattern_block_fill(&block, pattern);
+
+		start = timer_us(0);
+		for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+			pattern_write(mem, BENCHMARK_SIZE, &block);
+		write_us = timer_us(start);
+
+		start = timer_us(0);
+		for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+			assert_int_equal(pattern_check(mem, BENCHMARK_SIZE,
+						       &block),
+					 BENCHMARK_SIZE);
+		check_us = timer_us(start);
+
+		start = timer_us(0);
+		for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+			reference_write(mem, BENCHMARK_SIZE, block.data);
+		ref_write_us = timer_us(start);
+
+		start = timer_us(0);
+		for (int i = 0; i < BENCHMARK_ROUNDS; i++)
+			assert_int_equal(reference_check(mem, BENCHMARK_SIZE,
+							 block.data),
+					 BENCHMARK_SIZE);
+		ref_check_us = timer_us(start);
+
+		print_message("%-14s %10s %10s %10s %10s\n", pattern->name,
+			      gb_per_sec(str[0], sizeof(str[0]), total,
+					 write_us),
+			      gb_per_sec(str[1], sizeof(str[1]), total,
+					 check_us),
+			      gb_per_sec(str[2], sizeof(str[2]), total,
+					 ref_write_us),
+			      gb_per_sec(str[3], sizeof(str[3]), total,
+					 ref_check_us));
+	}
+
+	test_free(mem);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_pattern_block_fill),
+		cmocka_unit_test(test_pattern_round_trip),
+		cmocka_unit_test(test_pattern_check_mismatch),
+		cmocka_unit_test(test_pattern_check_first_mismatch),
+		cmocka_unit_test(test_pattern_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
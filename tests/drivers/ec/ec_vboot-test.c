@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+
+#include "drivers/ec/cros/ec.h"
+#include "tests/test.h"
+
+#include "drivers/ec/cros/ec_vboot.c"
+
+#define MOCK_BLOCK_SIZE 0x100
+#define MOCK_BLOCK_COUNT 8
+#define MOCK_REGION_OFFSET MOCK_BLOCK_SIZE
+#define MOCK_REGION_SIZE (MOCK_BLOCK_COUNT * MOCK_BLOCK_SIZE)
+#define MOCK_FLASH_SIZE (MOCK_REGION_OFFSET + MOCK_REGION_SIZE)
+/* Ends in the middle of the second to last block */
+#define MOCK_IMAGE_SIZE (MOCK_REGION_SIZE - MOCK_BLOCK_SIZE - 0x40)
+
+static uint8_t mock_flash[MOCK_FLASH_SIZE];
+static uint8_t mock_image[MOCK_IMAGE_SIZE];
+static uint8_t mock_erase_value;
+static bool mock_flash_info_v1;
+static int mock_erase_count;
+static int mock_write_count;
+
+static CrosEc mock_ec = {
+	.max_param_size = 0x80,
+	.proto3_response_size = 0x80,
+};
+
+/* Mock functions. */
+
+int cros_ec_cmd_version_supported(int cmd, int ver)
+{
+	switch (cmd) {
+	case EC_CMD_FLASH_INFO:
+		return ver == 0 || (ver == 1 && mock_flash_info_v1);
+	case EC_CMD_FLASH_WRITE:
+		return ver <= EC_VER_FLASH_WRITE;
+	default:
+		return 0;
+	}
+}
+
+static int mock_flash_info(int cmd_version, void *din, int din_len)
+{
+	struct ec_response_flash_info_1 info = {
+		.flash_size = MOCK_FLASH_SIZE,
+		.write_block_size = 0x10,
+		.erase_block_size = MOCK_BLOCK_SIZE,
+		.protect_block_size = MOCK_BLOCK_SIZE,
+		.write_ideal_size = 0x40,
+		.flags = mock_erase_value ? 0 : EC_FLASH_INFO_ERASE_TO_0,
+	};
+	int size = cmd_version ? sizeof(info) :
+		sizeof(struct ec_response_flash_info);
+
+	assert_true(cmd_version == 0 || mock_flash_info_v1);
+	assert_int_equal(din_len, size);
+	memcpy(din, &info, size);
+	return size;
+}
+
+int ec_command(CrosEc *me, int cmd, int cmd_version, const void *dout,
+	       int dout_len, void *din, int din_len)
+{
+	const struct ec_params_flash_read *read = dout;
+	const struct ec_params_flash_erase *erase = dout;
+	const struct ec_params_flash_write *write = dout;
+
+	assert_ptr_equal(me, &mock_ec);
+
+	switch (cmd) {
+	case EC_CMD_FLASH_INFO:
+		return mock_flash_info(cmd_version, din, din_len);
+	case EC_CMD_FLASH_READ:
+		assert_true(read->offset + read->size <= MOCK_FLASH_SIZE);
+		assert_int_equal(din_len, read->size);
+		memcpy(din, mock_flash + read->offset, read->size);
+		return read->size;
+	case EC_CMD_FLASH_ERASE:
+		assert_true(erase->offset + erase->size <= MOCK_FLASH_SIZE);
+		assert_int_equal(erase->offset % MOCK_BLOCK_SIZE, 0);
+		assert_int_equal(erase->size % MOCK_BLOCK_SIZE, 0);
+		memset(mock_flash + erase->offset, mock_erase_value,
+		       erase->size);
+		mock_erase_count++;
+		return 0;
+	case EC_CMD_FLASH_WRITE:
+		assert_true(write->offset + write->size <= MOCK_FLASH_SIZE);
+		assert_int_equal(dout_len, sizeof(*write) + write->size);
+		memcpy(mock_flash + write->offset, write + 1, write->size);
+		mock_write_count++;
+		return 0;
+	default:
+		fail_msg("Unexpected EC command %#x", cmd);
+		return -EC_RES_INVALID_COMMAND;
+	}
+}
+
+/* Put the image in the region and leave the rest of it erased. */
+static void mock_flash_image(void)
+{
+	memset(mock_flash, mock_erase_value, sizeof(mock_flash));
+	memcpy(mock_flash + MOCK_REGION_OFFSET, mock_image, sizeof(mock_image));
+}
+
+static void assert_flash_image(void)
+{
+	assert_memory_equal(mock_flash + MOCK_REGION_OFFSET, mock_image,
+			    sizeof(mock_image));
+	assert_filled_with(mock_flash + MOCK_REGION_OFFSET + MOCK_IMAGE_SIZE,
+			   mock_erase_value, MOCK_REGION_SIZE - MOCK_IMAGE_SIZE);
+}
+
+static int update_diff(void)
+{
+	return ec_flash_update_diff(&mock_ec, mock_image, sizeof(mock_image),
+				    MOCK_REGION_OFFSET, MOCK_REGION_SIZE);
+}
+
+static int setup(void **state)
+{
+	for (size_t i = 0; i < sizeof(mock_image); i++)
+		mock_image[i] = i * 0x9d + (i >> 8) + 1;
+	mock_erase_value = 0xff;
+	mock_flash_info_v1 = false;
+	mock_erase_count = 0;
+	mock_write_count = 0;
+	return 0;
+}
+
+/* Test functions. */
+
+static void test_update_diff_unchanged(void **state)
+{
+	mock_flash_image();
+
+	assert_int_equal(update_diff(), 0);
+	assert_int_equal(mock_erase_count, 0);
+	assert_int_equal(mock_write_count, 0);
+	assert_flash_image();
+}
+
+static void test_update_diff_one_block(void **state)
+{
+	mock_flash_image();
+	mock_flash[MOCK_REGION_OFFSET + 2 * MOCK_BLOCK_SIZE + 5] ^= 1;
+
+	assert_int_equal(update_diff(), 0);
+	assert_int_equal(mock_erase_count, 1);
+	assert_flash_image();
+}
+
+static void test_update_diff_last_image_block(void **state)
+{
+	/* The erased part of the block is checked as well */
+	mock_flash_image();
+	mock_flash[MOCK_REGION_OFFSET + MOCK_IMAGE_SIZE + 3] = 0x12;
+
+	assert_int_equal(update_diff(), 0);
+	assert_int_equal(mock_erase_count, 1);
+	assert_flash_image();
+}
+
+static void test_update_diff_zeroes_past_image(void **state)
+{
+	/* Zeroes aren't erased flash on a chip that erases to 0xff */
+	mock_flash_image();
+	memset(mock_flash + MOCK_REGION_OFFSET + MOCK_REGION_SIZE -
+	       MOCK_BLOCK_SIZE, 0, MOCK_BLOCK_SIZE);
+
+	assert_int_equal(update_diff(), 0);
+	assert_int_equal(mock_erase_count, 1);
+	assert_int_equal(mock_write_count, 0);
+	assert_flash_image();
+}
+
+static void test_update_diff_erase_to_0(void **state)
+{
+	mock_flash_info_v1 = true;
+	mock_erase_value = 0;
+	mock_flash_image();
+
+	assert_int_equal(update_diff(), 0);
+	assert_int_equal(mock_erase_count, 0);
+	assert_flash_image();
+
+	/* 0xff isn't erased flash on a chip that erases to 0 */
+	memset(mock_flash + MOCK_REGION_OFFSET + MOCK_REGION_SIZE -
+	       MOCK_BLOCK_SIZE, 0xff, MOCK_BLOCK_SIZE);
+
+	assert_int_equal(update_diff(), 0);
+	assert_int_equal(mock_erase_count, 1);
+	assert_flash_image();
+}
+
+static void test_update_diff_too_many_changes(void **state)
+{
+	mock_flash_image();
+	for (int i = 0; i <= MOCK_BLOCK_COUNT / 2; i++)
+		mock_flash[MOCK_REGION_OFFSET + i * MOCK_BLOCK_SIZE] ^= 1;
+
+	assert_int_equal(update_diff(), 1);
+	assert_int_equal(mock_erase_count, 0);
+	assert_int_equal(mock_write_count, 0);
+}
+
+static void test_update_diff_unaligned_region(void **state)
+{
+	assert_int_equal(ec_flash_update_diff(&mock_ec, mock_image,
+					      sizeof(mock_image),
+					      MOCK_REGION_OFFSET + 1,
+					      MOCK_REGION_SIZE), -1);
+	assert_int_equal(mock_erase_count, 0);
+}
+
+#define TEST(test_function_name) \
+	cmocka_unit_test_setup(test_function_name, setup)
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		TEST(test_update_diff_unchanged),
+		TEST(test_update_diff_one_block),
+		TEST(test_update_diff_last_image_block),
+		TEST(test_update_diff_zeroes_past_image),
+		TEST(test_update_diff_erase_to_0),
+		TEST(test_update_diff_too_many_changes),
+		TEST(test_update_diff_unaligned_region),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
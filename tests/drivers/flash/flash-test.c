@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+#include <string.h>
+
+#include "drivers/flash/flash.h"
+#include "tests/test.h"
+
+#define SECTOR_SIZE 0x100
+#define FLASH_SIZE (8 * SECTOR_SIZE)
+
+/* Mocks */
+
+static uint8_t flash_data[FLASH_SIZE];
+static int erase_count;
+static int write_count;
+static int drop_writes;
+
+static int ram_read(struct FlashOps *me, void *buffer, uint32_t offset,
+		    uint32_t size)
+{
+	memcpy(buffer, flash_data + offset, size);
+	return size;
+}
+
+static int ram_write(struct FlashOps *me, const void *buffer, uint32_t offset,
+		     uint32_t size)
+{
+	check_expected(offset);
+	check_expected(size);
+	write_count++;
+	if (!drop_writes)
+		memcpy(flash_data + offset, buffer, size);
+	return size;
+}
+
+static int ram_erase(struct FlashOps *me, uint32_t offset, uint32_t size)
+{
+	check_expected(offset);
+	check_expected(size);
+	erase_count++;
+	memset(flash_data + offset, 0xff, size);
+	return size;
+}
+
+static FlashOps ram_ops = {
+	.read = ram_read,
+	.write = ram_write,
+	.erase = ram_erase,
+	.sector_size = SECTOR_SIZE,
+};
+
+static int setup(void **state)
+{
+	for (int i = 0; i < FLASH_SIZE; i++)
+		flash_data[i] = i & 0xff;
+	erase_count = 0;
+	write_count = 0;
+	drop_writes = 0;
+	return 0;
+}
+
+#define WILL_REWRITE(off, len) do { \
+	expect_value(ram_erase, offset, off); \
+	expect_value(ram_erase, size, len); \
+	expect_value(ram_write, offset, off); \
+	expect_value(ram_write, size, len); \
+} while (0)
+
+/* Tests */
+
+static void test_rewrite_diff_unchanged(void **state)
+{
+	uint8_t buf[2 * SECTOR_SIZE];
+
+	memcpy(buf, flash_data + SECTOR_SIZE, sizeof(buf));
+	assert_int_equal(flash_rewrite_diff_ops(&ram_ops, buf, SECTOR_SIZE,
+						sizeof(buf)), sizeof(buf));
+	assert_int_equal(erase_count, 0);
+	assert_int_equal(write_count, 0);
+}
+
+static void test_rewrite_diff_one_sector(void **state)
+{
+	uint8_t buf[4 * SECTOR_SIZE];
+
+	memcpy(buf, flash_data, sizeof(buf));
+	buf[2 * SECTOR_SIZE + 5] ^= 0xff;
+
+	WILL_REWRITE(2 * SECTOR_SIZE, SECTOR_SIZE);
+	assert_int_equal(flash_rewrite_diff_ops(&ram_ops, buf, 0, sizeof(buf)),
+			 sizeof(buf));
+	assert_memory_equal(flash_data, buf, sizeof(buf));
+	assert_int_equal(erase_count, 1);
+}
+
+static void test_rewrite_diff_runs(void **state)
+{
+	uint8_t buf[FLASH_SIZE];
+
+	memcpy(buf, flash_data, sizeof(buf));
+	buf[1 * SECTOR_SIZE] ^= 0xff;
+	buf[2 * SECTOR_SIZE] ^= 0xff;
+	buf[6 * SECTOR_SIZE - 1] ^= 0xff;
+
+	WILL_REWRITE(1 * SECTOR_SIZE, 2 * SECTOR_SIZE);
+	WILL_REWRITE(5 * SECTOR_SIZE, SECTOR_SIZE);
+	assert_int_equal(flash_rewrite_diff_ops(&ram_ops, buf, 0, sizeof(buf)),
+			 sizeof(buf));
+	assert_memory_equal(flash_data, buf, sizeof(buf));
+}
+
+static void test_rewrite_diff_unaligned(void **state)
+{
+	uint8_t old[FLASH_SIZE];
+	uint8_t buf[0x20];
+	const uint32_t start = 3 * SECTOR_SIZE - 0x10;
+
+	memcpy(old, flash_data, sizeof(old));
+	memset(buf, 0xa5, sizeof(buf));
+
+	WILL_REWRITE(2 * SECTOR_SIZE, 2 * SECTOR_SIZE);
+	assert_int_equal(flash_rewrite_diff_ops(&ram_ops, buf, start,
+						sizeof(buf)), sizeof(buf));
+	assert_memory_equal(flash_data + start, buf, sizeof(buf));
+	/* The rest of the touched sectors must be preserved */
+	assert_memory_equal(flash_data, old, start);
+	assert_memory_equal(flash_data + start + sizeof(buf),
+			    old + start + sizeof(buf),
+			    FLASH_SIZE - start - sizeof(buf));
+}
+
+static void test_rewrite_diff_verify_fail(void **state)
+{
+	uint8_t buf[SECTOR_SIZE];
+
+	memset(buf, 0, sizeof(buf));
+	drop_writes = 1;
+
+	WILL_REWRITE(0, SECTOR_SIZE);
+	assert_int_equal(flash_rewrite_diff_ops(&ram_ops, buf, 0, sizeof(buf)),
+			 -1);
+}
+
+#define FLASH_TEST(func) cmocka_unit_test_setup(func, setup)
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		FLASH_TEST(test_rewrite_diff_unchanged),
+		FLASH_TEST(test_rewrite_diff_one_sector),
+		FLASH_TEST(test_rewrite_diff_runs),
+		FLASH_TEST(test_rewrite_diff_unaligned),
+		FLASH_TEST(test_rewrite_diff_verify_fail),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+#include <stdio.h>
+
+#include "drivers/storage/block_cache.h"
+#include "drivers/storage/blockdev.h"
+#include "tests/test.h"
+
+#define TEST_STORAGE_BLOCK_SIZE 16
+#define TEST_STORAGE_BLOCKS 64
+#define TEST_STORAGE_SIZE (TEST_STORAGE_BLOCK_SIZE * TEST_STORAGE_BLOCKS)
+/* Room for 8 blocks, reads of up to 4 blocks are cached */
+#define TEST_CACHE_BYTES (TEST_STORAGE_BLOCK_SIZE * 8)
+
+static BlockDev test_parent_dev;
+static char test_storage[TEST_STORAGE_SIZE];
+static int parent_reads;
+static int parent_writes;
+static int parent_erases;
+
+static lba_t test_read(struct BlockDevOps *me, lba_t start, lba_t count, void *buffer)
+{
+	BlockDev *blockdev = (BlockDev *)me;
+
+	assert_ptr_equal(blockdev, &test_parent_dev);
+	assert_true(start <= blockdev->block_count);
+	assert_true(count <= blockdev->block_count - start);
+
+	parent_reads++;
+	memcpy(buffer, test_storage + blockdev->block_size * start,
+	       blockdev->block_size * count);
+
+	return count;
+}
+
+static lba_t test_write(struct BlockDevOps *me, lba_t start, lba_t count,
+			const void *buffer)
+{
+	BlockDev *blockdev = (BlockDev *)me;
+
+	assert_ptr_equal(blockdev, &test_parent_dev);
+	assert_true(start <= blockdev->block_count);
+	assert_true(count <= blockdev->block_count - start);
+
+	parent_writes++;
+	memcpy(test_storage + blockdev->block_size * start, buffer,
+	       blockdev->block_size * count);
+
+	return count;
+}
+
+static lba_t test_erase(struct BlockDevOps *me, lba_t start, lba_t count)
+{
+	BlockDev *blockdev = (BlockDev *)me;
+
+	assert_ptr_equal(blockdev, &test_parent_dev);
+
+	parent_erases++;
+	memset(test_storage + blockdev->block_size * start, 0xff,
+	       blockdev->block_size * count);
+
+	return count;
+}
+
+static int test_get_health_info(struct BlockDevOps *me, struct HealthInfo *info)
+{
+	/* Drivers look up their state from the ops they are called with */
+	assert_ptr_equal(me, &test_parent_dev.ops);
+	assert_ptr_equal(info, (void *)0x1234);
+
+	return 42;
+}
+
+static int test_get_test_log(struct BlockDevOps *me,
+			     enum BlockDevTestOpsType ops,
+			     struct StorageTestLog *result)
+{
+	assert_ptr_equal(me, &test_parent_dev.ops);
+	assert_int_equal(ops, BLOCKDEV_TEST_OPS_TYPE_SHORT);
+	assert_ptr_equal(result, (void *)0x5678);
+
+	return 43;
+}
+
+static int test_test_control(struct BlockDevOps *me,
+			     enum BlockDevTestOpsType ops)
+{
+	assert_ptr_equal(me, &test_parent_dev.ops);
+	assert_int_equal(ops, BLOCKDEV_TEST_OPS_TYPE_EXTENDED);
+
+	return 44;
+}
+
+static uint32_t test_test_support(void)
+{
+	return BLOCKDEV_TEST_OPS_TYPE_SHORT;
+}
+
+static int setup(void **state)
+{
+	test_parent_dev.name = "parent";
+	test_parent_dev.block_size = TEST_STORAGE_BLOCK_SIZE;
+	test_parent_dev.block_count = TEST_STORAGE_BLOCKS;
+	test_parent_dev.ops.read = &test_read;
+	test_parent_dev.ops.write = &test_write;
+	test_parent_dev.ops.erase = &test_erase;
+	test_parent_dev.ops.new_stream = &new_simple_stream;
+	test_parent_dev.ops.get_health_info = &test_get_health_info;
+	test_parent_dev.ops.get_test_log = &test_get_test_log;
+	test_parent_dev.ops.test_control = &test_test_control;
+	test_parent_dev.ops.test_support = &test_test_support;
+
+	parent_reads = 0;
+	parent_writes = 0;
+	parent_erases = 0;
+
+	for (int i = 0; i < TEST_STORAGE_SIZE; i++)
+		test_storage[i] = i & 0xff;
+
+	*state = new_blockdev_cache(&test_parent_dev, TEST_CACHE_BYTES);
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	free_blockdev_cache(*state);
+
+	return 0;
+}
+
+#define READ_AND_CHECK(cache, start, count) do { \
+	char _buf[TEST_STORAGE_BLOCK_SIZE * (count)]; \
+	assert_int_equal((cache)->ops.read(&(cache)->ops, start, count, _buf), \
+			 count); \
+	assert_memory_equal(_buf, test_storage + \
+			    TEST_STORAGE_BLOCK_SIZE * (start), sizeof(_buf)); \
+} while (0)
+
+static void test_cache_creation(void **state)
+{
+	BlockDev *cache = *state;
+
+	assert_string_equal(cache->name, test_parent_dev.name);
+	assert_int_equal(cache->block_size, test_parent_dev.block_size);
+	assert_int_equal(cache->block_count, test_parent_dev.block_count);
+	assert_non_null(cache->ops.read);
+	assert_non_null(cache->ops.write);
+	assert_non_null(cache->ops.erase);
+	assert_non_null(cache->ops.new_stream);
+	assert_non_null(cache->ops.get_health_info);
+	assert_non_null(cache->ops.get_test_log);
+	assert_non_null(cache->ops.test_control);
+	assert_non_null(cache->ops.test_support);
+}
+
+static void test_cache_health_info(void **state)
+{
+	BlockDev *cache = *state;
+
+	assert_int_equal(cache->ops.get_health_info(&cache->ops,
+						    (void *)0x1234), 42);
+}
+
+static void test_cache_test_ops(void **state)
+{
+	BlockDev *cache = *state;
+
+	assert_int_equal(cache->ops.get_test_log(&cache->ops,
+						 BLOCKDEV_TEST_OPS_TYPE_SHORT,
+						 (void *)0x5678), 43);
+	assert_int_equal(cache->ops.test_control(&cache->ops,
+						 BLOCKDEV_TEST_OPS_TYPE_EXTENDED),
+			 44);
+	assert_int_equal(cache->ops.test_support(),
+			 BLOCKDEV_TEST_OPS_TYPE_SHORT);
+}
+
+static void test_cache_missing_ops(void **state)
+{
+	BlockDev parent = test_parent_dev;
+	BlockDev *cache;
+
+	parent.ops.erase = NULL;
+	parent.ops.get_health_info = NULL;
+	parent.ops.get_test_log = NULL;
+	parent.ops.test_control = NULL;
+	parent.ops.test_support = NULL;
+	cache = new_blockdev_cache(&parent, TEST_CACHE_BYTES);
+
+	assert_null(cache->ops.erase);
+	assert_null(cache->ops.get_health_info);
+	assert_null(cache->ops.get_test_log);
+	assert_null(cache->ops.test_control);
+	assert_null(cache->ops.test_support);
+
+	free_blockdev_cache(cache);
+}
+
+static void test_cache_repeated_reads(void **state)
+{
+	BlockDev *cache = *state;
+	const BlockDevCacheStats *stats = blockdev_cache_stats(cache);
+
+	READ_AND_CHECK(cache, 1, 2);
+	READ_AND_CHECK(cache, 1, 2);
+	READ_AND_CHECK(cache, 2, 1);
+	READ_AND_CHECK(cache, 1, 1);
+
+	assert_int_equal(parent_reads, 1);
+	assert_int_equal(stats->misses, 1);
+	assert_int_equal(stats->hits, 3);
+
+	/* Partially cached range is read from the device as a whole */
+	READ_AND_CHECK(cache, 2, 3);
+	assert_int_equal(parent_reads, 2);
+	READ_AND_CHECK(cache, 1, 4);
+	assert_int_equal(parent_reads, 2);
+	assert_int_equal(stats->misses, 2);
+	assert_int_equal(stats->hits, 4);
+}
+
+static void test_cache_large_reads_bypass(void **state)
+{
+	BlockDev *cache = *state;
+	const BlockDevCacheStats *stats = blockdev_cache_stats(cache);
+
+	READ_AND_CHECK(cache, 0, 5);
+	READ_AND_CHECK(cache, 0, 5);
+
+	assert_int_equal(parent_reads, 2);
+	assert_int_equal(stats->uncached, 2);
+	assert_int_equal(stats->hits, 0);
+	assert_int_equal(stats->misses, 0);
+}
+
+static void test_cache_lru_eviction(void **state)
+{
+	BlockDev *cache = *state;
+	const BlockDevCacheStats *stats = blockdev_cache_stats(cache);
+
+	READ_AND_CHECK(cache, 0, 4);
+	READ_AND_CHECK(cache, 10, 4);
+	/* Touch blocks 0-1 so that 2-3 are the least recently used */
+	READ_AND_CHECK(cache, 0, 2);
+	READ_AND_CHECK(cache, 20, 2);
+	assert_int_equal(parent_reads, 3);
+	assert_int_equal(stats->evictions, 2);
+
+	READ_AND_CHECK(cache, 0, 2);
+	READ_AND_CHECK(cache, 10, 4);
+	assert_int_equal(parent_reads, 3);
+
+	READ_AND_CHECK(cache, 2, 2);
+	assert_int_equal(parent_reads, 4);
+}
+
+static void test_cache_write_through(void **state)
+{
+	BlockDev *cache = *state;
+	char buf[TEST_STORAGE_BLOCK_SIZE * 2];
+
+	READ_AND_CHECK(cache, 4, 4);
+
+	memset(buf, 0xa5, sizeof(buf));
+	assert_int_equal(cache->ops.write(&cache->ops, 5, 2, buf), 2);
+	assert_int_equal(parent_writes, 1);
+	assert_memory_equal(test_storage + TEST_STORAGE_BLOCK_SIZE * 5, buf,
+			    sizeof(buf));
+
+	/* Written blocks are updated in the cache */
+	READ_AND_CHECK(cache, 4, 4);
+	assert_int_equal(parent_reads, 1);
+
+	/* Large writes update cached blocks too */
+	char big[TEST_STORAGE_BLOCK_SIZE * 16];
+	memset(big, 0x3c, sizeof(big));
+	assert_int_equal(cache->ops.write(&cache->ops, 0, 16, big), 16);
+	READ_AND_CHECK(cache, 4, 4);
+	assert_int_equal(parent_reads, 1);
+}
+
+static void test_cache_erase_invalidates(void **state)
+{
+	BlockDev *cache = *state;
+
+	READ_AND_CHECK(cache, 4, 4);
+	assert_int_equal(cache->ops.erase(&cache->ops, 6, 1), 1);
+	assert_int_equal(parent_erases, 1);
+
+	READ_AND_CHECK(cache, 4, 2);
+	assert_int_equal(parent_reads, 1);
+	READ_AND_CHECK(cache, 6, 1);
+	assert_int_equal(parent_reads, 2);
+}
+
+static void test_cache_stream(void **state)
+{
+	BlockDev *cache = *state;
+	char buf[TEST_STORAGE_BLOCK_SIZE + 4];
+	StreamOps *stream;
+
+	/* Stream window is read through the cache */
+	for (int i = 0; i < 2; i++) {
+		stream = cache->ops.new_stream(&cache->ops, 8, 2);
+		assert_int_equal(stream->read(stream, sizeof(buf), buf),
+				 sizeof(buf));
+		assert_memory_equal(buf, test_storage + TEST_STORAGE_BLOCK_SIZE * 8,
+				    sizeof(buf));
+		stream->close(stream);
+	}
+
+	assert_int_equal(parent_reads, 1);
+}
+
+#define TEST(test_function_name) \
+	cmocka_unit_test_setup_teardown(test_function_name, setup, teardown)
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		TEST(test_cache_creation),
+		TEST(test_cache_health_info),
+		TEST(test_cache_test_ops),
+		TEST(test_cache_missing_ops),
+		TEST(test_cache_repeated_reads),
+		TEST(test_cache_large_reads_bypass),
+		TEST(test_cache_lru_eviction),
+		TEST(test_cache_write_through),
+		TEST(test_cache_erase_invalidates),
+		TEST(test_cache_stream),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -3,6 +3,7 @@
 #include <libpayload.h>
 
 #include "drivers/storage/blockdev.h"
+#include "drivers/storage/bouncebuf.h"
 #include "tests/test.h"
 
 #define TEST_STORAGE_SIZE 256
@@ -11,11 +12,14 @@
 
 static BlockDev test_block_dev;
 static char test_storage[TEST_STORAGE_SIZE];
+static int test_read_calls;
 
 static lba_t test_read(struct BlockDevOps *me, lba_t start, lba_t count, void *buffer)
 {
 	BlockDev *blockdev = (BlockDev *)me;
 
+	test_read_calls++;
+
 	assert_ptr_equal(blockdev, &test_block_dev);
 	assert_in_range(start, 0, blockdev->block_count);
 	assert_in_range(start + count, 0, blockdev->block_count);
@@ -32,6 +36,7 @@ static int setup(void **state)
 	test_block_dev.block_count = TEST_STORAGE_SIZE / TEST_STORAGE_BLOCK_SIZE;
 	test_block_dev.ops.read = &test_read;
 	test_block_dev.ops.new_stream = &new_simple_stream;
+	test_read_calls = 0;
 
 	for (int i = 0; i < TEST_STORAGE_SIZE; i++)
 		test_storage[i] = i & 0xff;
@@ -180,8 +185,300 @@ static void test_simple_stream_read_over_the_end(void **state)
 	assert_filled_with(buf.after, SENTINEL, sizeof(buf.after));
 }
 
+static void test_simple_stream_read_ahead(void **state)
+{
+	char buf[TEST_STORAGE_BLOCK_SIZE * 2];
+	StreamOps *stream = test_block_dev.ops.new_stream(&test_block_dev.ops, 2, 10);
+	const char *expected = test_storage + TEST_STORAGE_BLOCK_SIZE * 2;
+
+	/* Header-sized reads are all served from a single device read */
+	assert_int_equal(stream->read(stream, 3, buf), 3);
+	assert_memory_equal(buf, expected, 3);
+	assert_int_equal(stream->read(stream, 5, buf), 5);
+	assert_memory_equal(buf, expected + 3, 5);
+	assert_int_equal(stream->read(stream, sizeof(buf), buf), sizeof(buf));
+	assert_memory_equal(buf, expected + 8, sizeof(buf));
+	assert_int_equal(stream->read(stream, 7, buf), 7);
+	assert_memory_equal(buf, expected + 8 + sizeof(buf), 7);
+	stream->close(stream);
+
+	assert_int_equal(test_read_calls, 1);
+}
+
+static void test_simple_stream_skip_does_not_read(void **state)
+{
+	char buf[4];
+	StreamOps *stream = new_simple_stream_window(&test_block_dev.ops, 0, 16, 2);
+
+	assert_int_equal(stream->skip(stream, TEST_STORAGE_BLOCK_SIZE * 5 + 1),
+			 TEST_STORAGE_BLOCK_SIZE * 5 + 1);
+	assert_int_equal(test_read_calls, 0);
+
+	assert_int_equal(stream->read(stream, sizeof(buf), buf), sizeof(buf));
+	assert_memory_equal(buf, test_storage + TEST_STORAGE_BLOCK_SIZE * 5 + 1,
+			    sizeof(buf));
+	assert_int_equal(test_read_calls, 1);
+
+	/* Skipping within the window keeps it */
+	assert_int_equal(stream->skip(stream, 8), 8);
+	assert_int_equal(stream->read(stream, sizeof(buf), buf), sizeof(buf));
+	assert_memory_equal(buf, test_storage + TEST_STORAGE_BLOCK_SIZE * 5 + 13,
+			    sizeof(buf));
+	assert_int_equal(test_read_calls, 1);
+
+	/* Skipping past the window refills it on the next read only */
+	assert_int_equal(stream->skip(stream, TEST_STORAGE_BLOCK_SIZE * 4),
+			 TEST_STORAGE_BLOCK_SIZE * 4);
+	assert_int_equal(test_read_calls, 1);
+	assert_int_equal(stream->read(stream, sizeof(buf), buf), sizeof(buf));
+	assert_memory_equal(buf, test_storage + TEST_STORAGE_BLOCK_SIZE * 9 + 17,
+			    sizeof(buf));
+	assert_int_equal(test_read_calls, 2);
+
+	stream->close(stream);
+}
+
+static void test_simple_stream_large_read_bypasses_window(void **state)
+{
+	char buf[TEST_STORAGE_BLOCK_SIZE * 9];
+	StreamOps *stream = new_simple_stream_window(&test_block_dev.ops, 0, 16, 2);
+
+	/* Unaligned head goes through the window, the rest straight to buf */
+	assert_int_equal(stream->skip(stream, TEST_STORAGE_BLOCK_SIZE - 3),
+			 TEST_STORAGE_BLOCK_SIZE - 3);
+	assert_int_equal(stream->read(stream, sizeof(buf), buf), sizeof(buf));
+	assert_memory_equal(buf, test_storage + TEST_STORAGE_BLOCK_SIZE - 3,
+			    sizeof(buf));
+	stream->close(stream);
+
+	/* Window fill for blocks 0-1, blocks 2-8 direct, window fill from 9 */
+	assert_int_equal(test_read_calls, 3);
+}
+
+typedef struct {
+	BlockDevCtrlr ctrlr;
+	char id;
+} TestCtrlr;
+
+static char ctrlr_log[16];
+
+static void log_ctrlr_call(BlockDevCtrlrOps *me, char op)
+{
+	TestCtrlr *test_ctrlr = container_of(me, TestCtrlr, ctrlr.ops);
+	size_t len = strlen(ctrlr_log);
+
+	assert_true(len + 2 < sizeof(ctrlr_log));
+	ctrlr_log[len] = op;
+	ctrlr_log[len + 1] = test_ctrlr->id;
+}
+
+static int test_ctrlr_kick(BlockDevCtrlrOps *me)
+{
+	log_ctrlr_call(me, 'k');
+	return 0;
+}
+
+static int test_ctrlr_update(BlockDevCtrlrOps *me)
+{
+	TestCtrlr *test_ctrlr = container_of(me, TestCtrlr, ctrlr.ops);
+
+	log_ctrlr_call(me, 'u');
+	test_ctrlr->ctrlr.need_update = 0;
+	return 0;
+}
+
+static void test_get_all_bdevs_kicks_fixed_ctrlrs_first(void **state)
+{
+	TestCtrlr ctrlrs[] = {
+		{ .ctrlr.ops.kick = test_ctrlr_kick, .id = 'A' },
+		{ .ctrlr.ops.kick = test_ctrlr_kick, .id = 'B' },
+		{ .id = 'C' },
+	};
+	struct list_node *prev = &fixed_block_dev_controllers;
+
+	memset(ctrlr_log, 0, sizeof(ctrlr_log));
+	for (int i = 0; i < ARRAY_SIZE(ctrlrs); i++) {
+		ctrlrs[i].ctrlr.ops.update = test_ctrlr_update;
+		ctrlrs[i].ctrlr.need_update = 1;
+		list_insert_after(&ctrlrs[i].ctrlr.list_node, prev);
+		prev = &ctrlrs[i].ctrlr.list_node;
+	}
+
+	assert_int_equal(get_all_bdevs(BLOCKDEV_FIXED, NULL), 0);
+	assert_string_equal(ctrlr_log, "kAkBuAuBuC");
+
+	/* Nothing left to do on the next call */
+	assert_int_equal(get_all_bdevs(BLOCKDEV_FIXED, NULL), 0);
+	assert_string_equal(ctrlr_log, "kAkBuAuBuC");
+
+	for (int i = 0; i < ARRAY_SIZE(ctrlrs); i++)
+		list_remove(&ctrlrs[i].ctrlr.list_node);
+}
+
+static void test_get_all_bdevs_removable_not_kicked(void **state)
+{
+	TestCtrlr ctrlr = {
+		.ctrlr.ops.kick = test_ctrlr_kick,
+		.ctrlr.ops.update = test_ctrlr_update,
+		.ctrlr.need_update = 1,
+		.id = 'R',
+	};
+
+	memset(ctrlr_log, 0, sizeof(ctrlr_log));
+	list_insert_after(&ctrlr.ctrlr.list_node, &removable_block_dev_controllers);
+
+	assert_int_equal(get_all_bdevs(BLOCKDEV_REMOVABLE, NULL), 0);
+	assert_string_equal(ctrlr_log, "uR");
+
+	list_remove(&ctrlr.ctrlr.list_node);
+}
+
+#define SPLIT_BLOCK_SIZE 512
+#define SPLIT_BLOCKS 8
+#define SPLIT_MAX_CALLS 4
+
+int dma_coherent(const void *ptr)
+{
+	return 0;
+}
+
+static struct {
+	lba_t start;
+	lba_t count;
+	uintptr_t buffer;
+	unsigned int bbflags;
+} split_calls[SPLIT_MAX_CALLS];
+static int split_ncalls;
+static uint8_t split_storage[SPLIT_BLOCK_SIZE * SPLIT_BLOCKS];
+
+static lba_t test_split_rw(BlockDevOps *me, lba_t start, lba_t count,
+			   void *buffer, bool read, unsigned int bbflags)
+{
+	assert_ptr_equal(me, &test_block_dev.ops);
+	assert_in_range(split_ncalls, 0, SPLIT_MAX_CALLS - 1);
+	assert_in_range(start + count, 1, SPLIT_BLOCKS);
+
+	split_calls[split_ncalls].start = start;
+	split_calls[split_ncalls].count = count;
+	split_calls[split_ncalls].buffer = (uintptr_t)buffer;
+	split_calls[split_ncalls].bbflags = bbflags;
+	split_ncalls++;
+
+	if (read)
+		memcpy(buffer, split_storage + start * SPLIT_BLOCK_SIZE,
+		       count * SPLIT_BLOCK_SIZE);
+	else
+		memcpy(split_storage + start * SPLIT_BLOCK_SIZE, buffer,
+		       count * SPLIT_BLOCK_SIZE);
+	return count;
+}
+
+static int setup_split(void **state)
+{
+	memset(&test_block_dev, 0, sizeof(test_block_dev));
+	test_block_dev.block_size = SPLIT_BLOCK_SIZE;
+	test_block_dev.block_count = SPLIT_BLOCKS;
+	split_ncalls = 0;
+
+	for (int i = 0; i < sizeof(split_storage); i++)
+		split_storage[i] = (i * 7) & 0xff;
+
+	return 0;
+}
+
+static void test_split_rw_read_misaligned(void **state)
+{
+	const size_t size = SPLIT_BLOCK_SIZE * 6;
+	uint8_t *mem = memalign(ARCH_DMA_MINALIGN, size + ARCH_DMA_MINALIGN);
+	uint8_t *buf = mem + 4;
+
+	assert_int_equal(blockdev_split_rw(&test_block_dev.ops, 1, 6, buf, true,
+					   &test_split_rw), 6);
+
+	assert_memory_equal(buf, split_storage + SPLIT_BLOCK_SIZE, size);
+	assert_int_equal(split_ncalls, 3);
+	/* Middle blocks go straight into the caller's buffer */
+	assert_int_equal(split_calls[0].start, 2);
+	assert_int_equal(split_calls[0].count, 4);
+	assert_int_equal(split_calls[0].buffer,
+			 (uintptr_t)buf + SPLIT_BLOCK_SIZE);
+	assert_int_equal(split_calls[0].bbflags, GEN_BB_INPLACE);
+	/* Edges go through an aligned block */
+	assert_int_equal(split_calls[1].start, 1);
+	assert_int_equal(split_calls[1].count, 1);
+	assert_int_equal(split_calls[1].buffer % ARCH_DMA_MINALIGN, 0);
+	assert_int_equal(split_calls[1].bbflags, 0);
+	assert_int_equal(split_calls[2].start, 6);
+	assert_int_equal(split_calls[2].count, 1);
+	assert_int_equal(split_calls[2].buffer % ARCH_DMA_MINALIGN, 0);
+	assert_int_equal(split_calls[2].bbflags, 0);
+
+	assert_int_equal(test_block_dev.dma_bytes, size);
+	assert_int_equal(test_block_dev.bounced_bytes, 2 * SPLIT_BLOCK_SIZE);
+
+	free(mem);
+}
+
+static void test_split_rw_read_aligned(void **state)
+{
+	const size_t size = SPLIT_BLOCK_SIZE * 6;
+	uint8_t *buf = memalign(ARCH_DMA_MINALIGN, size);
+
+	assert_int_equal(blockdev_split_rw(&test_block_dev.ops, 0, 6, buf, true,
+					   &test_split_rw), 6);
+
+	assert_memory_equal(buf, split_storage, size);
+	assert_int_equal(split_ncalls, 1);
+	assert_int_equal(split_calls[0].buffer, (uintptr_t)buf);
+	assert_int_equal(split_calls[0].bbflags, 0);
+	assert_int_equal(test_block_dev.dma_bytes, size);
+	assert_int_equal(test_block_dev.bounced_bytes, 0);
+
+	free(buf);
+}
+
+static void test_split_rw_read_unaligned_word(void **state)
+{
+	const size_t size = SPLIT_BLOCK_SIZE * 6;
+	uint8_t *mem = memalign(ARCH_DMA_MINALIGN, size + ARCH_DMA_MINALIGN);
+	uint8_t *buf = mem + 1;
+
+	assert_int_equal(blockdev_split_rw(&test_block_dev.ops, 0, 6, buf, true,
+					   &test_split_rw), 6);
+
+	/* Driver has to bounce the whole transfer */
+	assert_memory_equal(buf, split_storage, size);
+	assert_int_equal(split_ncalls, 1);
+	assert_int_equal(split_calls[0].bbflags, 0);
+	assert_int_equal(test_block_dev.bounced_bytes, size);
+
+	free(mem);
+}
+
+static void test_split_rw_write_misaligned(void **state)
+{
+	const size_t size = SPLIT_BLOCK_SIZE * 4;
+	uint8_t *mem = memalign(ARCH_DMA_MINALIGN, size + ARCH_DMA_MINALIGN);
+	uint8_t *buf = mem + 8;
+
+	memset(buf, 0xa5, size);
+	assert_int_equal(blockdev_split_rw(&test_block_dev.ops, 2, 4, buf, false,
+					   &test_split_rw), 4);
+
+	assert_memory_equal(split_storage + 2 * SPLIT_BLOCK_SIZE, buf, size);
+	assert_int_equal(split_ncalls, 1);
+	assert_int_equal(split_calls[0].buffer, (uintptr_t)buf);
+	assert_int_equal(split_calls[0].bbflags, GEN_BB_INPLACE);
+	assert_int_equal(test_block_dev.dma_bytes, size);
+	assert_int_equal(test_block_dev.bounced_bytes, 0);
+
+	free(mem);
+}
+
 #define TEST(test_function_name) \
 	cmocka_unit_test_setup(test_function_name, setup)
+#define TEST_SPLIT(test_function_name) \
+	cmocka_unit_test_setup(test_function_name, setup_split)
 
 int main(void)
 {
@@ -191,6 +488,15 @@ int main(void)
 		TEST(test_simple_stream_read_beginning_not_aligned),
 		TEST(test_simple_stream_read_multiple_not_aligned),
 		TEST(test_simple_stream_read_over_the_end),
+		TEST(test_simple_stream_read_ahead),
+		TEST(test_simple_stream_skip_does_not_read),
+		TEST(test_simple_stream_large_read_bypasses_window),
+		cmocka_unit_test(test_get_all_bdevs_kicks_fixed_ctrlrs_first),
+		cmocka_unit_test(test_get_all_bdevs_removable_not_kicked),
+		TEST_SPLIT(test_split_rw_read_misaligned),
+		TEST_SPLIT(test_split_rw_read_aligned),
+		TEST_SPLIT(test_split_rw_read_unaligned_word),
+		TEST_SPLIT(test_split_rw_write_misaligned),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
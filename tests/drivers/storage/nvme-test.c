@@ -57,10 +57,21 @@ struct {
 
 struct {
 	bool malicious_sqhd;
+	// Complete IO commands only once the host polls the CQ
+	bool defer_completion;
 	uint8_t mdts;
 	uint32_t last_sq_tail[NVME_NUM_QUEUES];
 } fake_device_behavior;
 
+// Counters of the fake device, reset after controller init
+struct {
+	int sq_doorbells[NVME_NUM_QUEUES];
+	int cq_doorbells[NVME_NUM_QUEUES];
+	int max_outstanding[NVME_NUM_QUEUES];
+	int io_cmds;
+	int prp_chains;
+} fake_stats;
+
 // Define the global cleanup_funcs list to resolve link errors
 struct list_node cleanup_funcs;
 
@@ -129,6 +140,44 @@ void init_fake_regs(void)
 	fake_regs.cap = 0x200101003fULL;
 }
 
+// Fill each 512-byte block with its LBA, following PRP1, PRP2 and chained PRP lists
+static void fake_dma_read_data(NVME_SQ *sq)
+{
+	uint64_t slba = sq->cdw10 | ((uint64_t)sq->cdw11 << 32);
+	size_t len = ((sq->cdw12 & 0xffff) + 1) * 512;
+	uint8_t *page = (uint8_t *)(uintptr_t)sq->prp[0];
+	size_t offset = (uintptr_t)page & (NVME_PAGE_SIZE - 1);
+	size_t page_len = NVME_PAGE_SIZE - offset;
+	uint64_t *list = NULL;
+	size_t entry = 0;
+	size_t done = 0;
+
+	if (len + offset > 2 * NVME_PAGE_SIZE)
+		list = (uint64_t *)(uintptr_t)sq->prp[1];
+
+	while (1) {
+		size_t n = MIN(page_len, len - done);
+		for (size_t i = 0; i < n; i++)
+			page[i] = (uint8_t)(slba + (done + i) / 512);
+		done += n;
+		if (done >= len)
+			break;
+
+		page_len = NVME_PAGE_SIZE;
+		if (!list) {
+			page = (uint8_t *)(uintptr_t)sq->prp[1];
+			continue;
+		}
+		if (entry == PRP_ENTRIES_PER_LIST - 1 &&
+		    len - done > NVME_PAGE_SIZE) {
+			list = (uint64_t *)(uintptr_t)list[entry];
+			entry = 0;
+			fake_stats.prp_chains++;
+		}
+		page = (uint8_t *)(uintptr_t)list[entry++];
+	}
+}
+
 // Process single fake command and write completion (accepts expected host phase tag)
 static void handle_fake_device_command(int qid, uint32_t sq_idx, NVME_SQ *sq, uint16_t expected_host_pt)
 {
@@ -159,6 +208,9 @@ static void handle_fake_device_command(int qid, uint32_t sq_idx, NVME_SQ *sq, ui
 				id_ns->lba_format[0].lbads = 9; // LBAF0: 512 bytes (2^9)
 			}
 		}
+	} else if (sq->opc == NVME_IO_READ_OPC) {
+		fake_stats.io_cmds++;
+		fake_dma_read_data(sq);
 	}
 
 	// Prepare completion entry
@@ -184,6 +236,27 @@ static void handle_fake_device_command(int qid, uint32_t sq_idx, NVME_SQ *sq, ui
 	cq_entry->flags = ((expected_host_pt ^ 1) & NVME_CQ_FLAGS_PHASE);
 }
 
+// Complete all commands between the last processed SQ tail and the doorbell value
+static void process_fake_commands(int qid)
+{
+	uint32_t prev_tail = fake_device_behavior.last_sq_tail[qid];
+	uint32_t new_tail = fake_regs.sqtdbl[qid];
+	size_t sq_size = (qid == NVME_ADMIN_QUEUE_INDEX) ? 2 : current_ctrlr->iosq_sz;
+	size_t cq_size = sq_size;
+	uint32_t idx = prev_tail;
+	uint16_t expected_host_pt = current_ctrlr->pt[qid];
+	while (idx != new_tail) {
+		NVME_SQ *sq_entry = &current_ctrlr->sq_buffer[qid][idx];
+		handle_fake_device_command(qid, idx, sq_entry, expected_host_pt);
+		// Track host-side phase tag flip on queue wrap-around
+		if (idx == cq_size - 1) {
+			expected_host_pt ^= 1;
+		}
+		idx = (idx + 1) % sq_size;
+	}
+	fake_device_behavior.last_sq_tail[qid] = new_tail;
+}
+
 // MMIO Read Mock with correct volatile signatures
 uint32_t mock_read32(volatile const void *addr)
 {
@@ -250,28 +323,19 @@ void mock_write32(volatile void *addr, uint32_t val)
 		for (int qid = 0; qid < NVME_NUM_QUEUES; qid++) {
 			if (offset == NVME_SQTDBL_OFFSET(qid, dstrd)) {
 				fake_regs.sqtdbl[qid] = val;
+				fake_stats.sq_doorbells[qid]++;
 				print_message("mock_write32: SQTDBL write for qid %d, val %d (prev_tail %d)\n", qid, val, fake_device_behavior.last_sq_tail[qid]);
-				// Process new commands!
-				uint32_t prev_tail = fake_device_behavior.last_sq_tail[qid];
-				uint32_t new_tail = val;
 				size_t sq_size = (qid == NVME_ADMIN_QUEUE_INDEX) ? 2 : current_ctrlr->iosq_sz;
-				size_t cq_size = sq_size;
-				uint32_t idx = prev_tail;
-				uint16_t expected_host_pt = current_ctrlr->pt[qid];
-				while (idx != new_tail) {
-					NVME_SQ *sq_entry = &current_ctrlr->sq_buffer[qid][idx];
-					handle_fake_device_command(qid, idx, sq_entry, expected_host_pt);
-					// Track host-side phase tag flip on queue wrap-around
-					if (idx == cq_size - 1) {
-						expected_host_pt ^= 1;
-					}
-					idx = (idx + 1) % sq_size;
-				}
-				fake_device_behavior.last_sq_tail[qid] = new_tail;
+				int outstanding = (val + sq_size - fake_device_behavior.last_sq_tail[qid]) % sq_size;
+				fake_stats.max_outstanding[qid] = MAX(fake_stats.max_outstanding[qid], outstanding);
+				if (qid == NVME_IO_QUEUE_INDEX && fake_device_behavior.defer_completion)
+					return;
+				process_fake_commands(qid);
 				return;
 			}
 			if (offset == NVME_CQHDBL_OFFSET(qid, dstrd)) {
 				fake_regs.cqhdbl[qid] = val;
+				fake_stats.cq_doorbells[qid]++;
 				return;
 			}
 		}
@@ -283,9 +347,106 @@ void mock_write32(volatile void *addr, uint32_t val)
 // Memory read mock with correct volatile signature
 uint16_t mock_read16(volatile const void *addr)
 {
+	// Host polls the IO CQ: finish everything that was queued so far
+	if (current_ctrlr && fake_device_behavior.defer_completion &&
+	    fake_device_behavior.last_sq_tail[NVME_IO_QUEUE_INDEX] !=
+	    fake_regs.sqtdbl[NVME_IO_QUEUE_INDEX])
+		process_fake_commands(NVME_IO_QUEUE_INDEX);
 	return *(volatile const uint16_t*)(uintptr_t)(addr);
 }
 
+static BlockDev *init_fake_nvme(uint8_t mdts)
+{
+	init_fake_regs();
+	memset(&fake_device_behavior, 0, sizeof(fake_device_behavior));
+	fake_device_behavior.mdts = mdts;
+
+	NvmeCtrlr *ctrlr = new_nvme_ctrlr(0x100);
+	assert_non_null(ctrlr);
+	current_ctrlr = ctrlr;
+	assert_int_equal(ctrlr->ctrlr.ops.update(&ctrlr->ctrlr.ops), 0);
+	assert_false(list_is_empty(&fixed_block_devices));
+
+	// Only count IO traffic from here on
+	memset(&fake_stats, 0, sizeof(fake_stats));
+	fake_device_behavior.defer_completion = true;
+
+	return container_of(list_first(&fixed_block_devices), BlockDev, list_node);
+}
+
+static void assert_blocks_read(const uint8_t *buffer, lba_t start, lba_t count)
+{
+	for (lba_t lba = 0; lba < count; lba++)
+		for (int i = 0; i < 512; i += 64)
+			assert_int_equal(buffer[lba * 512 + i],
+					 (uint8_t)(start + lba));
+}
+
+// Large transfers use chained PRP lists and are all in flight at once
+static void test_nvme_queued_read_chained_prp(void **state)
+{
+	BlockDev *bdev = init_fake_nvme(0);
+
+	// 6 commands of NVME_MAX_XFER_BYTES, buffer unaligned within a page
+	size_t transfer_size = 6 * NVME_MAX_XFER_BYTES;
+	lba_t blocks = transfer_size / 512;
+	uint8_t *real_buffer = malloc(transfer_size + 2 * NVME_PAGE_SIZE);
+	assert_non_null(real_buffer);
+	uint8_t *buffer = (uint8_t *)ALIGN_UP((uintptr_t)real_buffer,
+					      NVME_PAGE_SIZE) + 512;
+	memset(buffer, 0xAA, transfer_size);
+
+	assert_int_equal(bdev->ops.read(&bdev->ops, 100, blocks, buffer),
+			 blocks);
+	assert_blocks_read(buffer, 100, blocks);
+
+	print_message("queue depth %d, SQ doorbells %d, CQ doorbells %d\n",
+		      fake_stats.max_outstanding[NVME_IO_QUEUE_INDEX],
+		      fake_stats.sq_doorbells[NVME_IO_QUEUE_INDEX],
+		      fake_stats.cq_doorbells[NVME_IO_QUEUE_INDEX]);
+	assert_int_equal(fake_stats.io_cmds, 6);
+	// One SQ doorbell per command, one CQ doorbell for the whole batch
+	assert_int_equal(fake_stats.sq_doorbells[NVME_IO_QUEUE_INDEX], 6);
+	assert_int_equal(fake_stats.cq_doorbells[NVME_IO_QUEUE_INDEX], 1);
+	assert_int_equal(fake_stats.max_outstanding[NVME_IO_QUEUE_INDEX], 6);
+	// Each unaligned 4MB command needs 1024 list entries over 3 lists
+	assert_int_equal(fake_stats.prp_chains, 2 * 6);
+
+	free(real_buffer);
+}
+
+// Small MDTS fills the SQ and completions are reaped a full queue at a time
+static void test_nvme_queued_read_full_sq(void **state)
+{
+	// 32KB max transfer
+	BlockDev *bdev = init_fake_nvme(3);
+	const int max_queued = current_ctrlr->iosq_sz - 1;
+	const int cmds = 2 * max_queued + 3;
+
+	size_t transfer_size = cmds * 32 * KiB;
+	lba_t blocks = transfer_size / 512;
+	uint8_t *real_buffer = malloc(transfer_size + NVME_PAGE_SIZE);
+	assert_non_null(real_buffer);
+	uint8_t *buffer = (uint8_t *)ALIGN_UP((uintptr_t)real_buffer,
+					      NVME_PAGE_SIZE);
+
+	assert_int_equal(bdev->ops.read(&bdev->ops, 0, blocks, buffer), blocks);
+	assert_blocks_read(buffer, 0, blocks);
+
+	print_message("queue depth %d, SQ doorbells %d, CQ doorbells %d\n",
+		      fake_stats.max_outstanding[NVME_IO_QUEUE_INDEX],
+		      fake_stats.sq_doorbells[NVME_IO_QUEUE_INDEX],
+		      fake_stats.cq_doorbells[NVME_IO_QUEUE_INDEX]);
+	assert_int_equal(fake_stats.io_cmds, cmds);
+	assert_int_equal(fake_stats.sq_doorbells[NVME_IO_QUEUE_INDEX], cmds);
+	assert_int_equal(fake_stats.cq_doorbells[NVME_IO_QUEUE_INDEX], 3);
+	assert_int_equal(fake_stats.max_outstanding[NVME_IO_QUEUE_INDEX],
+			 max_queued);
+	assert_int_equal(fake_stats.prp_chains, 0);
+
+	free(real_buffer);
+}
+
 // Test case for the vulnerability
 static void test_nvme_vulnerability(void **state)
 {
@@ -402,6 +563,8 @@ int main(void)
 {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test_setup_teardown(test_nvme_vulnerability, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_nvme_queued_read_chained_prp, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_nvme_queued_read_full_sq, setup, teardown),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
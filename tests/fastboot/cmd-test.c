@@ -14,7 +14,7 @@ static void test_stream_close(struct StreamOps *me);
 
 /* Mock data */
 UfsCtlr test_ufs;
-char _kernel_start[0x100];
+char _kernel_start[CONFIG_KERNEL_SIZE];
 /*
  * Magic number for tests to validate that the same android_misc_oem_cmdline is used for
  * different commands
@@ -24,11 +24,10 @@ StreamOps test_stream = {
 	.read = test_stream_read,
 	.close = test_stream_close,
 };
-/*
- * Magic number for tests to validate that the same vb2_sha256_context is used for different
- * commands
- */
-const uint32_t test_sha256_context_magic = 0xafa;
+/* Context passed to vb2_digest_init(), to validate that the same one is used afterwards */
+static struct vb2_digest_context *test_digest_context;
+/* Value returned by the vb2_digest_extend() mock */
+static vb2_error_t test_digest_extend_result;
 
 /* Mocked functions */
 int android_misc_bcb_write(BlockDev *disk, GptData *gpt, struct bootloader_message *bcb)
@@ -251,6 +250,18 @@ void fastboot_erase(struct FastbootOps *fb, const char *partition_name)
 	expect_string(fastboot_erase, partition_name, part); \
 } while (0)
 
+void fastboot_stream_flash_start(struct FastbootOps *fb, const char *partition_name)
+{
+	check_expected_ptr(fb);
+	check_expected(partition_name);
+}
+
+/* Setup for fastboot_stream_flash_start mock */
+#define WILL_STREAM_FLASH_START(fb_ptr, part) do { \
+	expect_value(fastboot_stream_flash_start, fb, fb_ptr); \
+	expect_string(fastboot_stream_flash_start, partition_name, part); \
+} while (0)
+
 bool gpt_foreach_partition(GptData *gpt, gpt_foreach_callback_t cb, void *ctx)
 {
 	GptEntry *e;
@@ -447,41 +458,69 @@ enum gpt_io_ret gpt_open_partition_stream(BlockDev *disk, GptData *gpt,
 	WILL_OPEN_STREAM(off, len, ret); \
 } while (0)
 
-void vb2_sha256_init(struct vb2_sha256_context *ctx, enum vb2_hash_algorithm algo)
+bool cbfs_hwcrypto_allowed(void)
+{
+	return true;
+}
+
+vb2_error_t vb2_digest_init(struct vb2_digest_context *dc, bool allow_hwcrypto,
+			    enum vb2_hash_algorithm algo, uint32_t data_size)
 {
 	function_called();
+	assert_true(allow_hwcrypto);
 	assert_int_equal(algo, VB2_HASH_SHA256);
-	ctx->h[0] = test_sha256_context_magic;
+	check_expected(data_size);
+	test_digest_context = dc;
+
+	return VB2_SUCCESS;
 }
 
-/* Setup for vb2_sha256_init mock */
-#define WILL_INIT_VB2_SHA256 expect_function_call(vb2_sha256_init)
+/* Setup for vb2_digest_init mock */
+#define WILL_INIT_VB2_SHA256_SIZE(size) do { \
+	expect_function_call(vb2_digest_init); \
+	expect_value(vb2_digest_init, data_size, size); \
+} while (0)
+
+#define WILL_INIT_VB2_SHA256 do { \
+	expect_function_call(vb2_digest_init); \
+	expect_any(vb2_digest_init, data_size); \
+} while (0)
 
-void vb2_sha256_update(struct vb2_sha256_context *ctx, const uint8_t *data, uint32_t size)
+vb2_error_t vb2_digest_extend(struct vb2_digest_context *dc, const uint8_t *buf,
+			      uint32_t size)
 {
-	assert_int_equal(ctx->h[0], test_sha256_context_magic);
-	assert_ptr_equal(data, &_kernel_start);
+	assert_ptr_equal(dc, test_digest_context);
+	check_expected_ptr(buf);
 	check_expected(size);
+
+	return test_digest_extend_result;
 }
 
-/* Setup for vb2_sha256_update mock */
-#define WILL_UPDATE_VB2_SHA256(len) expect_value(vb2_sha256_update, size, len)
+/* Setup for vb2_digest_extend mock */
+#define WILL_UPDATE_VB2_SHA256_AT(data, len) do { \
+	expect_value(vb2_digest_extend, buf, data); \
+	expect_value(vb2_digest_extend, size, len); \
+} while (0)
+
+#define WILL_UPDATE_VB2_SHA256(len) WILL_UPDATE_VB2_SHA256_AT(&_kernel_start, len)
 
-void vb2_sha256_finalize(struct vb2_sha256_context *ctx, uint8_t *digest,
-			 enum vb2_hash_algorithm algo)
+vb2_error_t vb2_digest_finalize(struct vb2_digest_context *dc, uint8_t *digest,
+				uint32_t digest_size)
 {
-	assert_int_equal(ctx->h[0], test_sha256_context_magic);
-	assert_int_equal(algo, VB2_HASH_SHA256);
+	assert_ptr_equal(dc, test_digest_context);
+	assert_int_equal(digest_size, VB2_SHA256_DIGEST_SIZE);
 
 	uint8_t *sha = mock_ptr_type(uint8_t *);
 	int len = mock();
 	memcpy(digest, sha, len);
+
+	return VB2_SUCCESS;
 }
 
-/* Setup for vb2_sha256_finalize mock */
+/* Setup for vb2_digest_finalize mock */
 #define WILL_FINALIZE_VB2_SHA256(sha, sha_len) do { \
-	will_return(vb2_sha256_finalize, sha); \
-	will_return(vb2_sha256_finalize, sha_len); \
+	will_return(vb2_digest_finalize, sha); \
+	will_return(vb2_digest_finalize, sha_len); \
 } while (0)
 
 static uint64_t test_stream_read(struct StreamOps *me, uint64_t count, void *buffer)
@@ -537,6 +576,7 @@ int android_misc_virtual_ab_cancel_update(BlockDev *disk, GptData *gpt)
 static int setup(void **state)
 {
 	fastboot_disk_init_could_fail = true;
+	test_digest_extend_result = VB2_SUCCESS;
 	setup_test_fb();
 
 	*state = &test_fb;
@@ -618,6 +658,221 @@ static void test_fb_cmd_download_ok(void **state)
 	assert_false(fb->has_staged_data);
 }
 
+static void test_fb_cmd_download_streaming_bigger_than_max_download_size(void **state)
+{
+	struct FastbootOps *fb = *state;
+	struct sparse_stream *stream = (struct sparse_stream *)0x1234;
+	char cmd[] = "download:ff000000";
+
+	fb->stream_flash = stream;
+
+	WILL_SEND_EXACT(fb, "DATAff000000");
+
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+	assert_int_equal(fb->state, DOWNLOAD);
+	assert_int_equal(fb->memory_buffer_len, 0xff000000);
+	assert_ptr_equal(fb->stream_flash, stream);
+}
+
+static void test_fb_download_streaming(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "download:00000030";
+	char data[0x30];
+
+	fb->stream_flash = (struct sparse_stream *)0x1234;
+	memset(data, 0xab, sizeof(data));
+
+	WILL_SEND_EXACT(fb, "DATA00000030");
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+
+	/* Data is collected until the stage is full or the download is complete */
+	fastboot_handle_packet(fb, data, 0x10);
+	assert_int_equal(fb->state, DOWNLOAD);
+	assert_int_equal(fb->download_progress, 0x10);
+
+	/* Nothing stays staged, the finish reports the result of the flash */
+	WILL_STREAM_FLASH_FEED(fb, _kernel_start, 0x30, true);
+	WILL_STREAM_FLASH_FINISH(fb);
+	fastboot_handle_packet(fb, data + 0x10, 0x20);
+	assert_int_equal(fb->state, COMMAND);
+	assert_false(fb->has_staged_data);
+	assert_null(fb->stream_flash);
+	assert_filled_with(_kernel_start, 0xab, 0x30);
+	assert_int_equal(fb->stream_flash_chunks, 1);
+}
+
+static void test_fb_download_streaming_stage(void **state)
+{
+	struct FastbootOps *fb = *state;
+	const uint64_t stage = FASTBOOT_STREAM_STAGE_SIZE;
+	char cmd[] = "download:00000000";
+	static char data[0x1000];
+	uint64_t left;
+	char *dest;
+
+	fb->stream_flash = (struct sparse_stream *)0x1234;
+	memset(data, 0xcd, sizeof(data));
+	snprintf(cmd, sizeof(cmd), "download:%08llx", 2 * stage + 0x10);
+
+	WILL_SEND_PREFIX(fb, "DATA");
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+
+	/* The stage is received in place and flashed once it is full */
+	dest = fastboot_get_download_dest(fb, &left);
+	assert_ptr_equal(dest, _kernel_start);
+	assert_int_equal(left, stage);
+	fastboot_handle_packet(fb, dest, stage - 0x10);
+
+	/* A copied packet may straddle the end of the stage */
+	WILL_STREAM_FLASH_FEED(fb, _kernel_start, stage, true);
+	fastboot_handle_packet(fb, data, 0x20);
+	assert_filled_with(_kernel_start, 0xcd, 0x10);
+
+	/* Then staging starts from the beginning again */
+	dest = fastboot_get_download_dest(fb, &left);
+	assert_ptr_equal(dest, &_kernel_start[0x10]);
+	assert_int_equal(left, stage - 0x10);
+	WILL_STREAM_FLASH_FEED(fb, _kernel_start, stage, true);
+	fastboot_handle_packet(fb, dest, left);
+
+	/* The last piece is flashed as soon as it arrives */
+	dest = fastboot_get_download_dest(fb, &left);
+	assert_ptr_equal(dest, _kernel_start);
+	assert_int_equal(left, 0x10);
+	WILL_STREAM_FLASH_FEED(fb, _kernel_start, 0x10, true);
+	WILL_STREAM_FLASH_FINISH(fb);
+	fastboot_handle_packet(fb, dest, left);
+
+	assert_int_equal(fb->state, COMMAND);
+	assert_null(fb->stream_flash);
+	assert_int_equal(fb->stream_flash_chunks, 3);
+	assert_null(fastboot_get_download_dest(fb, &left));
+}
+
+static void test_fb_download_streaming_fail(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "download:00000030";
+	char data[0x30];
+
+	fb->stream_flash = (struct sparse_stream *)0x1234;
+	memset(data, 0xab, sizeof(data));
+
+	WILL_SEND_EXACT(fb, "DATA00000030");
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+
+	fastboot_handle_packet(fb, data, 0x10);
+
+	/* The error is reported once, when the download is complete */
+	WILL_STREAM_FLASH_FEED(fb, _kernel_start, 0x30, false);
+	WILL_STREAM_FLASH_FINISH(fb);
+	fastboot_handle_packet(fb, data + 0x10, 0x20);
+	assert_int_equal(fb->state, COMMAND);
+	assert_int_equal(fb->download_progress, 0);
+	assert_false(fb->has_staged_data);
+	assert_null(fb->stream_flash);
+}
+
+static void test_fb_download_streaming_fail_midway(void **state)
+{
+	struct FastbootOps *fb = *state;
+	const uint64_t stage = FASTBOOT_STREAM_STAGE_SIZE;
+	char cmd[] = "download:00000000";
+	char garbage[] = "getvar:all";
+	uint64_t left;
+	char *dest;
+
+	fb->stream_flash = (struct sparse_stream *)0x1234;
+	snprintf(cmd, sizeof(cmd), "download:%08llx", 2 * stage + sizeof(garbage) - 1);
+
+	WILL_SEND_PREFIX(fb, "DATA");
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+
+	/* A corrupt chunk in the first piece stops decoding */
+	dest = fastboot_get_download_dest(fb, &left);
+	WILL_STREAM_FLASH_FEED(fb, _kernel_start, stage, false);
+	fastboot_handle_packet(fb, dest, left);
+	assert_int_equal(fb->state, DOWNLOAD);
+	assert_true(fb->stream_flash_failed);
+
+	/* The rest of the download is still received, but nothing is fed or answered */
+	dest = fastboot_get_download_dest(fb, &left);
+	assert_non_null(dest);
+	fastboot_handle_packet(fb, dest, stage);
+	assert_int_equal(fb->state, DOWNLOAD);
+	assert_int_equal(fb->download_progress, 2 * stage);
+
+	/* Data that looks like a command is still part of the download */
+	WILL_STREAM_FLASH_FINISH(fb);
+	fastboot_handle_packet(fb, garbage, sizeof(garbage) - 1);
+	assert_int_equal(fb->state, COMMAND);
+	assert_int_equal(fb->download_progress, 0);
+	assert_null(fb->stream_flash);
+}
+
+static void test_fb_download_in_place(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "download:00000030";
+	uint64_t left;
+	char *dest;
+
+	assert_null(fastboot_get_download_dest(fb, &left));
+
+	WILL_SEND_EXACT(fb, "DATA00000030");
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+
+	dest = fastboot_get_download_dest(fb, &left);
+	assert_ptr_equal(dest, &_kernel_start);
+	assert_int_equal(left, 0x30);
+	memset(dest, 0xab, 0x10);
+	fastboot_handle_packet(fb, dest, 0x10);
+	assert_int_equal(fb->download_progress, 0x10);
+
+	/* The transport receives the rest right behind the first chunk */
+	dest = fastboot_get_download_dest(fb, &left);
+	assert_ptr_equal(dest, &_kernel_start[0x10]);
+	assert_int_equal(left, 0x20);
+	memset(dest, 0xcd, 0x20);
+	WILL_SEND_EXACT(fb, "OKAY");
+	fastboot_handle_packet(fb, dest, 0x20);
+
+	assert_int_equal(fb->state, COMMAND);
+	assert_true(fb->has_staged_data);
+	assert_int_equal(fb->last_download_bytes, 0x30);
+	assert_filled_with(_kernel_start, 0xab, 0x10);
+	assert_filled_with(&_kernel_start[0x10], 0xcd, 0x20);
+	assert_null(fastboot_get_download_dest(fb, &left));
+}
+
+static void test_fb_download_dest_streaming(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "download:00000030";
+	uint64_t left;
+
+	fb->stream_flash = (struct sparse_stream *)0x1234;
+
+	WILL_SEND_EXACT(fb, "DATA00000030");
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+
+	/* Streamed data is received into the start of the staging buffer */
+	assert_ptr_equal(fastboot_get_download_dest(fb, &left), _kernel_start);
+	assert_int_equal(left, 0x30);
+}
+
+static void test_fb_cmd_oem_flash_streaming(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "oem flash-streaming:partitionname";
+
+	WILL_STREAM_FLASH_START(fb, "partitionname");
+
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+	assert_int_equal(fb->state, COMMAND);
+}
+
 static void test_fb_cmd_reboot(void **state)
 {
 	struct FastbootOps *fb = *state;
@@ -2292,6 +2547,25 @@ static void test_fb_cmd_oem_sha256_read_fail(void **state)
 	assert_int_equal(fb->state, COMMAND);
 }
 
+static void test_fb_cmd_oem_sha256_hash_fail(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "oem sha256:part";
+	const int part_len = 16;
+
+	test_digest_extend_result = VB2_ERROR_MOCK;
+
+	WILL_OPEN_PARTITION_STREAM("part", 0, part_len, GPT_IO_SUCCESS);
+	WILL_INIT_VB2_SHA256;
+	WILL_READ_STREAM(part_len);
+	WILL_UPDATE_VB2_SHA256(part_len);
+	WILL_CLOSE_STREAM;
+	WILL_SEND_FAIL(fb);
+
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+	assert_int_equal(fb->state, COMMAND);
+}
+
 static void test_fb_cmd_oem_sha256_len_greater_than_part_len(void **state)
 {
 	struct FastbootOps *fb = *state;
@@ -2383,6 +2657,82 @@ static void test_fb_cmd_oem_sha256_bad_arg(void **state)
 
 	fastboot_handle_packet(fb, cmd9, sizeof(cmd9) - 1);
 	assert_int_equal(fb->state, COMMAND);
+
+	char cmd10[] = "oem sha256:vbmeta_a:5:24:0";
+
+	WILL_SEND_FAIL(fb);
+
+	fastboot_handle_packet(fb, cmd10, sizeof(cmd10) - 1);
+	assert_int_equal(fb->state, COMMAND);
+
+	char cmd11[] = "oem sha256:vbmeta_a:5:24:16:additional";
+
+	WILL_SEND_FAIL(fb);
+
+	fastboot_handle_packet(fb, cmd11, sizeof(cmd11) - 1);
+	assert_int_equal(fb->state, COMMAND);
+}
+
+static void fill_info_chunk_sha_str(char *str, uint64_t offset, uint8_t *sha, int sha_len)
+{
+	char sha_str[sha_len * 2 + 4 + 1];
+
+	fill_info_sha_str(sha_str, sha, sha_len);
+	sprintf(str, "INFO0x%llx:%s", offset, sha_str + 4);
+}
+
+static void test_fb_cmd_oem_sha256_chunks(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "oem sha256:part:0x100:0x10000:0x6000";
+	uint8_t sha[] = {
+		0xe9, 0x88, 0x4c, 0x9c, 0x74, 0x5f, 0x2b, 0xad,
+		0x79, 0xba, 0x02, 0xfe, 0xe6, 0x79, 0xc8, 0xf5,
+		0x0a, 0x08, 0x81, 0xdd, 0x68, 0x31, 0x4b, 0x68,
+		0x99, 0x19, 0x4e, 0x68, 0x9c, 0xbd, 0x80, 0xfa,
+	};
+	const uint64_t chunk_offsets[] = { 0x100, 0x6100, 0xc100 };
+	const uint32_t chunk_sizes[] = { 0x6000, 0x6000, 0x4000 };
+	char info_str[sizeof(sha) * 2 + 4 + 20];
+
+	/* Two chunks fit in the buffer, the third one is read separately */
+	assert_int_equal(FASTBOOT_MAX_DOWNLOAD_SIZE, 0x10000);
+
+	WILL_OPEN_PARTITION_STREAM("part", 0x100, 0x20000, GPT_IO_SUCCESS);
+	WILL_READ_STREAM(0xc000);
+	WILL_READ_STREAM(0x4000);
+	for (int i = 0; i < ARRAY_SIZE(chunk_offsets); i++) {
+		WILL_INIT_VB2_SHA256_SIZE(chunk_sizes[i]);
+		WILL_UPDATE_VB2_SHA256_AT(&_kernel_start[i % 2 * 0x6000], chunk_sizes[i]);
+		WILL_FINALIZE_VB2_SHA256(sha, sizeof(sha));
+		fill_info_chunk_sha_str(info_str, chunk_offsets[i], sha, sizeof(sha));
+		WILL_SEND_EXACT(fb, info_str);
+	}
+	WILL_CLOSE_STREAM;
+	/* The last digest covers the chunk digests */
+	WILL_INIT_VB2_SHA256_SIZE(3 * VB2_SHA256_DIGEST_SIZE);
+	expect_any(vb2_digest_extend, buf);
+	expect_value(vb2_digest_extend, size, 3 * VB2_SHA256_DIGEST_SIZE);
+	WILL_FINALIZE_VB2_SHA256(sha, sizeof(sha));
+	fill_info_sha_str(info_str, sha, sizeof(sha));
+	WILL_SEND_EXACT(fb, info_str);
+	WILL_SEND_PREFIX(fb, "OKAY");
+
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+	assert_int_equal(fb->state, COMMAND);
+}
+
+static void test_fb_cmd_oem_sha256_too_many_chunks(void **state)
+{
+	struct FastbootOps *fb = *state;
+	char cmd[] = "oem sha256:part:0:0:1";
+
+	WILL_OPEN_PARTITION_STREAM("part", 0, 0x10000, GPT_IO_SUCCESS);
+	WILL_CLOSE_STREAM;
+	WILL_SEND_FAIL(fb);
+
+	fastboot_handle_packet(fb, cmd, sizeof(cmd) - 1);
+	assert_int_equal(fb->state, COMMAND);
 }
 
 static void test_fb_cmd_snapshot_update_get(void **state)
@@ -2513,6 +2863,14 @@ int main(void)
 		TEST(test_fb_cmd_download_overflow),
 		TEST(test_fb_cmd_download_nan),
 		TEST(test_fb_cmd_download_ok),
+		TEST(test_fb_cmd_download_streaming_bigger_than_max_download_size),
+		TEST(test_fb_download_streaming),
+		TEST(test_fb_download_streaming_stage),
+		TEST(test_fb_download_streaming_fail),
+		TEST(test_fb_download_streaming_fail_midway),
+		TEST(test_fb_download_in_place),
+		TEST(test_fb_download_dest_streaming),
+		TEST(test_fb_cmd_oem_flash_streaming),
 		TEST(test_fb_cmd_reboot),
 		TEST(test_fb_cmd_reboot_recovery),
 		TEST(test_fb_cmd_reboot_recovery_write_fail),
@@ -2606,9 +2964,12 @@ int main(void)
 		TEST(test_fb_cmd_oem_sha256_offset_len),
 		TEST(test_fb_cmd_oem_sha256_raw_sector),
 		TEST(test_fb_cmd_oem_sha256_read_fail),
+		TEST(test_fb_cmd_oem_sha256_hash_fail),
 		TEST(test_fb_cmd_oem_sha256_len_greater_than_part_len),
 		TEST(test_fb_cmd_oem_sha256_fail_open_stream),
 		TEST(test_fb_cmd_oem_sha256_bad_arg),
+		TEST(test_fb_cmd_oem_sha256_chunks),
+		TEST(test_fb_cmd_oem_sha256_too_many_chunks),
 		TEST(test_fb_cmd_snapshot_update_get),
 		TEST(test_fb_cmd_snapshot_update_get_disk_error),
 		TEST(test_fb_cmd_snapshot_update_get_unknown_val),
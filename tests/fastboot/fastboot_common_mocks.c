@@ -45,6 +45,26 @@ int fastboot_do_disk_init(struct FastbootOps *fb, bool send_fail)
 	return 0;
 }
 
+bool fastboot_stream_flash_feed(struct FastbootOps *fb, void *data, uint64_t len)
+{
+	check_expected_ptr(fb);
+	check_expected_ptr(data);
+	check_expected(len);
+
+	return mock();
+}
+
+void fastboot_stream_flash_finish(struct FastbootOps *fb)
+{
+	check_expected_ptr(fb);
+	fb->stream_flash = NULL;
+}
+
+void fastboot_stream_flash_abort(struct FastbootOps *fb)
+{
+	fb->stream_flash = NULL;
+}
+
 char fastboot_get_slot_for_partition_name(const char *partition_name)
 {
 	check_expected(partition_name);
@@ -929,6 +929,18 @@ static void test_fb_getvar_partner_custom(void **state)
 	TEST_FASTBOOT_GETVAR_OK(VAR_PARTNER_CUSTOM, "", "unknown");
 }
 
+static void test_fb_getvar_download_throughput(void **state)
+{
+	struct FastbootOps *fb = *state;
+
+	TEST_FASTBOOT_GETVAR_OK(VAR_DOWNLOAD_THROUGHPUT, "", "unknown");
+
+	/* 32 MiB in 2 seconds */
+	fb->last_download_bytes = 32 * MiB;
+	fb->last_download_us = 2 * USECS_PER_SEC;
+	TEST_FASTBOOT_GETVAR_OK(VAR_DOWNLOAD_THROUGHPUT, "", "16384 KiB/s");
+}
+
 static void test_fb_getvar_has_slot(void **state)
 {
 	GptEntry *part = (void *)0xcafe;
@@ -1446,6 +1458,7 @@ static void test_fb_cmd_getvar_all(void **state)
 	check_fb_cmd_getvar_all_contains("INFOsku:0xdead");
 	check_fb_cmd_getvar_all_contains("INFOoem:0xbeef");
 	check_fb_cmd_getvar_all_contains("INFOpartner-custom:EFGH");
+	check_fb_cmd_getvar_all_contains("INFOdownload-throughput:unknown");
 
 	assert_true(list_is_empty(&packets_list));
 }
@@ -1583,6 +1596,7 @@ static void test_fb_cmd_getvar_all_fail_get_var(void **state)
 	check_fb_cmd_getvar_all_contains("INFOsku:0xdead");
 	check_fb_cmd_getvar_all_contains("INFOoem:0xbeef");
 	check_fb_cmd_getvar_all_contains("INFOpartner-custom:EFGH");
+	check_fb_cmd_getvar_all_contains("INFOdownload-throughput:unknown");
 
 	assert_true(list_is_empty(&packets_list));
 }
@@ -1653,6 +1667,7 @@ int main(void)
 		TEST(test_fb_getvar_sku_fail),
 		TEST(test_fb_getvar_oem_fail),
 		TEST(test_fb_getvar_partner_custom),
+		TEST(test_fb_getvar_download_throughput),
 		TEST(test_fb_getvar_has_slot),
 		TEST(test_fb_getvar_has_no_slot),
 		TEST(test_fb_getvar_has_slot_no_partition),
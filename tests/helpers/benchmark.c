@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+
+#include "helpers/benchmark.h"
+
+/*
+ * libpayload has no clock_gettime(), so use the host one. Its headers don't
+ * describe the host clock either, so tests/Makefile.common looks up the value
+ * of CLOCK_MONOTONIC with the host compiler.
+ */
+#ifndef HOST_CLOCK_MONOTONIC
+#error "HOST_CLOCK_MONOTONIC must be defined by the build"
+#endif
+
+struct host_timespec {
+	long tv_sec;
+	long tv_nsec;
+};
+int clock_gettime(int clk_id, struct host_timespec *tp);
+
+/* Overrides the weak stub, timer_hz() is 1 MHz. */
+uint64_t timer_raw_value(void)
+{
+	struct host_timespec ts;
+
+	clock_gettime(HOST_CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * USECS_PER_SEC + ts.tv_nsec / 1000;
+}
+
+const char *gb_per_sec(char *str, size_t size, uint64_t bytes, uint64_t us)
+{
+	uint64_t mb_per_sec = bytes / MAX(us, 1);
+
+	snprintf(str, size, "%llu.%02llu", mb_per_sec / 1000,
+		 mb_per_sec % 1000 / 10);
+	return str;
+}
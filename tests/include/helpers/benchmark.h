@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+#ifndef _HELPERS_BENCHMARK_H
+#define _HELPERS_BENCHMARK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Linking tests/helpers/benchmark.c also makes timer_us() and friends follow
+ * the host monotonic clock, instead of the stub that always returns 0.
+ */
+
+/* Format the throughput as GB/s with two decimals, returns str. */
+const char *gb_per_sec(char *str, size_t size, uint64_t bytes, uint64_t us);
+
+#endif /* _HELPERS_BENCHMARK_H */
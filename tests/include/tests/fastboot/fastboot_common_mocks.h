@@ -34,7 +34,17 @@ void setup_test_fb(void);
 	WILL_SEND_PREFIX(fb_ptr, "FAIL"); \
 } while (0)
 
-/* Setup for get_slot_for_partition_name mock */
+/* Setup for fastboot_stream_flash_feed mock */
+#define WILL_STREAM_FLASH_FEED(fb_ptr, data_ptr, length, ret) do { \
+	expect_value(fastboot_stream_flash_feed, fb, fb_ptr); \
+	expect_value(fastboot_stream_flash_feed, data, data_ptr); \
+	expect_value(fastboot_stream_flash_feed, len, length); \
+	will_return(fastboot_stream_flash_feed, ret); \
+} while (0)
+
+#define WILL_STREAM_FLASH_FINISH(fb_ptr) \
+	expect_value(fastboot_stream_flash_finish, fb, fb_ptr)
+
 #define WILL_GET_SLOT_FOR_PARTITION_NAME(n, ret) do { \
 	expect_string(fastboot_get_slot_for_partition_name, partition_name, n); \
 	will_return(fastboot_get_slot_for_partition_name, ret); \
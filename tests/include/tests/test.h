@@ -22,6 +22,16 @@
 #define _UINTPTR_T_DEFINED
 #include <cmocka.h>
 
+/* Benchmarks are skipped unless TEST_BENCHMARK=1 is passed to make. */
+#ifndef __TEST_BENCHMARK__
+#define __TEST_BENCHMARK__ 0
+#endif
+
+#define skip_unless_benchmark() do { \
+	if (!__TEST_BENCHMARK__) \
+		skip(); \
+} while (0)
+
 /* Ensure that die()/halt() is called. */
 #define expect_die(expression) expect_assert_failure(expression)
 
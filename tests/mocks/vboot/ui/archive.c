@@ -24,3 +24,8 @@ vb2_error_t ui_load_bitmap(enum ui_archive_type type, const char *file,
 {
 	return mock_type(vb2_error_t);
 }
+
+vb2_error_t ui_load_char_bitmap(const char c, struct ui_bitmap *bitmap)
+{
+	return mock_type(vb2_error_t);
+}
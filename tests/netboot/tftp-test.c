@@ -0,0 +1,440 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <endian.h>
+#include <libpayload.h>
+
+#include "drivers/net/net.h"
+#include "net/net.h"
+#include "net/uip.h"
+#include "net/uip_udp_packet.h"
+#include "netboot/tftp.h"
+#include "tests/test.h"
+
+#define TEST_FILE_MAX_SIZE (16 * KiB)
+#define TEST_SERVER_PORT 1234
+#define TEST_QUEUE_SIZE 64
+#define TEST_MAX_POLLS 100000
+
+/*
+ * Scripted TFTP server. It answers the packets sent by the client by queueing
+ * replies, which the mocked net_poll() hands back to the client one by one.
+ */
+struct fake_server {
+	/* Behavior */
+	uint32_t file_size;
+	bool options;		/* acknowledges options with an OACK */
+	bool refuse_options;	/* answers requests with options with error 8 */
+	uint32_t max_blksize;
+	uint32_t max_windowsize;
+	uint16_t drop_block;	/* data block which gets lost once */
+
+	/* State */
+	uint32_t blksize;
+	uint32_t windowsize;
+	bool dropped;
+
+	/* Observations */
+	int rrq_count;
+	int ack_count;
+	int data_count;
+	uint32_t requested_blksize;
+	uint32_t requested_windowsize;
+	bool requested_tsize;
+	int client_error;
+
+	struct {
+		uint8_t data[CONFIG_UIP_LINK_MTU];
+		int len;
+	} queue[TEST_QUEUE_SIZE];
+	int queue_head;
+	int queue_tail;
+};
+
+static struct fake_server server;
+static uint8_t test_file[TEST_FILE_MAX_SIZE];
+static uint8_t test_dest[TEST_FILE_MAX_SIZE];
+static uint64_t mock_time_us;
+static int poll_count;
+
+/* uIP state normally provided by uip.c */
+uip_buf_t uip_aligned_buf;
+void *uip_appdata;
+uint16_t uip_len;
+uint16_t uip_slen;
+uint8_t uip_flags;
+struct uip_udp_conn *uip_udp_conn;
+static struct uip_udp_conn test_conn;
+static NetCallback test_callback;
+
+static void queue_packet(const void *data, int len)
+{
+	assert_true(server.queue_tail - server.queue_head < TEST_QUEUE_SIZE);
+	int slot = server.queue_tail++ % TEST_QUEUE_SIZE;
+	memcpy(server.queue[slot].data, data, len);
+	server.queue[slot].len = len;
+}
+
+static uint16_t last_block(void)
+{
+	return server.file_size / server.blksize + 1;
+}
+
+static void queue_window(uint16_t first)
+{
+	uint8_t pkt[CONFIG_UIP_LINK_MTU];
+
+	for (uint16_t block = first;
+	     block < first + server.windowsize && block <= last_block();
+	     block++) {
+		uint32_t offset = (block - 1) * server.blksize;
+		uint32_t len = MIN(server.blksize, server.file_size - offset);
+		uint16_t hdr[2] = { htonw(TftpData), htonw(block) };
+
+		if (block == server.drop_block && !server.dropped) {
+			server.dropped = true;
+			continue;
+		}
+
+		memcpy(pkt, hdr, sizeof(hdr));
+		memcpy(pkt + sizeof(hdr), test_file + offset, len);
+		queue_packet(pkt, sizeof(hdr) + len);
+		server.data_count++;
+	}
+}
+
+static void queue_error(uint16_t code)
+{
+	uint8_t pkt[] = { 0, TftpError, 0, code, 'e', 'r', 'r', 0 };
+
+	queue_packet(pkt, sizeof(pkt));
+}
+
+static void queue_oack(void)
+{
+	uint8_t pkt[128];
+	int len = 2;
+
+	pkt[0] = 0;
+	pkt[1] = TftpOack;
+	len += sprintf((char *)pkt + len, "blksize") + 1;
+	len += sprintf((char *)pkt + len, "%u", server.blksize) + 1;
+	len += sprintf((char *)pkt + len, "windowsize") + 1;
+	len += sprintf((char *)pkt + len, "%u", server.windowsize) + 1;
+	if (server.requested_tsize) {
+		len += sprintf((char *)pkt + len, "tsize") + 1;
+		len += sprintf((char *)pkt + len, "%u", server.file_size) + 1;
+	}
+	queue_packet(pkt, len);
+}
+
+static void server_handle_rrq(const uint8_t *pkt, int len)
+{
+	const char *p = (const char *)pkt + 2;
+	const char *end = (const char *)pkt + len;
+	bool has_options = false;
+
+	server.rrq_count++;
+	server.requested_blksize = 0;
+	server.requested_windowsize = 0;
+	server.requested_tsize = false;
+
+	/* Skip the file name and the mode */
+	p += strlen(p) + 1;
+	assert_string_equal(p, "Octet");
+	p += strlen(p) + 1;
+
+	while (p < end) {
+		const char *value = p + strlen(p) + 1;
+
+		has_options = true;
+		if (!strcmp(p, "blksize"))
+			server.requested_blksize = strtoul(value, NULL, 10);
+		else if (!strcmp(p, "windowsize"))
+			server.requested_windowsize = strtoul(value, NULL, 10);
+		else if (!strcmp(p, "tsize"))
+			server.requested_tsize = true;
+		p = value + strlen(value) + 1;
+	}
+
+	if (has_options && server.refuse_options) {
+		queue_error(TftpOptionNegotiation);
+		return;
+	}
+
+	if (has_options && server.options) {
+		server.blksize = MIN(server.requested_blksize,
+				     server.max_blksize);
+		server.windowsize = MIN(server.requested_windowsize,
+					server.max_windowsize);
+		queue_oack();
+		return;
+	}
+
+	server.blksize = TftpDefaultBlockSize;
+	server.windowsize = 1;
+	queue_window(1);
+}
+
+static void server_receive(const void *data, int len)
+{
+	const uint8_t *pkt = data;
+	uint16_t opcode, block;
+
+	assert_true(len >= 4);
+	memcpy(&opcode, pkt, sizeof(opcode));
+	memcpy(&block, pkt + 2, sizeof(block));
+	opcode = ntohw(opcode);
+	block = ntohw(block);
+
+	switch (opcode) {
+	case TftpReadReq:
+		server_handle_rrq(pkt, len);
+		break;
+	case TftpAck:
+		server.ack_count++;
+		if (block < last_block())
+			queue_window(block + 1);
+		break;
+	case TftpError:
+		server.client_error = block;
+		break;
+	default:
+		fail_msg("Unexpected opcode %d from the client", opcode);
+	}
+}
+
+/* Mocked functions */
+
+uint64_t timer_us(uint64_t base)
+{
+	return mock_time_us - base;
+}
+
+struct uip_udp_conn *uip_udp_new(const uip_ipaddr_t *ripaddr, uint16_t rport)
+{
+	memset(&test_conn, 0, sizeof(test_conn));
+	test_conn.rport = rport;
+	return &test_conn;
+}
+
+void uip_udp_packet_send(struct uip_udp_conn *c, const void *data, int len)
+{
+	uint16_t opcode;
+
+	memcpy(&opcode, data, sizeof(opcode));
+	/* Requests go to the well-known port, the rest to the server's TID */
+	if (ntohw(opcode) == TftpReadReq)
+		assert_int_equal(c->rport, htonw(TftpPort));
+	else
+		assert_int_equal(c->rport, htonw(TEST_SERVER_PORT));
+
+	server_receive(data, len);
+}
+
+void uip_send(const void *data, int len)
+{
+	uip_slen = len;
+	if (data != uip_appdata)
+		memcpy(uip_appdata, data, len);
+}
+
+void net_set_callback(NetCallback func)
+{
+	test_callback = func;
+}
+
+enum net_poll_status net_poll(void)
+{
+	uint16_t srcport = htonw(TEST_SERVER_PORT);
+
+	assert_true(++poll_count < TEST_MAX_POLLS);
+
+	if (server.queue_head == server.queue_tail) {
+		mock_time_us += 50 * USECS_PER_MSEC;
+		return NET_POLL_NO_RX;
+	}
+
+	int slot = server.queue_head++ % TEST_QUEUE_SIZE;
+	memcpy(&uip_buf[CONFIG_UIP_LLH_LEN +
+			offsetof(struct uip_udpip_hdr, srcport)],
+	       &srcport, sizeof(srcport));
+	uip_appdata = &uip_buf[CONFIG_UIP_LLH_LEN + UIP_IPUDPH_LEN];
+	memcpy(uip_appdata, server.queue[slot].data, server.queue[slot].len);
+	uip_len = server.queue[slot].len;
+	uip_flags = UIP_NEWDATA;
+	uip_udp_conn = &test_conn;
+	uip_slen = 0;
+
+	assert_non_null(test_callback);
+	test_callback();
+
+	if (uip_slen)
+		server_receive(uip_appdata, uip_slen);
+
+	return NET_POLL_RX;
+}
+
+/* Reset mock data (for use before each test) */
+static int setup(void **state)
+{
+	memset(&server, 0, sizeof(server));
+	server.max_blksize = 1024;
+	server.max_windowsize = 8;
+
+	for (int i = 0; i < sizeof(test_file); i++)
+		test_file[i] = (i * 7 + i / 256) & 0xff;
+	memset(test_dest, 0, sizeof(test_dest));
+
+	mock_time_us = 0;
+	poll_count = 0;
+	test_callback = NULL;
+
+	return 0;
+}
+
+static int do_tftp_read(uint32_t *size, uint32_t max_size)
+{
+	uip_ipaddr_t ip;
+
+	uip_ipaddr(&ip, 10, 0, 0, 1);
+	return tftp_read(test_dest, &ip, "vmlinuz", size, max_size);
+}
+
+/* Test functions start here */
+
+static void test_tftp_negotiated(void **state)
+{
+	uint32_t size = 0;
+
+	server.options = true;
+	server.file_size = 10000;
+
+	assert_int_equal(do_tftp_read(&size, sizeof(test_dest)), 0);
+
+	assert_int_equal(size, server.file_size);
+	assert_memory_equal(test_dest, test_file, server.file_size);
+	assert_int_equal(server.rrq_count, 1);
+	assert_int_equal(server.requested_blksize,
+			 CONFIG_UIP_LINK_MTU - UIP_IPUDPH_LEN - 4);
+	assert_int_equal(server.requested_windowsize,
+			 CONFIG_NETBOOT_TFTP_WINDOWSIZE);
+	assert_true(server.requested_tsize);
+	assert_int_equal(server.blksize, 1024);
+	assert_int_equal(server.windowsize, 4);
+	/* ACK of the OACK, then one per window of 4 out of 10 blocks */
+	assert_int_equal(server.ack_count, 1 + 3);
+	assert_null(test_callback);
+}
+
+static void test_tftp_no_options(void **state)
+{
+	uint32_t size = 0;
+
+	server.file_size = 2000;
+
+	assert_int_equal(do_tftp_read(&size, sizeof(test_dest)), 0);
+
+	assert_int_equal(size, server.file_size);
+	assert_memory_equal(test_dest, test_file, server.file_size);
+	assert_int_equal(server.rrq_count, 1);
+	assert_int_equal(server.blksize, TftpDefaultBlockSize);
+	/* Lock-step, one ACK per block */
+	assert_int_equal(server.ack_count, 4);
+}
+
+static void test_tftp_options_refused(void **state)
+{
+	uint32_t size = 0;
+
+	server.refuse_options = true;
+	server.file_size = 1500;
+
+	assert_int_equal(do_tftp_read(&size, sizeof(test_dest)), 0);
+
+	assert_int_equal(size, server.file_size);
+	assert_memory_equal(test_dest, test_file, server.file_size);
+	/* The second request is plain TFTP */
+	assert_int_equal(server.rrq_count, 2);
+	assert_int_equal(server.requested_blksize, 0);
+	assert_int_equal(server.requested_windowsize, 0);
+	assert_false(server.requested_tsize);
+	assert_int_equal(server.ack_count, 3);
+}
+
+static void test_tftp_tsize_too_large(void **state)
+{
+	uint32_t size = 0;
+
+	server.options = true;
+	server.file_size = 10000;
+
+	assert_int_equal(do_tftp_read(&size, 5000), -1);
+
+	/* Refused before any data was sent */
+	assert_int_equal(server.client_error, TftpNoSpace);
+	assert_int_equal(server.data_count, 0);
+	assert_int_equal(size, 0);
+}
+
+static void test_tftp_lost_block_in_window(void **state)
+{
+	uint32_t size = 0;
+
+	server.options = true;
+	server.file_size = 10000;
+	server.drop_block = 3;
+
+	assert_int_equal(do_tftp_read(&size, sizeof(test_dest)), 0);
+
+	assert_int_equal(size, server.file_size);
+	assert_memory_equal(test_dest, test_file, server.file_size);
+	assert_true(server.dropped);
+	/*
+	 * Block 4 arriving after block 2 makes the client ACK block 2, which
+	 * restarts the window at block 3. Then blocks 3-6 and 7-10 are ACKed.
+	 */
+	assert_int_equal(server.ack_count, 1 + 1 + 2);
+}
+
+static void test_tftp_exact_multiple_of_blksize(void **state)
+{
+	uint32_t size = 0;
+
+	server.options = true;
+	server.file_size = 4096;
+
+	assert_int_equal(do_tftp_read(&size, sizeof(test_dest)), 0);
+
+	assert_int_equal(size, server.file_size);
+	assert_memory_equal(test_dest, test_file, server.file_size);
+	/* Four full blocks and an empty one terminating the transfer */
+	assert_int_equal(server.data_count, 5);
+	assert_int_equal(server.ack_count, 1 + 2);
+}
+
+static void test_tftp_too_large_without_tsize(void **state)
+{
+	uint32_t size = 0;
+
+	server.file_size = 3000;
+
+	assert_int_equal(do_tftp_read(&size, 2000), -1);
+}
+
+#define TEST(test_function_name) \
+	cmocka_unit_test_setup(test_function_name, setup)
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		TEST(test_tftp_negotiated),
+		TEST(test_tftp_no_options),
+		TEST(test_tftp_options_refused),
+		TEST(test_tftp_tsize_too_large),
+		TEST(test_tftp_lost_block_in_window),
+		TEST(test_tftp_exact_multiple_of_blksize),
+		TEST(test_tftp_too_large_without_tsize),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
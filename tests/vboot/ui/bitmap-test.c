@@ -15,6 +15,12 @@ vb2_error_t ui_load_bitmap(enum ui_archive_type type, const char *file,
 	return VB2_SUCCESS;
 }
 
+vb2_error_t ui_load_char_bitmap(const char c, struct ui_bitmap *bitmap)
+{
+	check_expected(c);
+	return VB2_SUCCESS;
+}
+
 /* Test functions */
 static void test_ui_get_bitmap(void **state)
 {
@@ -39,10 +45,19 @@ static void test_ui_get_bitmap(void **state)
 	}
 }
 
+static void test_ui_get_char_bitmap(void **state)
+{
+	struct ui_bitmap bitmap;
+
+	expect_value(ui_load_char_bitmap, c, 'a');
+	ASSERT_VB2_SUCCESS(ui_get_char_bitmap('a', &bitmap));
+}
+
 int main(void)
 {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_ui_get_bitmap),
+		cmocka_unit_test(test_ui_get_char_bitmap),
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
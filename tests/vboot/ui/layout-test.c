@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <tests/test.h>
+#include <tests/vboot/common.h>
+#include <tests/vboot/context.h>
+#include <vboot/ui.h>
+#include <vb2_api.h>
+
+/* Mocks */
+
+vb2_error_t ui_screen_change(struct ui_context *ui, enum ui_screen id)
+{
+	return VB2_ERROR_MOCK;
+}
+
+const struct ui_screen_info *ui_get_screen_info(enum ui_screen screen_id)
+{
+	return NULL;
+}
+
+int clear_screen(const struct rgb_color *rgb)
+{
+	function_called();
+	return CBGFX_SUCCESS;
+}
+
+vb2_error_t ui_get_bitmap(const char *image_name, const char *locale_code,
+			  int focused, struct ui_bitmap *bitmap)
+{
+	strncpy(bitmap->name, image_name, sizeof(bitmap->name) - 1);
+	bitmap->name[sizeof(bitmap->name) - 1] = '\0';
+	return VB2_SUCCESS;
+}
+
+vb2_error_t ui_get_language_name_bitmap(const char *locale_code,
+					struct ui_bitmap *bitmap)
+{
+	return ui_get_bitmap("language.bmp", locale_code, 0, bitmap);
+}
+
+vb2_error_t ui_get_step_icon_bitmap(int step, int focused,
+				    struct ui_bitmap *bitmap)
+{
+	return ui_get_bitmap("step.bmp", NULL, focused, bitmap);
+}
+
+vb2_error_t ui_get_bitmap_width(const struct ui_bitmap *bitmap,
+				int32_t height, int32_t *width)
+{
+	*width = 100;
+	return VB2_SUCCESS;
+}
+
+uint32_t ui_get_bitmap_num_lines(const struct ui_bitmap *bitmap)
+{
+	return 1;
+}
+
+vb2_error_t ui_get_ntext_width(const char *text, size_t n, int32_t height,
+			       int32_t *width)
+{
+	*width = 100;
+	return VB2_SUCCESS;
+}
+
+/* Every bitmap drawn has to be expected by the test */
+vb2_error_t ui_draw_bitmap(const struct ui_bitmap *bitmap,
+			   int32_t x, int32_t y, int32_t width, int32_t height,
+			   uint32_t flags, int reverse)
+{
+	const char *name = bitmap->name;
+
+	check_expected(name);
+	return VB2_SUCCESS;
+}
+
+vb2_error_t ui_draw_mapped_bitmap(const struct ui_bitmap *bitmap,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  const struct rgb_color *bg_color,
+				  const struct rgb_color *fg_color,
+				  uint32_t flags, int reverse)
+{
+	const char *name = bitmap->name;
+
+	check_expected(name);
+	return VB2_SUCCESS;
+}
+
+vb2_error_t ui_draw_ntext(const char *text, size_t n,
+			  int32_t x, int32_t y, int32_t height,
+			  const struct rgb_color *bg_color,
+			  const struct rgb_color *fg_color,
+			  uint32_t flags, int reverse)
+{
+	return VB2_SUCCESS;
+}
+
+vb2_error_t ui_draw_rounded_box(int32_t x, int32_t y,
+				int32_t width, int32_t height,
+				const struct rgb_color *rgb,
+				uint32_t thickness, uint32_t radius,
+				int reverse)
+{
+	return VB2_SUCCESS;
+}
+
+vb2_error_t ui_draw_box(int32_t x, int32_t y,
+			int32_t width, int32_t height,
+			const struct rgb_color *rgb,
+			int reverse)
+{
+	return VB2_SUCCESS;
+}
+
+#define WILL_CLEAR_SCREEN expect_function_call(clear_screen)
+
+#define WILL_DRAW_BITMAP(file) expect_string(ui_draw_bitmap, name, file)
+
+#define WILL_DRAW_BUTTON(file) expect_string(ui_draw_mapped_bitmap, name, file)
+
+#define WILL_DRAW_SCREEN do { \
+	WILL_DRAW_BITMAP("ic_info.bmp"); \
+	WILL_DRAW_BITMAP("title.bmp"); \
+	WILL_DRAW_BITMAP("desc.bmp"); \
+} while (0)
+
+/* Test screen */
+
+static const char *const test_desc_files[] = {
+	"desc.bmp",
+};
+
+static const struct ui_menu_item test_menu_items[] = {
+	{
+		.name = "item 0",
+		.file = "btn_0.bmp",
+	},
+	{
+		.name = "item 1",
+		.file = "btn_1.bmp",
+	},
+	{
+		.name = "item 2",
+		.file = "btn_2.bmp",
+	},
+};
+
+static const struct ui_screen_info test_screen = {
+	.id = UI_SCREEN_RECOVERY_SELECT,
+	.name = "test_screen",
+	.icon = UI_ICON_TYPE_INFO,
+	.title = "title.bmp",
+	.desc = {
+		.count = ARRAY_SIZE(test_desc_files),
+		.files = test_desc_files,
+	},
+	.menu = {
+		.num_items = ARRAY_SIZE(test_menu_items),
+		.items = test_menu_items,
+	},
+	.no_footer = 1,
+};
+
+static const struct ui_locale test_locale = {
+	.id = 0,
+	.code = "en",
+};
+
+struct ui_context test_ui_ctx;
+struct ui_state test_ui_state;
+struct ui_state test_prev_state;
+
+static int setup_ui_context(void **state)
+{
+	memset(&test_ui_ctx, 0, sizeof(test_ui_ctx));
+	memset(&test_ui_state, 0, sizeof(test_ui_state));
+	reset_mock_workbuf = 1;
+
+	test_ui_ctx.ctx = vboot_get_context();
+	test_ui_ctx.state = &test_ui_state;
+	test_ui_state.screen = &test_screen;
+	test_ui_state.locale = &test_locale;
+	memcpy(&test_prev_state, &test_ui_state, sizeof(test_prev_state));
+
+	*state = &test_ui_ctx;
+	return 0;
+}
+
+/* Tests */
+
+static void test_draw_default_full(void **state)
+{
+	struct ui_context *ui = *state;
+
+	WILL_CLEAR_SCREEN;
+	WILL_DRAW_SCREEN;
+	WILL_DRAW_BUTTON("btn_0.bmp");
+	WILL_DRAW_BUTTON("btn_1.bmp");
+	WILL_DRAW_BUTTON("btn_2.bmp");
+
+	assert_int_equal(ui_draw_default(ui, NULL), VB2_SUCCESS);
+}
+
+static void test_draw_default_unchanged(void **state)
+{
+	struct ui_context *ui = *state;
+
+	assert_int_equal(ui_draw_default(ui, &test_prev_state), VB2_SUCCESS);
+}
+
+static void test_draw_default_focus_change(void **state)
+{
+	struct ui_context *ui = *state;
+
+	ui->state->focused_item = 1;
+	WILL_DRAW_BUTTON("btn_0.bmp");
+	WILL_DRAW_BUTTON("btn_1.bmp");
+
+	assert_int_equal(ui_draw_default(ui, &test_prev_state), VB2_SUCCESS);
+}
+
+static void test_draw_default_disabled_change(void **state)
+{
+	struct ui_context *ui = *state;
+
+	UI_SET_BIT(ui->state->disabled_item_mask, 2);
+	WILL_DRAW_BUTTON("btn_2.bmp");
+
+	assert_int_equal(ui_draw_default(ui, &test_prev_state), VB2_SUCCESS);
+}
+
+static void test_draw_default_hidden_change(void **state)
+{
+	struct ui_context *ui = *state;
+
+	/* The items below a hidden one move, so all of them are redrawn */
+	UI_SET_BIT(ui->state->hidden_item_mask, 1);
+	WILL_DRAW_BUTTON("btn_0.bmp");
+	WILL_DRAW_BUTTON("btn_2.bmp");
+
+	assert_int_equal(ui_draw_default(ui, &test_prev_state), VB2_SUCCESS);
+}
+
+static void test_draw_default_force_display(void **state)
+{
+	struct ui_context *ui = *state;
+
+	/* Something else drew over the screen, the state itself is the same */
+	ui->force_display = 1;
+	WILL_DRAW_SCREEN;
+	WILL_DRAW_BUTTON("btn_0.bmp");
+	WILL_DRAW_BUTTON("btn_1.bmp");
+	WILL_DRAW_BUTTON("btn_2.bmp");
+
+	assert_int_equal(ui_draw_default(ui, &test_prev_state), VB2_SUCCESS);
+}
+
+#define UI_TEST(test_function_name) \
+	cmocka_unit_test_setup(test_function_name, setup_ui_context)
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		UI_TEST(test_draw_default_full),
+		UI_TEST(test_draw_default_unchanged),
+		UI_TEST(test_draw_default_focus_change),
+		UI_TEST(test_draw_default_disabled_change),
+		UI_TEST(test_draw_default_hidden_change),
+		UI_TEST(test_draw_default_force_display),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <libpayload.h>
+#include <string.h>
+
+#include "tests/test.h"
+#include "vboot/util/wipe.h"
+
+#define ASSERT_SPLIT(split, h, b, t) do { \
+	assert_int_equal((split).head, h); \
+	assert_int_equal((split).body, b); \
+	assert_int_equal((split).tail, t); \
+} while (0)
+
+static void test_wipe_split_no_primitive(void **state)
+{
+	WipeSplit split;
+
+	wipe_split(0x1003, 0x5000, 0, &split);
+	ASSERT_SPLIT(split, 0x5000, 0, 0);
+}
+
+static void test_wipe_split_aligned(void **state)
+{
+	WipeSplit split;
+
+	wipe_split(0x1000, 0x4000, 64, &split);
+	ASSERT_SPLIT(split, 0, 0x4000, 0);
+}
+
+static void test_wipe_split_unaligned(void **state)
+{
+	WipeSplit split;
+
+	wipe_split(0x1010, 0x100, 64, &split);
+	ASSERT_SPLIT(split, 0x30, 0xc0, 0x10);
+}
+
+static void test_wipe_split_within_block(void **state)
+{
+	WipeSplit split;
+
+	wipe_split(0x1010, 0x20, 64, &split);
+	ASSERT_SPLIT(split, 0x20, 0, 0);
+
+	/* Ends right at a block boundary but doesn't cover a full block */
+	wipe_split(0x1010, 0x30, 64, &split);
+	ASSERT_SPLIT(split, 0x30, 0, 0);
+}
+
+static void test_wipe_split_empty(void **state)
+{
+	WipeSplit split;
+
+	wipe_split(0x1010, 0, 64, &split);
+	ASSERT_SPLIT(split, 0, 0, 0);
+}
+
+static void test_wipe_split_high(void **state)
+{
+	WipeSplit split;
+
+	/* Ranges above 4GB must not be truncated */
+	wipe_split(0x880000020ULL, 0x200000000ULL, 2048, &split);
+	ASSERT_SPLIT(split, 0x7e0, 0x1fffff800ULL, 0x20);
+}
+
+static void test_wipe_split_end_of_space(void **state)
+{
+	WipeSplit split;
+
+	/* Ranges touching the end of the address space fall back to memset */
+	wipe_split(UINT64_MAX - 0xff, 0x100, 64, &split);
+	ASSERT_SPLIT(split, 0x100, 0, 0);
+
+	wipe_split(UINT64_MAX - 0x10, 0x11, 64, &split);
+	ASSERT_SPLIT(split, 0x11, 0, 0);
+}
+
+#define BUF_SIZE (256 * KiB)
+#define GUARD 0x40
+static uint8_t buf[BUF_SIZE + 2 * GUARD]
+	__attribute__((aligned(4096)));
+
+static void check_wipe(size_t offset, size_t size)
+{
+	memset(buf, 0xa5, sizeof(buf));
+	wipe_zero(buf + GUARD + offset, size);
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		bool wiped = i >= GUARD + offset && i < GUARD + offset + size;
+		if (buf[i] != (wiped ? 0 : 0xa5))
+			fail_msg("offset %#zx size %#zx: byte %#zx is %#x",
+				 offset, size, i, buf[i]);
+	}
+}
+
+static void test_wipe_zero(void **state)
+{
+	check_wipe(0, BUF_SIZE);
+	check_wipe(1, BUF_SIZE - 1);
+	check_wipe(0x33, 0x1000);
+	check_wipe(0x1000, 0x7);
+	check_wipe(0x10, 0);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_wipe_split_no_primitive),
+		cmocka_unit_test(test_wipe_split_aligned),
+		cmocka_unit_test(test_wipe_split_unaligned),
+		cmocka_unit_test(test_wipe_split_within_block),
+		cmocka_unit_test(test_wipe_split_empty),
+		cmocka_unit_test(test_wipe_split_high),
+		cmocka_unit_test(test_wipe_split_end_of_space),
+		cmocka_unit_test(test_wipe_zero),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}